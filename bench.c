@@ -0,0 +1,770 @@
+/*----------------------------------------------------------------------------
+ * bench.c
+ *
+ * This program times the louis drawing and output routines without a
+ * terminal. Each workload draws a run of frames onto a Surface and sends them
+ * to a virtual terminal, which checks that every frame arrives intact and
+ * counts what it cost to send:
+ *
+ *     bench [-w width] [-h height] [-n frames] [-t threads] [-l level] [-p | -u] [-b baseline]...
+ *
+ * It prints a line per workload with the time spent drawing and rendering a
+ * frame, the bytes and escape sequences per frame, and the number of cells
+ * the terminal got wrong, which should always be 0. Given the saved output of
+ * earlier runs with -b, for instance of builds with other compiler options,
+ * it adds a column per baseline with the speedup of each workload over it.
+ *
+ * With -l, the kernels are bound for one CPU level by name, or with -l all
+ * for each level the machine supports in turn, so every variant is timed.
+ * The frames drawn at each level are checked against those of the first.
+ *
+ * With -p, the frames are written to STDOUT as they would be to a terminal,
+ * and a pipe carries them to the virtual terminal on a thread of its own,
+ * so that the render column includes waiting for the other end to take
+ * them. -u does the same through io_uring. Only the last frame of each
+ * workload is checked then, since frames written through io_uring may be
+ * replaced by newer ones before they are sent.
+ *----------------------------------------------------------------------------*/
+
+#include <time.h>
+#include <poll.h>
+#include "louis.h"
+
+typedef struct Bench {
+    const char *name;
+    void (*draw)(Surface *s, int frame);
+    int output;
+} Bench;
+
+enum {OUT_RENDER, OUT_DAMAGE, OUT_THROTTLE};
+
+#define MAX_BASELINES 4
+
+typedef struct Baseline {
+    const char *filename;
+    char names[32][16];
+    double times[32];
+    int count;
+} Baseline;
+
+static Baseline baselines[MAX_BASELINES];
+static int nbaselines;
+
+#define NBENCHES (int)(sizeof(benches) / sizeof(benches[0]))
+
+static Surface sprite;
+static Expr wave;
+static DisplayList lists[2];
+static BarSeries candles, boxes;
+static Graph graph;
+static VectorMap map;
+static int threads = 1;
+
+#define NDOTS 4096
+
+static Tweens tweens;
+static float dots[NDOTS][2];
+static float legEnd[NDOTS];
+
+#define NPANES 16
+
+static Chart panes[NPANES];
+static QuantileChart latencies;
+
+/* Where the results go, which isn't STDOUT when the frames are written to
+ * it, and the pipe carrying them to the virtual terminal */
+static FILE *report;
+static int feedFd = -1;
+static pthread_mutex_t feedLock = PTHREAD_MUTEX_INITIALIZER;
+
+/*----------------------------------------------------------------------------
+ * now
+ *
+ *----------------------------------------------------------------------------*/
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*----------------------------------------------------------------------------
+ * Workloads
+ *
+ *----------------------------------------------------------------------------*/
+static void drawLines(Surface *s, int frame)
+{
+    int w = s->width * 2, h = s->height * 4;
+
+    clearSurface(s);
+    for (int i = 0; i < 200; ++i)
+        drawLine(s, rand() % w, rand() % h, rand() % w, rand() % h);
+}
+
+static void drawCurves(Surface *s, int frame)
+{
+    int w = s->width * 2, h = s->height * 4;
+
+    clearSurface(s);
+    for (int i = 0; i < 20; ++i) {
+        float a = (rand() % 200 - 100) / 1000.0f;
+        drawCurve(s, 0, w - 1, a, -a * (w - 1), h / 2 + i);
+    }
+}
+
+static void drawRects(Surface *s, int frame)
+{
+    int w = s->width * 2, h = s->height * 4;
+
+    clearSurface(s);
+    for (int i = 0; i < 50; ++i)
+        drawRect(s, rand() % w, rand() % h, rand() % (w / 4), rand() % (h / 4), i & 1);
+}
+
+static void drawBitmaps(Surface *s, int frame)
+{
+    int w = s->width * 2, h = s->height * 4;
+
+    clearSurface(s);
+    for (int i = 0; i < 20; ++i)
+        drawBitmap(s, &sprite, rand() % w - sprite.width / 2, rand() % h - sprite.height / 2);
+}
+
+static void drawDither(Surface *s, int frame)
+{
+    int w = s->width * 2, h = s->height * 4;
+
+    clearSurface(s);
+    for (int y = 0; y < h; ++y)
+        for (int x = 0; x < w; ++x)
+            drawDitheredPoint(s, x, y, (float)((x + frame) % w) / w);
+}
+
+static void drawSpan(Surface *s, int frame)
+{
+    int w = s->width * 2, h = s->height * 4;
+    float *row = (float *)malloc(w * sizeof(float));
+
+    clearSurface(s);
+    for (int x = 0; x < w; ++x)
+        row[x] = (float)((x + frame) % w) / w;
+    for (int y = 0; y < h; ++y)
+        drawDitheredSpan(s, 0, y, row, w);
+    free(row);
+}
+
+static void drawExpr(Surface *s, int frame)
+{
+    clearSurface(s);
+    setExprParam(&wave, 't', frame * 0.05f);
+    plotExpr(s, &wave, -10, 10, -2, 2);
+}
+
+static void drawScroll(Surface *s, int frame)
+{
+    int h = s->height * 4;
+
+    scrollSurface(s, -1, 0);
+    for (int y = 0; y < h; ++y)
+        drawPoint(s, s->width * 2 - 1, y, rand() & 1);
+}
+
+/* A small box moving over a fixed background, drawn from display lists */
+static void drawMoving(Surface *s, int frame)
+{
+    DisplayList *dl = &lists[frame & 1];
+    int w = s->width * 2, h = s->height * 4;
+
+    resetDisplayList(dl);
+    addClear(dl);
+    for (int i = 0; i < 8; ++i)
+        addLine(dl, 0, i * h / 8, w - 1, h - 1 - i * h / 8);
+    addRect(dl, (frame * 3) % (w - 16), h / 2, 16, 16, 1);
+}
+
+/* Thousands of dots, each sent to a new place whenever it arrives */
+static void drawTweens(Surface *s, int frame)
+{
+    int w = s->width * 2, h = s->height * 4;
+
+    if (frame == 0) {
+        freeTweens(&tweens);
+        initTweens(&tweens);
+        for (int i = 0; i < NDOTS; ++i) {
+            dots[i][0] = rand() % w;
+            dots[i][1] = rand() % h;
+            legEnd[i] = 0;
+        }
+    }
+
+    for (int i = 0; i < NDOTS; ++i) {
+        if (legEnd[i] > tweens.time)
+            continue;
+        float duration = 0.2f + (rand() % 100) / 100.0f;
+        addTween(&tweens, &dots[i][0], dots[i][0], rand() % w, 0, duration, i % EASE_COUNT);
+        addTween(&tweens, &dots[i][1], dots[i][1], rand() % h, 0, duration, i % EASE_COUNT);
+        legEnd[i] = tweens.time + duration;
+    }
+    updateTweens(&tweens, 0.02f);
+
+    clearSurface(s);
+    for (int i = 0; i < NDOTS; ++i)
+        drawPoint(s, dots[i][0], dots[i][1], 1);
+}
+
+/* As many dots again, each walked about by a script that rests now and then */
+typedef struct Walker {
+    float w, h;
+    float dx, dy;
+    int steps;
+} Walker;
+
+static Scripts scripts;
+
+static int walk(Script *sc)
+{
+    Walker *wk = (Walker *)sc->locals;
+    float *dot = (float *)sc->arg;
+
+    SCRIPT_BEGIN(sc);
+    while (1) {
+        wk->dx = (rand() % 5 - 2) * 0.5f;
+        wk->dy = (rand() % 5 - 2) * 0.5f;
+        for (wk->steps = rand() % 40; wk->steps > 0; --wk->steps) {
+            dot[0] = fmodf(dot[0] + wk->dx + wk->w, wk->w);
+            dot[1] = fmodf(dot[1] + wk->dy + wk->h, wk->h);
+            NEXT_FRAME(sc);
+        }
+        WAIT_SECONDS(sc, (rand() % 50) / 100.0f);
+    }
+    SCRIPT_END(sc);
+}
+
+static void drawScripts(Surface *s, int frame)
+{
+    int w = s->width * 2, h = s->height * 4;
+
+    if (frame == 0) {
+        freeScripts(&scripts);
+        Walker wk = {(float)w, (float)h, 0, 0, 0};
+        for (int i = 0; i < NDOTS; ++i) {
+            dots[i][0] = rand() % w;
+            dots[i][1] = rand() % h;
+            startScript(&scripts, walk, dots[i], &wk, sizeof(wk));
+        }
+    }
+    runScripts(&scripts, 0.02f);
+
+    clearSurface(s);
+    for (int i = 0; i < NDOTS; ++i)
+        drawPoint(s, dots[i][0], dots[i][1], 1);
+}
+
+/* The dots again as a series on a log scale, under a transform that turns
+ * a little each frame */
+static void drawTransformed(Surface *s, int frame)
+{
+    int w = s->width * 2, h = s->height * 4;
+    float *x = (float *)malloc(NDOTS * 2 * sizeof(float));
+    float *y = x + NDOTS;
+
+    for (int i = 0; i < NDOTS; ++i) {
+        x[i] = i;
+        y[i] = expf((i + frame * 16) % NDOTS * 0.004f) * (1.1f + sinf(i * 0.05f));
+    }
+
+    clearSurface(s);
+    pushTransform();
+    translateView(w / 2, h / 2);
+    rotateView(frame * 0.01f);
+    translateView(-w / 2, -h / 2);
+    scaleView(w - 1, h - 1);
+    setAxisScale(AXIS_X, SCALE_LINEAR, 0, NDOTS - 1, 0);
+    setAxisScale(AXIS_Y, SCALE_LOG, 0.1f, 40000, 0);
+    drawPolyline(s, x, y, NDOTS);
+    setAxisScale(AXIS_Y, SCALE_SYMLOG, -10, 40000, 1);
+    drawPoints(s, x, y, NDOTS);
+    popTransform();
+
+    free(x);
+}
+
+/* Sixteen charts, a formula and a map sharing the screen, drawn at full
+ * detail and at the least detail a frame under pressure is drawn at */
+static void drawPanesAt(Surface *s, int frame, float detail)
+{
+    int w = s->width * 2, h = s->height * 4;
+
+    for (int i = 0; i < NPANES; ++i) {
+        if (frame == 0)
+            panes[i].count = panes[i].next = 0;
+        for (int n = (frame == 0) ? w / 4 : 1; n > 0; --n) {
+            float v = (panes[i].count ? panes[i].values[(panes[i].next + panes[i].capacity - 1) % panes[i].capacity] : 0)
+                    + (rand() % 201 - 100) / 100.0f;
+            chartPush(&panes[i], &v, 1);
+        }
+    }
+
+    setFrameDetail(detail);
+    clearSurface(s);
+    setExprParam(&wave, 't', frame * 0.05f);
+    plotExpr(s, &wave, -10, 10, -2, 2);
+    drawMap(s, &map, 0, 0, w, h, 500, 500, 0.8f);
+    for (int i = 0; i < NPANES; ++i)
+        drawChart(s, &panes[i], (i % 4) * (w / 4), (i / 4) * (h / 4), w / 4 - 2, h / 4 - 2);
+    setFrameDetail(1.0f);
+}
+
+static void drawPanes(Surface *s, int frame)
+{
+    drawPanesAt(s, frame, 1.0f);
+}
+
+static void drawPanesCoarse(Surface *s, int frame)
+{
+    drawPanesAt(s, frame, LOD_MIN);
+}
+
+/* Twenty thousand latencies a frame, spread wider now and then, drawn as
+ * bands a frame to a column */
+static void drawQuantiles(Surface *s, int frame)
+{
+    int w = s->width * 2, h = s->height * 4;
+
+    if (frame == 0) {
+        freeQuantileChart(&latencies);
+        initQuantileChart(&latencies, w, 0.001f);
+    } else {
+        advanceQuantileChart(&latencies);
+    }
+
+    float spread = (frame / 50 % 2) ? 1.5f : 0.5f;
+    for (int i = 0; i < 20000; ++i) {
+        float u = (rand() % 1000 + 0.5f) / 1000.0f;
+        recordQuantile(&latencies, 20.0f * expf(spread * logf(u / (1 - u))));
+    }
+
+    clearSurface(s);
+    drawQuantileChart(s, &latencies, 0, 0, w, h);
+}
+
+/* A year of minute candles zoomed in from all of it, over two days of
+ * hourly latency boxes */
+static void drawBarSeries(Surface *s, int frame)
+{
+    int w = s->width * 2, h = s->height * 4;
+    long count = barCount(&candles) >> (frame % 12);
+
+    clearSurface(s);
+    drawBars(s, &candles, barCount(&candles) - count, count, 0, h / 2, w, h / 2, 0, 0);
+    drawBars(s, &boxes, barCount(&boxes) - 48, 48, 0, 0, w, h / 2 - 4, 0, 0);
+}
+
+/* A graph of 2000 nodes laid out a step a frame, from scratch each run */
+static void drawGraphLayout(Surface *s, int frame)
+{
+    if (frame == 0) {
+        if (graph.cap)
+            freeGraph(&graph);
+        initGraph(&graph, threads);
+        for (int i = 0; i < 2000; ++i) {
+            addNode(&graph);
+            if (i > 0)
+                addEdge(&graph, i, rand() % i);
+        }
+    }
+    layoutGraph(&graph, 1);
+
+    clearSurface(s);
+    drawGraph(s, &graph, 0, 0, s->width * 2, s->height * 4, 1);
+}
+
+/* Half a million vertices of wandering lines, zoomed in on step by step */
+static void drawVectorMap(Surface *s, int frame)
+{
+    float scale = 0.2f * (1 << (frame % 12));
+
+    clearSurface(s);
+    drawMap(s, &map, 0, 0, s->width * 2, s->height * 4, 500, 500, scale);
+}
+
+static Bench benches[] = {
+    {"lines", drawLines, OUT_RENDER},
+    {"curves", drawCurves, OUT_RENDER},
+    {"rects", drawRects, OUT_RENDER},
+    {"bitmaps", drawBitmaps, OUT_RENDER},
+    {"dither", drawDither, OUT_RENDER},
+    {"span", drawSpan, OUT_RENDER},
+    {"expr", drawExpr, OUT_RENDER},
+    {"scroll", drawScroll, OUT_RENDER},
+    {"tweens", drawTweens, OUT_RENDER},
+    {"scripts", drawScripts, OUT_RENDER},
+    {"transform", drawTransformed, OUT_RENDER},
+    {"bars", drawBarSeries, OUT_RENDER},
+    {"graph", drawGraphLayout, OUT_RENDER},
+    {"map", drawVectorMap, OUT_RENDER},
+    {"quantiles", drawQuantiles, OUT_RENDER},
+    {"panes", drawPanes, OUT_RENDER},
+    {"panes-lod", drawPanesCoarse, OUT_RENDER},
+    {"damage", drawMoving, OUT_DAMAGE},
+    {"throttle", drawDither, OUT_THROTTLE},
+};
+
+/*----------------------------------------------------------------------------
+ * makeBars
+ *
+ * Made-up prices for a year of minutes, and latencies for a year of hours.
+ *----------------------------------------------------------------------------*/
+static void makeBars()
+{
+    float price = 100;
+
+    initBarSeries(&candles, BARS_CANDLE);
+    initBarSeries(&boxes, BARS_BOX);
+    for (int i = 0; i < 365 * 24 * 60; ++i) {
+        float open = price;
+        price += (rand() % 201 - 100) / 400.0f;
+        float top = (open > price) ? open : price, bottom = (open > price) ? price : open;
+        addCandle(&candles, open, top + (rand() % 50) / 100.0f, bottom - (rand() % 50) / 100.0f, price);
+        if (i % 60 == 0) {
+            float median = 20 + rand() % 10;
+            addBox(&boxes, median / 2, median * 0.8f, median, median * 1.5f, median * (3 + rand() % 5));
+        }
+    }
+}
+
+/*----------------------------------------------------------------------------
+ * makeMap
+ *
+ * Random walks over a 1000 by 1000 world, 256 vertices each.
+ *----------------------------------------------------------------------------*/
+static void makeMap()
+{
+    float xy[512];
+
+    initMap(&map);
+    for (int i = 0; i < 2000; ++i) {
+        xy[0] = rand() % 1000;
+        xy[1] = rand() % 1000;
+        for (int j = 1; j < 256; ++j) {
+            xy[j * 2] = xy[j * 2 - 2] + (rand() % 201 - 100) / 50.0f;
+            xy[j * 2 + 1] = xy[j * 2 - 1] + (rand() % 201 - 100) / 50.0f;
+        }
+        addMapFeature(&map, xy, 256);
+    }
+    buildMap(&map);
+}
+
+/*----------------------------------------------------------------------------
+ * makeSprite
+ *
+ * A filled circle, so the benchmark doesn't depend on any image file.
+ *----------------------------------------------------------------------------*/
+static void makeSprite(int size)
+{
+    sprite.width = size;
+    sprite.height = size;
+    sprite.data = (unsigned char *)malloc(size * size);
+    for (int y = 0; y < size; ++y)
+        for (int x = 0; x < size; ++x)
+            sprite.data[y * size + x] = (x - size / 2) * (x - size / 2) + (y - size / 2) * (y - size / 2) < size * size / 4;
+}
+
+/*----------------------------------------------------------------------------
+ * loadBaseline, baselineTime
+ *
+ * Read the output of an earlier run, and look up the time per frame it took
+ * for a workload, or 0 if it doesn't have it.
+ *----------------------------------------------------------------------------*/
+static int loadBaseline(Baseline *b, const char *filename)
+{
+    char line[256];
+    double draw, render;
+
+    FILE *fp = fopen(filename, "r");
+    if (!fp)
+        return -1;
+
+    b->filename = filename;
+    while (fgets(line, sizeof(line), fp) && b->count < 32) {
+        if (sscanf(line, "%15s %lf %lf", b->names[b->count], &draw, &render) == 3) {
+            b->times[b->count] = draw + render;
+            ++b->count;
+        }
+    }
+    fclose(fp);
+
+    return 0;
+}
+
+static double baselineTime(Baseline *b, const char *name)
+{
+    for (int i = 0; i < b->count; ++i)
+        if (!strcmp(b->names[i], name))
+            return b->times[i];
+    return 0;
+}
+
+/*----------------------------------------------------------------------------
+ * feedTerminal, settleTerminal
+ *
+ * Pass what comes down the pipe to the virtual terminal until it is closed,
+ * and wait until everything written so far has been passed on. The lock is
+ * held from reading a piece to feeding it, so that once the pipe is seen
+ * empty under it the terminal has had every byte.
+ *----------------------------------------------------------------------------*/
+static void *feedTerminal(void *arg)
+{
+    VTerm *vt = (VTerm *)arg;
+    unsigned char buf[65536];
+    struct pollfd pfd = {feedFd, POLLIN, 0};
+
+    while (poll(&pfd, 1, -1) > 0) {
+        pthread_mutex_lock(&feedLock);
+        int n = read(feedFd, buf, sizeof(buf));
+        if (n > 0)
+            feedVTerm(vt, buf, n);
+        pthread_mutex_unlock(&feedLock);
+        if (n <= 0)
+            break;
+    }
+
+    return NULL;
+}
+
+static void settleTerminal()
+{
+    int queued = 1;
+
+    if (feedFd < 0)
+        return;
+
+    flushOutput();
+    while (queued) {
+        pthread_mutex_lock(&feedLock);
+        if (ioctl(feedFd, FIONREAD, &queued) < 0)
+            queued = 0;
+        pthread_mutex_unlock(&feedLock);
+        if (queued)
+            usleep(100);
+    }
+}
+
+/*----------------------------------------------------------------------------
+ * runBench
+ *
+ * Run a workload for a number of frames and print its line. Return a
+ * checksum of the frames drawn.
+ *----------------------------------------------------------------------------*/
+static unsigned int runBench(Bench *bench, Surface *s, VTerm *vt, int frames)
+{
+    int width = s->width, height = s->height;
+    unsigned int sum = 2166136261u;
+    double drawTime = 0, renderTime = 0;
+    long wrong = 0;
+    DamageRegion dr;
+    Throttle t;
+
+    srand(1);
+    initDamageRegion(&dr);
+    initThrottle(&t, width * height / 2);
+    resetDisplayList(&lists[0]);
+    resetDisplayList(&lists[1]);
+    clearSurface(s);
+    render(s);
+    settleTerminal();
+    resetVTermStats(vt);
+
+    for (int f = 0; f < frames; ++f) {
+        double t0 = now();
+        bench->draw(s, f);
+        if (bench->output == OUT_DAMAGE) {
+            clearDamage(&dr);
+            if (f == 0)
+                addDamage(&dr, 0, 0, width - 1, height - 1);
+            else
+                diffDisplayLists(&lists[(f + 1) & 1], &lists[f & 1], s, &dr);
+            mergeDamage(&dr, s);
+            redrawDamage(&lists[f & 1], s, &dr);
+        }
+        double t1 = now();
+        if (bench->output == OUT_DAMAGE)
+            renderDamage(s, &dr);
+        else if (bench->output == OUT_THROTTLE)
+            renderThrottled(s, &t);
+        else
+            render(s);
+        double t2 = now();
+
+        drawTime += t1 - t0;
+        renderTime += t2 - t1;
+
+        for (int i = 0; i < width * height; ++i)
+            sum = (sum ^ s->data[i]) * 16777619u;
+
+        /* A throttled screen is only expected to match once it settles */
+        if (bench->output != OUT_THROTTLE && feedFd < 0)
+            wrong += compareVTerm(vt, s);
+    }
+    if (bench->output == OUT_THROTTLE) {
+        while (renderThrottled(s, &t) > 0)
+            ;
+    }
+    if (bench->output == OUT_THROTTLE || feedFd >= 0) {
+        settleTerminal();
+        wrong += compareVTerm(vt, s);
+    }
+
+    fprintf(report, "%-10s %12.1f %12.1f %12ld %10ld %8ld", bench->name, drawTime * 1e6 / frames,
+           renderTime * 1e6 / frames, vt->bytes / frames, vt->escapes / frames, wrong);
+    for (int i = 0; i < nbaselines; ++i) {
+        double before = baselineTime(&baselines[i], bench->name);
+        int columns = strlen(baselines[i].filename) + 3;
+        if (before > 0)
+            fprintf(report, "  %*.2fx", columns - 1, before / ((drawTime + renderTime) * 1e6 / frames));
+        else
+            fprintf(report, "  %*s", columns, "-");
+    }
+    fprintf(report, "\n");
+
+    freeDamageRegion(&dr);
+    freeThrottle(&t);
+
+    return sum;
+}
+
+/*----------------------------------------------------------------------------
+ * main
+ *
+ *----------------------------------------------------------------------------*/
+int main(int argc, char **argv)
+{
+    int width = 200, height = 60, frames = 200;
+    int first = CPU_BEST, last = CPU_BEST;
+    unsigned int checksums[NBENCHES];
+    int output = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "w:h:n:t:l:pub:")) != -1) {
+        if (opt == 'w' && (width = atoi(optarg)) > 0)
+            continue;
+        if (opt == 'h' && (height = atoi(optarg)) > 0)
+            continue;
+        if (opt == 'n' && (frames = atoi(optarg)) > 0)
+            continue;
+        if (opt == 't' && (threads = atoi(optarg)) > 0)
+            continue;
+        if (opt == 'l' && !strcmp(optarg, "all")) {
+            first = CPU_GENERIC;
+            continue;
+        }
+        if (opt == 'l' && (first = last = cpuLevelByName(optarg)) != CPU_BEST)
+            continue;
+        if (opt == 'p' || opt == 'u') {
+            output = opt;
+            continue;
+        }
+        if (opt == 'b' && nbaselines < MAX_BASELINES) {
+            if (loadBaseline(&baselines[nbaselines], optarg) < 0) {
+                perror(optarg);
+                return 1;
+            }
+            ++nbaselines;
+            continue;
+        }
+        fprintf(stderr, "usage: %s [-w width] [-h height] [-n frames] [-t threads] [-l level] [-p | -u] [-b baseline]...\n",
+                argv[0]);
+        return 1;
+    }
+
+    genBrailleTab();
+    genGridTabs();
+    makeSprite(32);
+    makeBars();
+    makeMap();
+    for (int i = 0; i < NPANES; ++i)
+        initChart(&panes[i], width * 2);
+    compileExpr(&wave, "sin(x + t) * cos(x * 3 - t)");
+    initDisplayList(&lists[0]);
+    initDisplayList(&lists[1]);
+    setRenderThreads(threads);
+
+    /* Levels the machine doesn't support are left out */
+    if (last == CPU_BEST)
+        last = detectCpuLevel();
+    if (first == CPU_BEST || first > last)
+        first = last;
+
+    Surface s = {(unsigned char *)calloc(width * height, 1), width, height};
+    VTerm vt;
+    initVTerm(&vt, width, height);
+    report = stdout;
+
+    pthread_t feeder;
+    if (output) {
+        int fds[2];
+        if (output == 'u' && useIoUring(1) < 0) {
+            fprintf(stderr, "%s: io_uring is not available\n", argv[0]);
+            return 1;
+        }
+        if (pipe(fds) < 0) {
+            perror("pipe");
+            return 1;
+        }
+        report = fdopen(dup(1), "w");
+        dup2(fds[1], 1);
+        close(fds[1]);
+        feedFd = fds[0];
+        pthread_create(&feeder, NULL, feedTerminal, &vt);
+    } else {
+        setOutputSink(&vt);
+    }
+
+    for (int level = first; level <= last; ++level) {
+        setCpuLevel(level);
+        if (first != last)
+            fprintf(report, "%scpu %s\n", level == first ? "" : "\n", cpuLevelNames[level]);
+
+        fprintf(report, "%-10s %12s %12s %12s %10s %8s", "workload", "draw us", "render us", "bytes", "escapes", "wrong");
+        for (int i = 0; i < nbaselines; ++i)
+            fprintf(report, "  vs %s", baselines[i].filename);
+        fprintf(report, "\n");
+
+        for (int b = 0; b < NBENCHES; ++b) {
+            unsigned int sum = runBench(&benches[b], &s, &vt, frames);
+            if (level == first)
+                checksums[b] = sum;
+            else if (sum != checksums[b])
+                fprintf(report, "%-10s drew different frames than at %s\n", benches[b].name, cpuLevelNames[first]);
+        }
+    }
+
+    setOutputSink(NULL);
+    if (output) {
+        useIoUring(0);
+        close(1);
+        pthread_join(feeder, NULL);
+        close(feedFd);
+        fclose(report);
+    }
+    setRenderThreads(1);
+    freeVTerm(&vt);
+    freeDisplayList(&lists[0]);
+    freeDisplayList(&lists[1]);
+    freeExpr(&wave);
+    freeTweens(&tweens);
+    freeScripts(&scripts);
+    freeBarSeries(&candles);
+    freeBarSeries(&boxes);
+    if (graph.cap)
+        freeGraph(&graph);
+    freeMap(&map);
+    for (int i = 0; i < NPANES; ++i)
+        freeChart(&panes[i]);
+    freeQuantileChart(&latencies);
+    free(sprite.data);
+    free(s.data);
+    free(screenBuffer);
+
+    return 0;
+}
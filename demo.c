@@ -6,6 +6,9 @@
 
 #include "louis.h"
 
+#define BMP_WIDTH 128
+#define BMP_HEIGHT 154
+
 /*----------------------------------------------------------------------------
  * main
  *
@@ -14,18 +17,31 @@ int main()
 {
     char c;
     float a = 0.1;
-    float d = 0.01;
 
     initLouis();
 
     Surface s;
     initSurface(&s);
 
-    Surface bmp = loadBitmap("louis.bmp");
-    initSurface(&s);
+    /* The picture loads in the background, and a placeholder stands in for
+     * it until then, so the first frame doesn't wait for it. */
+    AssetLoader al;
+    initAssetLoader(&al, 1);
+    Asset *bmp = requestAsset(&al, "louis.bmp", BMP_WIDTH, BMP_HEIGHT);
+
+    /* Everything but the curves looks the same from frame to frame, so it
+     * is drawn through a rasterization cache. */
+    RasterCache rc;
+    initRasterCache(&rc, 1 << 20);
+
+    /* The curves swing back and forth, turning round each time their
+     * tween finishes */
+    Tweens tw;
+    initTweens(&tw);
+    addTween(&tw, &a, a, 0.5, 0, 0.8, EASE_OUT);
 
     while (1) {
-        read(0, &c, 1);
+        readInput(&c, 1);
         if (c == 'q') {
             break;
         }
@@ -36,22 +52,26 @@ int main()
 
         drawCurve(&s, 0, 80, a, 10, 87);
         drawCurve(&s, 0, 80, -a, 10, 1000);
-        drawBitmap(&s, &bmp, 85, 0);
-        drawRect(&s, 200, 100, 20, 20, 1);
-        drawRect(&s, 250, 50, 20, 20, 1);
-        drawRect(&s, 300, 10, 20, 20, 1);
-        drawLine(&s, 200, 150, 280, 150);
-        drawLine(&s, 200, 150, 280, 100);
+        if (assetReady(bmp))
+            cachedBitmap(&rc, &s, &bmp->bitmap, 85, 0);
+        else
+            drawAsset(&s, bmp, 85, 0);
+        cachedRect(&rc, &s, 200, 100, 20, 20, 1);
+        cachedRect(&rc, &s, 250, 50, 20, 20, 1);
+        cachedRect(&rc, &s, 300, 10, 20, 20, 1);
+        cachedLine(&rc, &s, 200, 150, 280, 150);
+        cachedLine(&rc, &s, 200, 150, 280, 100);
 
         render(&s);
 
-        a += d;
-        if (a > 0.5 || a < -0.5) {
-            d *= -1;
-        }
+        if (updateTweens(&tw, 0.02))
+            addTween(&tw, &a, a, a > 0 ? -0.5 : 0.5, 0, 2, EASE_IN_OUT);
     }
 
     endLouis();
+    freeRasterCache(&rc);
+    freeTweens(&tw);
+    freeAssetLoader(&al);
     free(s.data);
 
     return 0;
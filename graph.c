@@ -0,0 +1,181 @@
+/*----------------------------------------------------------------------------
+ * graph.c
+ *
+ * This program draws a graph, such as the dependencies between services, as
+ * circles joined by lines and lays it out while it is on the screen. The
+ * graph is read from a file with one edge per line, given as the names of
+ * the two nodes it joins, optionally with -> between them:
+ *
+ *     graph deps.txt
+ *     graph -t 4 -g 5000
+ *
+ * Lines starting with # are left out. With -g, a random graph of the given
+ * number of nodes is made up instead, a tree with a few more edges across.
+ * -t sets the threads the layout runs on, -s the layout steps per frame,
+ * and -r the radius of the nodes in dots. q quits.
+ *----------------------------------------------------------------------------*/
+
+#include "louis.h"
+
+#define MAX_NAME 64
+
+static char (*names)[MAX_NAME];
+static int *slots;
+static int slotCount;
+
+/*----------------------------------------------------------------------------
+ * findNode
+ *
+ * Look a node up by name in an open-addressed hash table, adding it to the
+ * graph the first time it is seen.
+ *----------------------------------------------------------------------------*/
+static int findNode(Graph *g, const char *name)
+{
+    unsigned int h = 2166136261u;
+
+    for (const char *p = name; *p; ++p)
+        h = (h ^ (unsigned char)*p) * 16777619u;
+
+    /* Keep the table at most half full */
+    if (g->count * 2 >= slotCount) {
+        int *old = slots, oldCount = slotCount;
+        slotCount = slotCount ? slotCount * 2 : 1024;
+        slots = (int *)malloc(slotCount * sizeof(int));
+        memset(slots, -1, slotCount * sizeof(int));
+        for (int i = 0; i < oldCount; ++i) {
+            if (old[i] < 0)
+                continue;
+            unsigned int k = 2166136261u;
+            for (const char *p = names[old[i]]; *p; ++p)
+                k = (k ^ (unsigned char)*p) * 16777619u;
+            while (slots[k & (slotCount - 1)] >= 0)
+                ++k;
+            slots[k & (slotCount - 1)] = old[i];
+        }
+        free(old);
+    }
+
+    for (;; ++h) {
+        int i = slots[h & (slotCount - 1)];
+        if (i < 0)
+            break;
+        if (!strcmp(names[i], name))
+            return i;
+    }
+
+    int i = addNode(g);
+    names = (char (*)[MAX_NAME])realloc(names, g->cap * MAX_NAME);
+    snprintf(names[i], MAX_NAME, "%s", name);
+    slots[h & (slotCount - 1)] = i;
+
+    return i;
+}
+
+/*----------------------------------------------------------------------------
+ * readGraph
+ *
+ * Return the number of edges read, or -1 if the file can't be opened.
+ *----------------------------------------------------------------------------*/
+static int readGraph(Graph *g, const char *filename)
+{
+    char line[512], a[MAX_NAME], b[MAX_NAME], arrow[8];
+    int edges = 0;
+
+    FILE *fp = fopen(filename, "r");
+    if (!fp)
+        return -1;
+
+    while (fgets(line, sizeof(line), fp)) {
+        if (line[0] == '#')
+            continue;
+        if (sscanf(line, "%63s %7s %63s", a, arrow, b) == 3 && !strcmp(arrow, "->"))
+            ;
+        else if (sscanf(line, "%63s %63s", a, b) != 2)
+            continue;
+        int na = findNode(g, a);
+        addEdge(g, na, findNode(g, b));
+        ++edges;
+    }
+    fclose(fp);
+
+    return edges;
+}
+
+/*----------------------------------------------------------------------------
+ * makeGraph
+ *
+ *----------------------------------------------------------------------------*/
+static void makeGraph(Graph *g, int n)
+{
+    for (int i = 0; i < n; ++i) {
+        addNode(g);
+        if (i > 0)
+            addEdge(g, i, rand() % i);
+    }
+    for (int i = 0; i < n / 20; ++i)
+        addEdge(g, rand() % n, rand() % n);
+}
+
+/*----------------------------------------------------------------------------
+ * main
+ *
+ *----------------------------------------------------------------------------*/
+int main(int argc, char **argv)
+{
+    int threads = 1, steps = 2, radius = 1, generate = 0;
+    int opt;
+    char c;
+
+    while ((opt = getopt(argc, argv, "t:s:r:g:")) != -1) {
+        if (opt == 't' && (threads = atoi(optarg)) > 0)
+            continue;
+        if (opt == 's' && (steps = atoi(optarg)) > 0)
+            continue;
+        if (opt == 'r' && (radius = atoi(optarg)) >= 0)
+            continue;
+        if (opt == 'g' && (generate = atoi(optarg)) > 0)
+            continue;
+        fprintf(stderr, "usage: %s [-t threads] [-s steps] [-r radius] [-g nodes | file]\n", argv[0]);
+        return 1;
+    }
+    if ((optind < argc) == (generate > 0)) {
+        fprintf(stderr, "usage: %s [-t threads] [-s steps] [-r radius] [-g nodes | file]\n", argv[0]);
+        return 1;
+    }
+
+    Graph g;
+    initGraph(&g, threads);
+
+    if (generate) {
+        makeGraph(&g, generate);
+    } else if (readGraph(&g, argv[optind]) < 0) {
+        perror(argv[optind]);
+        return 1;
+    }
+
+    initLouis();
+
+    Surface s;
+    initSurface(&s);
+
+    while (1) {
+        if (readInput(&c, 1) == 1 && c == 'q')
+            break;
+
+        layoutGraph(&g, steps);
+
+        clearSurface(&s);
+        drawGraph(&s, &g, 0, 0, s.width * 2, s.height * 4, radius);
+        render(&s);
+
+        usleep(20000);
+    }
+
+    endLouis();
+    freeGraph(&g);
+    free(s.data);
+    free(names);
+    free(slots);
+
+    return 0;
+}
@@ -0,0 +1,269 @@
+/*----------------------------------------------------------------------------
+ * latency.c
+ *
+ * This program measures how long a louis program takes to answer a key with
+ * a new frame, as seen from the terminal's side. It runs the program on a
+ * pseudo-terminal, for example:
+ *
+ *     latency -n 200 -k '\e[C' -- ./plot "sin(x)"
+ *
+ * and presses the key over and over, timing from each press to the end of
+ * the first frame that shows something new. Frames are told apart by the
+ * escape sequence render starts each one with. A frame only counts as the
+ * answer if it began after the key was sent and differs from the frame shown
+ * before, so for a program that animates on its own the figure is a lower
+ * bound.
+ *
+ * At the end it prints the distribution of these latencies, and the frames
+ * and bytes per second the program kept up over the whole run.
+ *----------------------------------------------------------------------------*/
+
+#include <poll.h>
+#include <pty.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+typedef struct Frame {
+    double start;
+    double end;
+    unsigned int hash;
+    int open;
+} Frame;
+
+static int master;
+static Frame current, last;
+static int matched;
+static long frames;
+static long bytes;
+
+/*----------------------------------------------------------------------------
+ * now
+ *
+ *----------------------------------------------------------------------------*/
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*----------------------------------------------------------------------------
+ * unescape
+ *
+ * Turn \e, \r, \n, \t, \\ and \xHH in a key given on the command line into
+ * the bytes they stand for. Return the length.
+ *----------------------------------------------------------------------------*/
+static int unescape(char *dst, const char *src)
+{
+    int n = 0;
+
+    while (*src) {
+        if (*src != '\\' || !src[1]) {
+            dst[n++] = *src++;
+            continue;
+        }
+        switch (*++src) {
+        case 'e': dst[n++] = 0x1B; break;
+        case 'r': dst[n++] = '\r'; break;
+        case 'n': dst[n++] = '\n'; break;
+        case 't': dst[n++] = '\t'; break;
+        case 'x': {
+            unsigned int c = 0;
+            sscanf(src + 1, "%2x", &c);
+            dst[n++] = c;
+            src += (src[1] && src[2]) ? 2 : 0;
+            break;
+        }
+        default: dst[n++] = *src; break;
+        }
+        ++src;
+    }
+
+    return n;
+}
+
+/*----------------------------------------------------------------------------
+ * closeFrame, readOutput
+ *
+ * Read what the program writes for up to timeout milliseconds, cutting it
+ * into frames. A frame ends where the next one starts, or when the output
+ * goes quiet. Return -1 once the program has gone away.
+ *----------------------------------------------------------------------------*/
+static void closeFrame()
+{
+    if (!current.open)
+        return;
+    current.open = 0;
+    last = current;
+    ++frames;
+}
+
+static int readOutput(int timeout)
+{
+    static const char start[] = "\x1b[?25l";
+    unsigned char buf[65536];
+    struct pollfd pfd = {master, POLLIN, 0};
+
+    int ready = poll(&pfd, 1, timeout);
+    if (ready == 0) {
+        closeFrame();
+        return 0;
+    }
+
+    int n = read(master, buf, sizeof(buf));
+    if (n <= 0)
+        return -1;
+
+    double t = now();
+    bytes += n;
+
+    for (int i = 0; i < n; ++i) {
+        matched = (buf[i] == (unsigned char)start[matched]) ? matched + 1 : (buf[i] == 0x1B);
+        if (matched == (int)sizeof(start) - 1) {
+            closeFrame();
+            current.open = 1;
+            current.start = t;
+            current.hash = 2166136261u;
+            matched = 0;
+        }
+        current.hash = (current.hash ^ buf[i]) * 16777619u;
+    }
+    current.end = t;
+
+    return n;
+}
+
+/*----------------------------------------------------------------------------
+ * compareTimes
+ *
+ *----------------------------------------------------------------------------*/
+static int compareTimes(const void *a, const void *b)
+{
+    double da = *(const double *)a, db = *(const double *)b;
+    return (da > db) - (da < db);
+}
+
+/*----------------------------------------------------------------------------
+ * main
+ *
+ *----------------------------------------------------------------------------*/
+int main(int argc, char **argv)
+{
+    struct winsize ws = {40, 120, 0, 0};
+    int presses = 100, interval = 50, settle = 500;
+    char key[64], quit[64];
+    int keyLen = unescape(key, "\\e[C"), quitLen = unescape(quit, "q");
+    int opt, status;
+
+    while ((opt = getopt(argc, argv, "n:i:s:k:q:c:r:")) != -1) {
+        if (opt == 'n' && (presses = atoi(optarg)) > 0)
+            continue;
+        if (opt == 'i' && (interval = atoi(optarg)) > 0)
+            continue;
+        if (opt == 's' && (settle = atoi(optarg)) >= 0)
+            continue;
+        if (opt == 'k' && strlen(optarg) < sizeof(key)) {
+            keyLen = unescape(key, optarg);
+            continue;
+        }
+        if (opt == 'q' && strlen(optarg) < sizeof(quit)) {
+            quitLen = unescape(quit, optarg);
+            continue;
+        }
+        if (opt == 'c' && (ws.ws_col = atoi(optarg)) > 0)
+            continue;
+        if (opt == 'r' && (ws.ws_row = atoi(optarg)) > 0)
+            continue;
+        fprintf(stderr, "usage: %s [-n presses] [-i interval ms] [-s settle ms] [-k key] [-q quit key] "
+                "[-c columns] [-r rows] -- program [args]\n", argv[0]);
+        return 1;
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "%s: no program to run\n", argv[0]);
+        return 1;
+    }
+
+    pid_t pid = forkpty(&master, NULL, NULL, &ws);
+    if (pid < 0) {
+        perror("forkpty");
+        return 1;
+    }
+    if (pid == 0) {
+        execvp(argv[optind], argv + optind);
+        perror(argv[optind]);
+        _exit(127);
+    }
+
+    double *times = (double *)malloc(presses * sizeof(double));
+    int answered = 0, missed = 0;
+
+    /* Let the program start up and draw its first frames */
+    double begin = now();
+    while (now() - begin < settle / 1000.0)
+        if (readOutput(10) < 0)
+            break;
+    begin = now();
+    frames = 0;
+    bytes = 0;
+
+    for (int i = 0; i < presses; ++i) {
+        double until = now() + interval / 1000.0;
+        while (now() < until)
+            if (readOutput(1) < 0)
+                goto gone;
+
+        unsigned int before = last.hash;
+        double sent = now();
+        write(master, key, keyLen);
+
+        while (1) {
+            if (readOutput(5) < 0)
+                goto gone;
+            if (last.start >= sent && last.hash != before) {
+                times[answered++] = last.end - sent;
+                break;
+            }
+            if (now() - sent > 1.0) {
+                ++missed;
+                break;
+            }
+        }
+    }
+
+gone:
+    {
+        double elapsed = now() - begin;
+        long totalFrames = frames;
+        long totalBytes = bytes;
+
+        write(master, quit, quitLen);
+        for (int i = 0; i < 100 && waitpid(pid, &status, WNOHANG) == 0; ++i)
+            readOutput(10);
+        if (waitpid(pid, &status, WNOHANG) == 0) {
+            kill(pid, SIGTERM);
+            waitpid(pid, &status, 0);
+        }
+
+        if (answered == 0) {
+            fprintf(stderr, "%s: no frames answered the key (%d missed)\n", argv[0], missed);
+            return 1;
+        }
+
+        qsort(times, answered, sizeof(double), compareTimes);
+        printf("presses %d, answered %d, missed %d\n", answered + missed, answered, missed);
+        printf("latency ms: min %.2f  p50 %.2f  p90 %.2f  p99 %.2f  max %.2f\n",
+               times[0] * 1e3, times[answered / 2] * 1e3, times[answered * 9 / 10] * 1e3,
+               times[answered * 99 / 100] * 1e3, times[answered - 1] * 1e3);
+        printf("throughput: %.1f frames/s, %.1f KB/s\n", totalFrames / elapsed, totalBytes / elapsed / 1024);
+    }
+
+    free(times);
+    close(master);
+
+    return 0;
+}
@@ -35,9 +35,53 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <termios.h>
+#include <time.h>
+#include <pthread.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+/* C++ has C's atomics under std, and alignas as a keyword */
+#ifdef __cplusplus
+#include <atomic>
+using std::atomic_int;
+using std::atomic_uint;
+using std::atomic_long;
+using std::atomic_ulong;
+using std::atomic_uchar;
+using std::atomic_init;
+using std::atomic_load_explicit;
+using std::atomic_store;
+using std::atomic_store_explicit;
+using std::atomic_fetch_add;
+using std::atomic_fetch_add_explicit;
+using std::atomic_compare_exchange_weak_explicit;
+using std::memory_order_relaxed;
+using std::memory_order_acquire;
+using std::memory_order_release;
+#else
+#include <stdatomic.h>
+#include <stdalign.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LOUIS_X86
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#define LOUIS_IO_URING
+#endif
+#endif
 
 static struct termios origterm, rawterm;
 static int brailleTab[256];
@@ -61,6 +105,12 @@ unsigned char *screenBuffer;
  * computer screen operations. */
 static int braillePositionVals[8] = {64, 128, 4, 32, 2, 16, 1, 8};
 
+/* Shifting dots across cell boundaries is easier when a cell's bits are laid
+ * out in the same order as braillePositionVals: bit ((y % 4) * 2) + (x % 2)
+ * holds the dot at x, y. These tables convert between that grid order and
+ * the braille order stored in a Surface. */
+static unsigned char cellToGrid[256], gridToCell[256];
+
 typedef struct Surface {
     unsigned char *data;
     int width;
@@ -68,7 +118,7 @@ typedef struct Surface {
 } Surface;
 
 /*----------------------------------------------------------------------------
- * power, fAbs, fRound, littleToBigEndian
+ * power, fAbs, fRound, littleToBigEndian, readBigEndian
  *
  * Miscellaneous utility functions.
  *----------------------------------------------------------------------------*/
@@ -87,6 +137,11 @@ static int littleToBigEndian(unsigned char *src)
     return *src | *(src + 1) << 8 | *(src + 2) << 16 | *(src + 3) << 24;
 }
 
+static unsigned int readBigEndian(unsigned char *src)
+{
+    return (unsigned int)*src << 24 | *(src + 1) << 16 | *(src + 2) << 8 | *(src + 3);
+}
+
 /*----------------------------------------------------------------------------
  * utf8Encode
  *
@@ -121,296 +176,7592 @@ static void genBrailleTab()
 }
 
 /*----------------------------------------------------------------------------
- * drawPoint
+ * genGridTabs
  *
- * Take x and y coordinates to draw an individual point abstracted from the
- * braille character it's actually part of. Append to the screen buffer the
- * character that contains that point plus any others already drawn around it.
- * The value parameter is set to 1 to place a point and 0 to place no point or
- * erase one already there.
+ * Fill the tables that convert a braille cell to and from grid bit order.
  *----------------------------------------------------------------------------*/
-int drawPoint(Surface *s, float fx, float fy, int value)
+static void genGridTabs()
 {
-    int x = fRound(fx);
-    int y = fRound(fy);
-    if (x < 0 || y < 0 || x >= s->width * 2 || y >= s->height * 4)
-        return -1;
-
-    /* Derive character position on screen from point position */
-    unsigned char *p = s->data + (s->width * s->height) - s->width - ((y / 4) * s->width) + (x / 2);
+    for (int i = 0x00; i <= 0xFF; ++i) {
+        int grid = 0;
+        for (int bit = 0; bit < 8; ++bit) {
+            if (i & braillePositionVals[bit])
+                grid |= 1 << bit;
+        }
+        cellToGrid[i] = grid;
+        gridToCell[grid] = i;
+    }
+}
 
-    /* Bit value of dot within braille cell corresponding to x, y position */
-    unsigned char positionVal = braillePositionVals[((y % 4) * 2) + (x % 2)];
+/*----------------------------------------------------------------------------
+ * CPU dispatch
+ *
+ * The loops that do the most work over whole rows of cells are kernels,
+ * called through the table below, with one variant for each level of x86
+ * vector instructions. setCpuLevel binds the variants for a level, and
+ * initLouis picks the highest level the processor and operating system
+ * support, so one binary runs well on old and new machines alike. Setting
+ * LOUIS_CPU to generic, sse2, ssse3, avx2 or avx512 before initLouis forces a
+ * lower level, which is how every variant can be tested and timed on the same
+ * machine. A kernel without a variant of its own at some level uses the one
+ * from the level below.
+ *
+ * The kernels are:
+ *
+ *     encode  the UTF-8 encoding of cells, for render
+ *     blit    copying cached cells onto a Surface, keeping some of its dots
+ *     fill    setting the same dots in a run of cells, for filled rectangles
+ *     dither  dithering a row of dots, two to a cell
+ *     minMax  the smallest and largest of an array of floats, for scaling
+ *----------------------------------------------------------------------------*/
+enum {CPU_GENERIC, CPU_SSE2, CPU_SSSE3, CPU_AVX2, CPU_AVX512, CPU_BEST};
 
-    /* Either turn off or turn on the bit */
-    if (!value) {
-        *p &= ~positionVal;
-    } else {
-        *p |= positionVal;
-    }
+static const char *cpuLevelNames[CPU_BEST] = {"generic", "sse2", "ssse3", "avx2", "avx512"};
 
-    return 0;
-}
+typedef struct Kernels {
+    void (*encode)(unsigned char *dst, const unsigned char *src, int n);
+    void (*blit)(unsigned char *dst, const unsigned char *set, const unsigned char *keep, int n);
+    void (*fill)(unsigned char *dst, unsigned char dots, int n);
+    void (*dither)(unsigned char *dst, const float *intensity, int n, const float *threshold,
+                   const unsigned char *bits);
+    void (*minMax)(const float *v, int n, float *min, float *max);
+} Kernels;
 
 /*----------------------------------------------------------------------------
- * drawLine
+ * Generic kernels
  *
- * Take two points and draw a line segment.
+ * blit ORs set into dst, first masking dst with keep unless it is NULL. The
+ * dither kernel sets the dots in bits[0] and bits[1] of each cell from a pair
+ * of intensities, against threshold[k & 3] for the k-th intensity.
  *----------------------------------------------------------------------------*/
-void drawLine(Surface *s, float x1, float y1, float x2, float y2)
+static void encodeGeneric(unsigned char *dst, const unsigned char *src, int n)
 {
-    float slope, yint;
-    int inf = 0;
+    for (int i = 0; i < n; ++i) {
+        memcpy(dst, brailleTab + src[i], 3);
+        dst += 3;
+    }
+}
 
-    /* Account for the undefined slope */
-    if (x1 == x2) {
-        inf = 1;
+static inline __attribute__((always_inline))
+void blitBody(unsigned char *dst, const unsigned char *set, const unsigned char *keep, int n)
+{
+    if (keep) {
+        for (int i = 0; i < n; ++i)
+            dst[i] = (dst[i] & keep[i]) | set[i];
     } else {
-        slope = (y2 - y1) / (x2 - x1);
-        yint = y1 - (slope * x1);
+        for (int i = 0; i < n; ++i)
+            dst[i] |= set[i];
     }
+}
 
-    drawPoint(s, x1, y1, 1);
-    while (fAbs(x1, x2) > 1 || fAbs(y1, y2) > 1) {
-        /* An undefined slope is just a vertical line */
-        if (inf) {
-            y1 += (y1 < y2) ? 1.0f : -1.0f;
-        /* A slight incline needs more X-axis points to fill out the line */
-        } else if (slope < 1) {
-            x1 += (x1 < x2) ? 1.0f : -1.0f;
-            y1 = x1 * slope + yint;
-        /* A steeper slope needs more Y-axis points */
-        } else {
-            y1 += (y1 < y2) ? 1.0f : -1.0f;
-            x1 = (y1 - yint) / slope;
-        }
-        drawPoint(s, x1, y1, 1);
-    }
+static inline __attribute__((always_inline))
+void fillBody(unsigned char *dst, unsigned char dots, int n)
+{
+    for (int i = 0; i < n; ++i)
+        dst[i] |= dots;
 }
 
-/*----------------------------------------------------------------------------
- * drawCurve
- *
- * Take a starting point on the X axis and the three coefficients of a
- * quadratic equation to determine the curve, slope, and y-intercept. Draw the
- * resulting curve.
- *----------------------------------------------------------------------------*/
-void drawCurve(Surface *s, float x1, float x2, float a, float b, float c)
+static inline __attribute__((always_inline))
+void ditherBody(unsigned char *dst, const float *intensity, int n, const float *threshold,
+                const unsigned char *bits)
 {
-    int y;
-    while (x1 < x2) {
-        x1 += 0.2f;
+    unsigned char clear = ~(bits[0] | bits[1]);
+    int i = 0;
 
-        /* Quadratic equation */
-        y = (a * (x1 * x1)) + (b * x1) + c;
+    /* Two cells at a time, so every threshold is fixed in the loop body */
+    for (; i + 1 < n; i += 2) {
+        const float *v = intensity + i * 2;
+        dst[i] = (dst[i] & clear) | ((v[0] > threshold[0]) ? bits[0] : 0) | ((v[1] > threshold[1]) ? bits[1] : 0);
+        dst[i + 1] = (dst[i + 1] & clear) | ((v[2] > threshold[2]) ? bits[0] : 0) | ((v[3] > threshold[3]) ? bits[1] : 0);
+    }
+    if (i < n) {
+        const float *v = intensity + i * 2;
+        dst[i] = (dst[i] & clear) | ((v[0] > threshold[0]) ? bits[0] : 0) | ((v[1] > threshold[1]) ? bits[1] : 0);
+    }
+}
 
-        /* Exaggerate the X axis */
-        y /= 10;
+static void minMaxGeneric(const float *v, int n, float *min, float *max)
+{
+    float lo = *min, hi = *max;
 
-        drawPoint(s, x1, y, 1);
+    for (int i = 0; i < n; ++i) {
+        lo = (v[i] < lo) ? v[i] : lo;
+        hi = (v[i] > hi) ? v[i] : hi;
     }
+
+    *min = lo;
+    *max = hi;
 }
 
-/*----------------------------------------------------------------------------
- * drawRect
- *
- * Take x and y coordinates and draw a w by h rectangle, filled or unfilled,
- * using the drawPoint function.
- *----------------------------------------------------------------------------*/
-void drawRect(Surface *s, int x, int y, int w, int h, int fill)
+static void blitGeneric(unsigned char *dst, const unsigned char *set, const unsigned char *keep, int n)
 {
-    if (fill) {
-        for (int i = 0; i < h; ++i) {
-            for (int j = 0; j < w; ++j) {
-                drawPoint(s, x + j, y + i, 1);
-            }
-        }
-    } else {
-        for (int i = 0; i < w; ++i) {
-            drawPoint(s, x + i, y, 1);
-            drawPoint(s, x + i, y + h - 1, 1);
-        }
-        for (int i = 1; i < h - 1; ++i) {
-            drawPoint(s, x, y + i, 1);
-            drawPoint(s, x + w - 1, y + i, 1);
-        }
-    }
+    blitBody(dst, set, keep, n);
 }
 
-/*----------------------------------------------------------------------------
- * drawBitmap
- *
- * Draw a bitmap, an array of ones and zeros representing pixels, to the
- * screen at position x, y, using drawPoint.
- *----------------------------------------------------------------------------*/
-void drawBitmap(Surface *s, Surface *bitmap, int x, int y)
+static void fillGeneric(unsigned char *dst, unsigned char dots, int n)
 {
-    unsigned char *p = bitmap->data;
+    fillBody(dst, dots, n);
+}
 
-    /* Even though the Y origin of our coordinate system is at the bottom of
-     * the screen, BMP data is already "upside down", so we can read the data
-     * in the usual top to bottom way. */
-    for (int i = 0; i < bitmap->height; ++i) {
-        for (int j = 0; j < bitmap->width; ++j) {
-            drawPoint(s, x + j, y + i, *p++);
-        }
-    }
+static void ditherGeneric(unsigned char *dst, const float *intensity, int n, const float *threshold,
+                          const unsigned char *bits)
+{
+    ditherBody(dst, intensity, n, threshold, bits);
 }
 
+static Kernels kernels = {encodeGeneric, blitGeneric, fillGeneric, ditherGeneric, minMaxGeneric};
+static int currentCpuLevel = CPU_GENERIC;
 
+#ifdef LOUIS_X86
 /*----------------------------------------------------------------------------
- * render
+ * x86 kernels
  *
- * Convert the lower-byte-UCS values in the data buffer to their UTF-8 encoded
- * values, storing them in another buffer, and write that buffer to STDOUT.
+ * Each variant is compiled for its own instruction set with the target
+ * attribute, whatever the flags the rest of the program is built with.
+ * Encoding shuffles the two varying bytes of each character into place with
+ * pshufb, sixteen cells to three 16-byte stores; the AVX2 version does two
+ * such blocks at once and then swaps 16-byte halves into order. The dither
+ * kernel is left to the compiler's vectorizer at each level.
  *----------------------------------------------------------------------------*/
-void render(Surface *s)
+__attribute__((target("sse2")))
+static void blitSSE2(unsigned char *dst, const unsigned char *set, const unsigned char *keep, int n)
 {
-    if (!screenBuffer)
-        screenBuffer = (unsigned char *)malloc((s->width * s->height * 3) + 12);
+    int i = 0;
 
-    int len = s->width * s->height;
-    unsigned char *p = screenBuffer;
-    memcpy(p, "\x1b[?25l", 6);
-    p += 6;
-    memcpy(p, "\x1b[H", 3);
-    p += 3;
-    for (int i = 0; i < len; ++i) {
-        memcpy(p, brailleTab + *(s->data + i), 3);
-        p += 3;
+    for (; i + 16 <= n; i += 16) {
+        __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+        __m128i s = _mm_loadu_si128((const __m128i *)(set + i));
+        if (keep)
+            d = _mm_and_si128(d, _mm_loadu_si128((const __m128i *)(keep + i)));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_or_si128(d, s));
     }
-    memcpy(p, "\x1b[H", 3);
+    blitGeneric(dst + i, set + i, keep ? keep + i : NULL, n - i);
+}
+
+__attribute__((target("sse2")))
+static void fillSSE2(unsigned char *dst, unsigned char dots, int n)
+{
+    __m128i m = _mm_set1_epi8(dots);
+    int i = 0;
 
-    write(1, screenBuffer, (len * 3) + 12);
+    for (; i + 16 <= n; i += 16)
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_or_si128(_mm_loadu_si128((const __m128i *)(dst + i)), m));
+    fillGeneric(dst + i, dots, n - i);
 }
 
-/*----------------------------------------------------------------------------
- * clearSurface
- *
- * Set the whole block of Surface data to 0.
- *----------------------------------------------------------------------------*/
-void clearSurface(Surface *s)
+__attribute__((target("sse2")))
+static void ditherSSE2(unsigned char *dst, const float *intensity, int n, const float *threshold,
+                       const unsigned char *bits)
 {
-    for (int y = 0; y < s->height; ++y) {
-        for (int x = 0; x < s->width; ++x) {
-            *(s->data + (y * s->width) + x) = 0;
-        }
-    }
+    ditherBody(dst, intensity, n, threshold, bits);
 }
 
-/*----------------------------------------------------------------------------
- * initSurface
- *
- * Initialize a Surface struct with the width and height of the terminal window
- * and a zeroed block of memory.
- *----------------------------------------------------------------------------*/
-void initSurface(Surface *s)
+__attribute__((target("sse2")))
+static void minMaxSSE2(const float *v, int n, float *min, float *max)
 {
-    struct winsize ws;
-    ioctl(0, TIOCGWINSZ, &ws);
+    __m128 lo = _mm_set1_ps(*min), hi = _mm_set1_ps(*max);
+    float l[4], h[4];
+    int i = 0;
 
-    s->width = ws.ws_col;
-    s->height = ws.ws_row;
+    /* With a NaN in v, minps and maxps return the second operand, so NaNs
+     * are skipped just as by the comparisons of the generic kernel */
+    for (; i + 4 <= n; i += 4) {
+        __m128 x = _mm_loadu_ps(v + i);
+        lo = _mm_min_ps(x, lo);
+        hi = _mm_max_ps(x, hi);
+    }
+    _mm_storeu_ps(l, lo);
+    _mm_storeu_ps(h, hi);
+    for (int k = 0; k < 4; ++k) {
+        *min = (l[k] < *min) ? l[k] : *min;
+        *max = (h[k] > *max) ? h[k] : *max;
+    }
+    minMaxGeneric(v + i, n - i, min, max);
+}
 
-    s->data = (unsigned char *)malloc(s->width * s->height);
+__attribute__((target("ssse3")))
+static void encodeSSSE3(unsigned char *dst, const unsigned char *src, int n)
+{
+    const __m128i h0 = _mm_setr_epi8(-1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1);
+    const __m128i h1 = _mm_setr_epi8(5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10);
+    const __m128i h2 = _mm_setr_epi8(-1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1);
+    const __m128i l0 = _mm_setr_epi8(-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1);
+    const __m128i l1 = _mm_setr_epi8(-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1);
+    const __m128i l2 = _mm_setr_epi8(10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15);
+    const __m128i e0 = _mm_and_si128(_mm_cmpeq_epi8(h0, l0), _mm_set1_epi8((char)0xE2));
+    const __m128i e1 = _mm_and_si128(_mm_cmpeq_epi8(h1, l1), _mm_set1_epi8((char)0xE2));
+    const __m128i e2 = _mm_and_si128(_mm_cmpeq_epi8(h2, l2), _mm_set1_epi8((char)0xE2));
+    int i = 0;
 
-    clearSurface(s);
+    for (; i + 16 <= n; i += 16, dst += 48) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i hi = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(v, 6), _mm_set1_epi8(0x03)), _mm_set1_epi8((char)0xA0));
+        __m128i lo = _mm_or_si128(_mm_and_si128(v, _mm_set1_epi8(0x3F)), _mm_set1_epi8((char)0x80));
+        _mm_storeu_si128((__m128i *)dst, _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(hi, h0), _mm_shuffle_epi8(lo, l0)), e0));
+        _mm_storeu_si128((__m128i *)(dst + 16), _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(hi, h1), _mm_shuffle_epi8(lo, l1)), e1));
+        _mm_storeu_si128((__m128i *)(dst + 32), _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(hi, h2), _mm_shuffle_epi8(lo, l2)), e2));
+    }
+    encodeGeneric(dst, src + i, n - i);
 }
 
-/*----------------------------------------------------------------------------
- * loadBitmap
- *
- * Extract the bitmap data from a BMP file and put it in a buffer that can be
- * passed to drawBitmap. Write 0xFFFFFF (white) as 0 and everything else as 1.
- * In other words, the function expects two-value data, where white is
- * interpreted as the image's transparent background and black is the solid
- * foreground where braille dots are printed.
- *----------------------------------------------------------------------------*/
-struct Surface loadBitmap(char *filename)
+__attribute__((target("avx2")))
+static void encodeAVX2(unsigned char *dst, const unsigned char *src, int n)
 {
-    FILE *fp;
-    Surface bitmap;
-    unsigned char r, g, b;
-    unsigned int pixel;
-    unsigned int dataOffset;
+    const __m256i h0 = _mm256_setr_epi8(-1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1,
+                                        -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1);
+    const __m256i h1 = _mm256_setr_epi8(5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10,
+                                        5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10);
+    const __m256i h2 = _mm256_setr_epi8(-1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1,
+                                        -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1);
+    const __m256i l0 = _mm256_setr_epi8(-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1,
+                                        -1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1);
+    const __m256i l1 = _mm256_setr_epi8(-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1,
+                                        -1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1);
+    const __m256i l2 = _mm256_setr_epi8(10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15,
+                                        10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15);
+    const __m256i e0 = _mm256_and_si256(_mm256_cmpeq_epi8(h0, l0), _mm256_set1_epi8((char)0xE2));
+    const __m256i e1 = _mm256_and_si256(_mm256_cmpeq_epi8(h1, l1), _mm256_set1_epi8((char)0xE2));
+    const __m256i e2 = _mm256_and_si256(_mm256_cmpeq_epi8(h2, l2), _mm256_set1_epi8((char)0xE2));
+    int i = 0;
 
-    fp = fopen(filename, "r");
+    /* Lane 0 holds cells 0 to 15 and lane 1 cells 16 to 31, so each output
+     * vector has one 16-byte piece from the first 48 bytes and one from the
+     * second */
+    for (; i + 32 <= n; i += 32, dst += 96) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i hi = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(v, 6), _mm256_set1_epi8(0x03)),
+                                     _mm256_set1_epi8((char)0xA0));
+        __m256i lo = _mm256_or_si256(_mm256_and_si256(v, _mm256_set1_epi8(0x3F)), _mm256_set1_epi8((char)0x80));
+        __m256i o0 = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(hi, h0), _mm256_shuffle_epi8(lo, l0)), e0);
+        __m256i o1 = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(hi, h1), _mm256_shuffle_epi8(lo, l1)), e1);
+        __m256i o2 = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(hi, h2), _mm256_shuffle_epi8(lo, l2)), e2);
+        _mm256_storeu_si256((__m256i *)dst, _mm256_permute2x128_si256(o0, o1, 0x20));
+        _mm256_storeu_si256((__m256i *)(dst + 32), _mm256_permute2x128_si256(o2, o0, 0x30));
+        _mm256_storeu_si256((__m256i *)(dst + 64), _mm256_permute2x128_si256(o1, o2, 0x31));
+    }
+    encodeSSSE3(dst, src + i, n - i);
+}
 
-    fseek(fp, 0L, SEEK_END);
+__attribute__((target("avx2")))
+static void blitAVX2(unsigned char *dst, const unsigned char *set, const unsigned char *keep, int n)
+{
+    int i = 0;
 
-    int size = ftell(fp);
-    rewind(fp);
+    for (; i + 32 <= n; i += 32) {
+        __m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+        __m256i s = _mm256_loadu_si256((const __m256i *)(set + i));
+        if (keep)
+            d = _mm256_and_si256(d, _mm256_loadu_si256((const __m256i *)(keep + i)));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_or_si256(d, s));
+    }
+    blitSSE2(dst + i, set + i, keep ? keep + i : NULL, n - i);
+}
 
-    unsigned char *buf = (unsigned char *)malloc(sizeof(char) * size);
+__attribute__((target("avx2")))
+static void fillAVX2(unsigned char *dst, unsigned char dots, int n)
+{
+    __m256i m = _mm256_set1_epi8(dots);
+    int i = 0;
 
-    fread(buf, 1, size, fp);
+    for (; i + 32 <= n; i += 32)
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_or_si256(_mm256_loadu_si256((const __m256i *)(dst + i)), m));
+    fillSSE2(dst + i, dots, n - i);
+}
 
-    fclose(fp);
+__attribute__((target("avx2")))
+static void ditherAVX2(unsigned char *dst, const float *intensity, int n, const float *threshold,
+                       const unsigned char *bits)
+{
+    ditherBody(dst, intensity, n, threshold, bits);
+}
 
-    /* Read the width, height, and data offset information from the bitmap
-     * file, converting from little-endian order. */
-    bitmap.width = littleToBigEndian(buf + 0x12);
-    bitmap.height = littleToBigEndian(buf + 0x16);
-    dataOffset = littleToBigEndian(buf + 0x0A);
+__attribute__((target("avx2")))
+static void minMaxAVX2(const float *v, int n, float *min, float *max)
+{
+    __m256 lo = _mm256_set1_ps(*min), hi = _mm256_set1_ps(*max);
+    float l[8], h[8];
+    int i = 0;
 
-    bitmap.data = (unsigned char *)malloc(bitmap.width * bitmap.height);
-    unsigned char *bp = bitmap.data;
+    for (; i + 8 <= n; i += 8) {
+        __m256 x = _mm256_loadu_ps(v + i);
+        lo = _mm256_min_ps(x, lo);
+        hi = _mm256_max_ps(x, hi);
+    }
+    _mm256_storeu_ps(l, lo);
+    _mm256_storeu_ps(h, hi);
+    for (int k = 0; k < 8; ++k) {
+        *min = (l[k] < *min) ? l[k] : *min;
+        *max = (h[k] > *max) ? h[k] : *max;
+    }
+    minMaxSSE2(v + i, n - i, min, max);
+}
 
-    /* BMP data is "upside down" from a screen's perspective, but we leave it
-     * this way, because our drawPoint function writes data "upside down" too,
-     * in order to comply with the standard coordinate system employed in
-     * mathematics. */
-    for (int y = 0; y < bitmap.height; y++) {
-        for (int x = 0; x < bitmap.width; x++) {
-            int bufOffset = (y * bitmap.width) + x;
-            b = *(buf + dataOffset + (bufOffset * 3));
-            g = *(buf + dataOffset + (bufOffset * 3) + 1);
-            r = *(buf + dataOffset + (bufOffset * 3) + 2);
-            pixel = (r << 24) | (g << 16) | (b << 8);
-            *bp++ = pixel ? 0 : 1;
-        }
+__attribute__((target("avx512f,avx512bw")))
+static void blitAVX512(unsigned char *dst, const unsigned char *set, const unsigned char *keep, int n)
+{
+    int i = 0;
+
+    for (; i + 64 <= n; i += 64) {
+        __m512i d = _mm512_loadu_si512((const void *)(dst + i));
+        __m512i s = _mm512_loadu_si512((const void *)(set + i));
+        if (keep)
+            d = _mm512_and_si512(d, _mm512_loadu_si512((const void *)(keep + i)));
+        _mm512_storeu_si512((void *)(dst + i), _mm512_or_si512(d, s));
     }
+    blitAVX2(dst + i, set + i, keep ? keep + i : NULL, n - i);
+}
 
-    free(buf);
+__attribute__((target("avx512f,avx512bw")))
+static void fillAVX512(unsigned char *dst, unsigned char dots, int n)
+{
+    __m512i m = _mm512_set1_epi8(dots);
+    int i = 0;
 
-    return bitmap;
+    for (; i + 64 <= n; i += 64)
+        _mm512_storeu_si512((void *)(dst + i), _mm512_or_si512(_mm512_loadu_si512((const void *)(dst + i)), m));
+    fillAVX2(dst + i, dots, n - i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void ditherAVX512(unsigned char *dst, const float *intensity, int n, const float *threshold,
+                         const unsigned char *bits)
+{
+    ditherBody(dst, intensity, n, threshold, bits);
 }
 
+__attribute__((target("avx512f,avx512bw")))
+static void minMaxAVX512(const float *v, int n, float *min, float *max)
+{
+    __m512 lo = _mm512_set1_ps(*min), hi = _mm512_set1_ps(*max);
+    float l[16], h[16];
+    int i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m512 x = _mm512_loadu_ps(v + i);
+        lo = _mm512_min_ps(x, lo);
+        hi = _mm512_max_ps(x, hi);
+    }
+    _mm512_storeu_ps(l, lo);
+    _mm512_storeu_ps(h, hi);
+    for (int k = 0; k < 16; ++k) {
+        *min = (l[k] < *min) ? l[k] : *min;
+        *max = (h[k] > *max) ? h[k] : *max;
+    }
+    minMaxAVX2(v + i, n - i, min, max);
+}
+#endif
 
 /*----------------------------------------------------------------------------
- * initLouis
- *
- * Perform various routines necessary for the graphics library to work:
+ * detectCpuLevel, setCpuLevel, cpuLevelByName
  *
- * 1) Save the terminal's attributes on program entry.
- * 2) Switch to raw input mode.
- * 3) Generate the table of braille escape sequences.
+ * Find the highest level the machine supports, and bind the kernels for a
+ * level, at most that one; CPU_BEST picks it. setCpuLevel returns the level
+ * bound. cpuLevelByName returns the level with a name, or CPU_BEST.
  *----------------------------------------------------------------------------*/
-void initLouis()
+int detectCpuLevel()
 {
-    tcgetattr(0, &origterm);
-    rawterm = origterm;
-    rawterm.c_iflag |= IGNBRK;
-    rawterm.c_lflag &= ~ICANON;
-    rawterm.c_lflag &= ~ECHO;
-    rawterm.c_cc[VMIN] = 0;
-    rawterm.c_cc[VTIME] = 0;
-    tcsetattr(0, TCSAFLUSH, &rawterm);
+#ifdef LOUIS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+        return CPU_AVX512;
+    if (__builtin_cpu_supports("avx2"))
+        return CPU_AVX2;
+    if (__builtin_cpu_supports("ssse3"))
+        return CPU_SSSE3;
+    if (__builtin_cpu_supports("sse2"))
+        return CPU_SSE2;
+#endif
+    return CPU_GENERIC;
+}
 
-    genBrailleTab();
+int setCpuLevel(int level)
+{
+    int best = detectCpuLevel();
+    Kernels k = {encodeGeneric, blitGeneric, fillGeneric, ditherGeneric, minMaxGeneric};
+
+    if (level < CPU_GENERIC || level > best)
+        level = best;
+
+#ifdef LOUIS_X86
+    if (level >= CPU_SSE2) {
+        k.blit = blitSSE2;
+        k.fill = fillSSE2;
+        k.dither = ditherSSE2;
+        k.minMax = minMaxSSE2;
+    }
+    if (level >= CPU_SSSE3)
+        k.encode = encodeSSSE3;
+    if (level >= CPU_AVX2) {
+        k.encode = encodeAVX2;
+        k.blit = blitAVX2;
+        k.fill = fillAVX2;
+        k.dither = ditherAVX2;
+        k.minMax = minMaxAVX2;
+    }
+    if (level >= CPU_AVX512) {
+        k.blit = blitAVX512;
+        k.fill = fillAVX512;
+        k.dither = ditherAVX512;
+        k.minMax = minMaxAVX512;
+    }
+#endif
+
+    kernels = k;
+    currentCpuLevel = level;
+
+    return level;
+}
+
+int cpuLevelByName(const char *name)
+{
+    for (int i = 0; i < CPU_BEST; ++i)
+        if (!strcmp(name, cpuLevelNames[i]))
+            return i;
+    return CPU_BEST;
+}
+
+/*----------------------------------------------------------------------------
+ * Tracing
+ *
+ * To compare changes to the library on what real programs do, the drawing
+ * calls and keyboard input of any louis program can be recorded to a file,
+ * by calling startTrace or by setting LOUIS_TRACE to a file name before
+ * initLouis. The replay program then plays the trace back headlessly, as fast
+ * as it can.
+ *
+ * Every record is an operation code, the id of the Surface it applies to,
+ * and its arguments as floats. Surfaces get ids the first time they are drawn
+ * on, and bitmaps have their contents recorded whenever they change. Only
+ * calls made by the program are recorded: the drawing routines raise
+ * traceDepth around their own work, so a line shows up once rather than as
+ * every point on it. Work done on private Surfaces and copied over, as the
+ * damage redraw does, is recorded as the cells it leaves behind. Frames sent
+ * with render, renderDamage or renderThrottled, and input read with
+ * readInput, are recorded with the time since tracing started.
+ *
+ * Programs that write to Surface data directly aren't seen by the trace.
+ *----------------------------------------------------------------------------*/
+enum {
+    TRACE_SURFACE = 1,
+    TRACE_BITMAP,
+    TRACE_POINT,
+    TRACE_LINE,
+    TRACE_CURVE,
+    TRACE_RECT,
+    TRACE_DRAW_BITMAP,
+    TRACE_DITHER,
+    TRACE_CLEAR,
+    TRACE_SCROLL,
+    TRACE_CELLS,
+    TRACE_RENDER,
+    TRACE_INPUT,
+    TRACE_CIRCLE,
+    TRACE_POINTS,
+    TRACE_POLYLINE,
+    TRACE_LOD
+};
+
+#define TRACE_MAX_SURFACES 256
+
+typedef struct TraceSurface {
+    unsigned char *data;
+    int width;
+    int height;
+    unsigned int hash;
+    unsigned long used;
+} TraceSurface;
+
+static struct Trace {
+    FILE *fp;
+    struct timespec start;
+    TraceSurface surfaces[TRACE_MAX_SURFACES];
+    int count;
+    unsigned long uses;
+} trace;
+
+static int traceDepth;
+
+/*----------------------------------------------------------------------------
+ * traceTime, traceRecord
+ *
+ * Write one record: the operation, the Surface id, and n floats.
+ *----------------------------------------------------------------------------*/
+static double traceTime()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - trace.start.tv_sec) + (now.tv_nsec - trace.start.tv_nsec) / 1e9;
+}
+
+static void traceRecord(int op, int id, const float *args, int n)
+{
+    unsigned char head[3] = {op, id & 0xFF, id >> 8};
+    fwrite(head, 1, 3, trace.fp);
+    if (n)
+        fwrite(args, sizeof(float), n, trace.fp);
+}
+
+/*----------------------------------------------------------------------------
+ * traceSurface
+ *
+ * Return the id of a Surface, recording it if it is new. Surfaces are known
+ * by their data and size, since programs pass copies of them around. With
+ * contents set, the data is recorded too whenever it has changed.
+ *----------------------------------------------------------------------------*/
+static int traceSurface(Surface *s, int contents)
+{
+    unsigned int hash = 2166136261u;
+    int id, stale = 0;
+
+    for (id = 0; id < trace.count; ++id) {
+        TraceSurface *t = &trace.surfaces[id];
+        if (t->data == s->data && t->width == s->width && t->height == s->height)
+            break;
+        if (t->used < trace.surfaces[stale].used)
+            stale = id;
+    }
+
+    /* Reuse the least recently used id once the table is full, which is
+     * never the Surface being drawn on */
+    if (id == TRACE_MAX_SURFACES)
+        id = stale;
+
+    if (contents)
+        for (int i = 0; i < s->width * s->height; ++i)
+            hash = (hash ^ s->data[i]) * 16777619u;
+
+    TraceSurface *t = &trace.surfaces[id];
+    t->used = ++trace.uses;
+    if (id == trace.count || t->data != s->data || (contents && t->hash != hash)) {
+        float size[2] = {s->width, s->height};
+        if (id == trace.count)
+            ++trace.count;
+        t->data = s->data;
+        t->width = s->width;
+        t->height = s->height;
+        t->hash = hash;
+        traceRecord(contents ? TRACE_BITMAP : TRACE_SURFACE, id, size, 2);
+        if (contents)
+            fwrite(s->data, 1, s->width * s->height, trace.fp);
+    }
+
+    return id;
+}
+
+/*----------------------------------------------------------------------------
+ * traceCall, traceCells, traceFrame
+ *
+ * Record a drawing call made by the program, a block of cells columns x0 to
+ * x1 and rows y0 to y1 from the top, and a frame sent to the terminal.
+ *----------------------------------------------------------------------------*/
+static void traceCall(Surface *s, int op, const float *args, int n)
+{
+    if (traceDepth)
+        return;
+    traceRecord(op, traceSurface(s, 0), args, n);
+}
+
+static void traceCells(Surface *s, int x0, int y0, int x1, int y1)
+{
+    float block[4] = {x0, y0, x1, y1};
+
+    if (traceDepth)
+        return;
+    traceRecord(TRACE_CELLS, traceSurface(s, 0), block, 4);
+    for (int y = y0; y <= y1; ++y)
+        fwrite(s->data + y * s->width + x0, 1, x1 - x0 + 1, trace.fp);
+}
+
+static void traceFrame(Surface *s)
+{
+    float time = traceTime();
+    traceRecord(TRACE_RENDER, traceSurface(s, 0), &time, 1);
+}
+
+/*----------------------------------------------------------------------------
+ * startTrace, stopTrace
+ *
+ * Start recording to a file, returning -1 if it can't be created, and stop.
+ *----------------------------------------------------------------------------*/
+int startTrace(const char *filename)
+{
+    FILE *fp = fopen(filename, "wb");
+    if (!fp)
+        return -1;
+
+    memset(&trace, 0, sizeof(trace));
+    trace.fp = fp;
+    clock_gettime(CLOCK_MONOTONIC, &trace.start);
+    fwrite("LOUISTR1", 1, 8, fp);
+
+    return 0;
+}
+
+void stopTrace()
+{
+    if (!trace.fp)
+        return;
+    fclose(trace.fp);
+    trace.fp = NULL;
+}
+
+/*----------------------------------------------------------------------------
+ * readInput
+ *
+ * Read up to n bytes of keyboard input without waiting, like read on STDIN,
+ * recording what arrives when tracing.
+ *----------------------------------------------------------------------------*/
+int readInput(char *buf, int n)
+{
+    n = read(0, buf, n);
+
+    if (n > 0 && trace.fp) {
+        float head[2] = {traceTime(), n};
+        traceRecord(TRACE_INPUT, 0, head, 2);
+        fwrite(buf, 1, n, trace.fp);
+    }
+
+    return n;
+}
+
+/*----------------------------------------------------------------------------
+ * Transforms
+ *
+ * Programs can hand drawPoint, drawLine, drawCurve, drawPoints and
+ * drawPolyline coordinates in their own units and have them mapped to dots.
+ * The current transform first puts each axis through its own scale, which
+ * takes the range lo to hi of the data to 0 to 1, linearly, by logarithm, or
+ * by a logarithm on either side of a linear part around zero, and then through
+ * an affine matrix built up from translations, scalings and rotations. Each
+ * call composes with the ones before it, so the last one made applies to the
+ * points first:
+ *
+ *     pushTransform();
+ *     translateView(x, y);
+ *     scaleView(w - 1, h - 1);
+ *     setAxisScale(AXIS_Y, SCALE_LOG, 1, 1e6, 0);
+ *     drawPolyline(s, xs, ys, n);
+ *     popTransform();
+ *
+ * Transforms are kept on a stack, so that a routine can change the view and
+ * put it back as it found it. Only calls made by the program are mapped: the
+ * drawing routines work in dots, and so do rectangles, circles, bitmaps,
+ * Primitives, and the widgets that are given a block of dots to fill, which
+ * draw as if the transform weren't there. Points are mapped a block at a
+ * time, a pass over each array per step, and traces record the dots they
+ * land on.
+ *----------------------------------------------------------------------------*/
+enum {AXIS_X, AXIS_Y};
+enum {SCALE_NONE, SCALE_LINEAR, SCALE_LOG, SCALE_SYMLOG};
+
+#define TRANSFORM_DEPTH 32
+#define TRANSFORM_BLOCK 256
+
+typedef struct Transform {
+    float m[6];         /* x' = m[0] x + m[2] y + m[4], y' = m[1] x + m[3] y + m[5] */
+    int kind[2];
+    float offset[2];    /* Where lo lands on the scale */
+    float factor[2];    /* One over the span from lo to hi */
+    float constant[2];
+    int affine;
+    int mapped;         /* 0 until anything is set, when m and kind are unused */
+} Transform;
+
+static struct TransformStack {
+    Transform t[TRANSFORM_DEPTH];
+    int top;
+    int overflow;
+} transforms;
+
+/*----------------------------------------------------------------------------
+ * pushTransform, popTransform, resetTransform
+ *
+ * Save the current transform, go back to the one saved last, and make the
+ * current one leave coordinates alone. Pushes past TRANSFORM_DEPTH aren't
+ * saved, but are counted so that the pops still match up.
+ *----------------------------------------------------------------------------*/
+void pushTransform()
+{
+    if (transforms.top + 1 < TRANSFORM_DEPTH) {
+        transforms.t[transforms.top + 1] = transforms.t[transforms.top];
+        ++transforms.top;
+    } else {
+        ++transforms.overflow;
+    }
+}
+
+void popTransform()
+{
+    if (transforms.overflow)
+        --transforms.overflow;
+    else if (transforms.top > 0)
+        --transforms.top;
+}
+
+void resetTransform()
+{
+    transforms.t[transforms.top].mapped = 0;
+}
+
+/*----------------------------------------------------------------------------
+ * editTransform
+ *
+ * Return the current transform to be changed, starting it off as the
+ * identity if nothing has been set on it.
+ *----------------------------------------------------------------------------*/
+static Transform *editTransform()
+{
+    Transform *t = &transforms.t[transforms.top];
+
+    if (!t->mapped) {
+        memset(t, 0, sizeof(Transform));
+        t->m[0] = t->m[3] = 1.0f;
+        t->mapped = 1;
+    }
+
+    return t;
+}
+
+/*----------------------------------------------------------------------------
+ * translateView, scaleView, rotateView
+ *
+ * Compose a move, a stretch along each axis, or a turn counterclockwise by
+ * an angle in radians with the current transform.
+ *----------------------------------------------------------------------------*/
+void translateView(float tx, float ty)
+{
+    Transform *t = editTransform();
+
+    t->m[4] += t->m[0] * tx + t->m[2] * ty;
+    t->m[5] += t->m[1] * tx + t->m[3] * ty;
+    t->affine = 1;
+}
+
+void scaleView(float sx, float sy)
+{
+    Transform *t = editTransform();
+
+    t->m[0] *= sx;
+    t->m[1] *= sx;
+    t->m[2] *= sy;
+    t->m[3] *= sy;
+    t->affine = 1;
+}
+
+void rotateView(float radians)
+{
+    Transform *t = editTransform();
+    float c = cosf(radians), s = sinf(radians);
+    float m0 = t->m[0], m1 = t->m[1];
+
+    t->m[0] = m0 * c + t->m[2] * s;
+    t->m[1] = m1 * c + t->m[3] * s;
+    t->m[2] = t->m[2] * c - m0 * s;
+    t->m[3] = t->m[3] * c - m1 * s;
+    t->affine = 1;
+}
+
+/*----------------------------------------------------------------------------
+ * setAxisScale
+ *
+ * Scale one axis of the current transform so that lo maps to 0 and hi to 1,
+ * replacing any scale set on it before. SCALE_LOG needs lo and hi above zero,
+ * and leaves out points at or below it. SCALE_SYMLOG is linear within about
+ * constant of zero and logarithmic beyond, so it takes values of either sign.
+ * SCALE_NONE takes the axis scale off again.
+ *----------------------------------------------------------------------------*/
+static float axisValue(int kind, float v, float constant)
+{
+    if (kind == SCALE_LOG)
+        return logf(v);
+    if (kind == SCALE_SYMLOG)
+        return copysignf(log1pf(fabsf(v) / constant), v);
+    return v;
+}
+
+void setAxisScale(int axis, int kind, float lo, float hi, float constant)
+{
+    Transform *t = editTransform();
+
+    if (constant <= 0)
+        constant = 1.0f;
+
+    float a = axisValue(kind, lo, constant), b = axisValue(kind, hi, constant);
+
+    t->kind[axis] = kind;
+    t->constant[axis] = constant;
+    t->offset[axis] = a;
+    t->factor[axis] = (b != a) ? 1.0f / (b - a) : 1.0f;
+}
+
+/*----------------------------------------------------------------------------
+ * mapPoints
+ *
+ * Map n points through the current transform, from the arrays x and y to
+ * outX and outY, which may be the same arrays. Each step is a loop of its own
+ * over a whole array, so the linear ones vectorize.
+ *----------------------------------------------------------------------------*/
+static void scaleAxis(const Transform *t, int axis, const float *v, float *out, int n)
+{
+    float offset = t->offset[axis], factor = t->factor[axis], constant = t->constant[axis];
+
+    switch (t->kind[axis]) {
+    case SCALE_NONE:
+        if (out != v)
+            memcpy(out, v, n * sizeof(float));
+        break;
+    case SCALE_LINEAR:
+        for (int i = 0; i < n; ++i)
+            out[i] = (v[i] - offset) * factor;
+        break;
+    case SCALE_LOG:
+        for (int i = 0; i < n; ++i)
+            out[i] = (logf(v[i]) - offset) * factor;
+        break;
+    case SCALE_SYMLOG:
+        for (int i = 0; i < n; ++i)
+            out[i] = (copysignf(log1pf(fabsf(v[i]) / constant), v[i]) - offset) * factor;
+        break;
+    }
+}
+
+void mapPoints(const float *x, const float *y, float *outX, float *outY, int n)
+{
+    const Transform *t = &transforms.t[transforms.top];
+
+    if (!t->mapped) {
+        if (outX != x)
+            memcpy(outX, x, n * sizeof(float));
+        if (outY != y)
+            memcpy(outY, y, n * sizeof(float));
+        return;
+    }
+
+    scaleAxis(t, AXIS_X, x, outX, n);
+    scaleAxis(t, AXIS_Y, y, outY, n);
+    if (!t->affine)
+        return;
+
+    float m0 = t->m[0], m1 = t->m[1], m2 = t->m[2], m3 = t->m[3], m4 = t->m[4], m5 = t->m[5];
+    for (int i = 0; i < n; ++i) {
+        float px = outX[i], py = outY[i];
+        outX[i] = m0 * px + m2 * py + m4;
+        outY[i] = m1 * px + m3 * py + m5;
+    }
+}
+
+/*----------------------------------------------------------------------------
+ * mapTopLevel, onSurfacePlane
+ *
+ * Map a point drawn by the program itself, and tell whether a mapped point
+ * is finite and near enough to be rounded to a dot. Out-of-range values on a
+ * log scale come out as infinities or NaN and are left out by the callers.
+ *----------------------------------------------------------------------------*/
+static inline int mapTopLevel(float *x, float *y)
+{
+    if (traceDepth || !transforms.t[transforms.top].mapped)
+        return 0;
+    mapPoints(x, y, x, y, 1);
+    return 1;
+}
+
+static inline int onSurfacePlane(float x, float y)
+{
+    return fabsf(x) < 1e9f && fabsf(y) < 1e9f;
+}
+
+/*----------------------------------------------------------------------------
+ * Level of detail
+ *
+ * A program that has to keep a steady frame rate brackets each frame with
+ * beginFrame and endFrame, giving the time it can spend on the frame. From
+ * what earlier frames cost, beginFrame works out a detail for the frame, from
+ * 1 for everything down to LOD_MIN, which frameDetail returns. The routines
+ * whose work can be thinned out without losing the shape of what they draw
+ * use it: plotExpr evaluates fewer columns, drawCurve takes longer steps,
+ * drawPolyline and drawChart keep fewer points, and drawMap simplifies more.
+ * Details come in steps of 1 / n, since these routines skip whole points or
+ * columns. A frame that runs over its time cuts the detail of the next as
+ * far as needed at once, and frames that finish early raise it again a step
+ * at a time, so that a program drawing idle frames refines the picture until
+ * endFrame reports it is at full detail. Primitives are always drawn at full
+ * detail, since they are compared and cached by what they cover.
+ *
+ * The detail stays the same for the whole of a frame. It is recorded when
+ * tracing, so that traces replay with the detail they were recorded with.
+ *----------------------------------------------------------------------------*/
+#define LOD_MIN 0.125f
+#define LOD_HEADROOM 0.9f
+
+static struct Lod {
+    struct timespec start;
+    double budget;
+    double fullCost;    /* Estimated time for a frame at full detail */
+    float detail;       /* 0 outside of frames with a budget, meaning 1 */
+} lod;
+
+/*----------------------------------------------------------------------------
+ * frameDetail, setFrameDetail, lodStride
+ *
+ * Return the detail of the current frame, or set it for the frames to come
+ * until beginFrame is next called, as replay does. lodStride turns the
+ * detail into how many points or columns to advance at a time.
+ *----------------------------------------------------------------------------*/
+float frameDetail()
+{
+    return (lod.detail > 0) ? lod.detail : 1.0f;
+}
+
+void setFrameDetail(float detail)
+{
+    lod.detail = (detail < LOD_MIN) ? LOD_MIN : (detail > 1.0f) ? 1.0f : detail;
+}
+
+static inline int lodStride()
+{
+    return (int)(1.0f / frameDetail() + 0.5f);
+}
+
+/*----------------------------------------------------------------------------
+ * beginFrame, endFrame
+ *
+ * Start a frame that should take no more than budget seconds, with 0 for
+ * full detail however long it takes, and finish it. endFrame returns 1 if the
+ * frame was drawn at less than full detail, so that it is worth drawing
+ * again even if nothing has changed.
+ *----------------------------------------------------------------------------*/
+void beginFrame(double budget)
+{
+    clock_gettime(CLOCK_MONOTONIC, &lod.start);
+    lod.budget = budget;
+
+    if (budget <= 0) {
+        lod.detail = 1.0f;
+    } else if (lod.fullCost > 0) {
+        int stride = (int)ceil(lod.fullCost / (budget * LOD_HEADROOM));
+        int least = lodStride() - 1;
+        stride = (stride < least) ? least : stride;
+        stride = (stride < 1) ? 1 : (stride > 1 / LOD_MIN) ? 1 / LOD_MIN : stride;
+        lod.detail = 1.0f / stride;
+    } else {
+        lod.detail = 1.0f;
+    }
+
+    if (trace.fp)
+        traceRecord(TRACE_LOD, 0, &lod.detail, 1);
+}
+
+int endFrame()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double took = (now.tv_sec - lod.start.tv_sec) + (now.tv_nsec - lod.start.tv_nsec) / 1e9;
+
+    /* The work done scales about with the detail, and a frame that took
+     * longer than expected counts in full rather than being averaged in */
+    double cost = took / frameDetail();
+    lod.fullCost = (cost > lod.fullCost) ? cost : (lod.fullCost + cost) / 2;
+
+    return lod.budget > 0 && frameDetail() < 1.0f;
+}
+
+/*----------------------------------------------------------------------------
+ * drawPoint
+ *
+ * Take x and y coordinates to draw an individual point abstracted from the
+ * braille character it's actually part of. Append to the screen buffer the
+ * character that contains that point plus any others already drawn around it.
+ * The value parameter is set to 1 to place a point and 0 to place no point or
+ * erase one already there.
+ *----------------------------------------------------------------------------*/
+int drawPoint(Surface *s, float fx, float fy, int value)
+{
+    if (mapTopLevel(&fx, &fy) && !onSurfacePlane(fx, fy))
+        return -1;
+
+    if (trace.fp) {
+        float args[3] = {fx, fy, value};
+        traceCall(s, TRACE_POINT, args, 3);
+    }
+
+    int x = fRound(fx);
+    int y = fRound(fy);
+    if (x < 0 || y < 0 || x >= s->width * 2 || y >= s->height * 4)
+        return -1;
+
+    /* Derive character position on screen from point position */
+    unsigned char *p = s->data + (s->width * s->height) - s->width - ((y / 4) * s->width) + (x / 2);
+
+    /* Bit value of dot within braille cell corresponding to x, y position */
+    unsigned char positionVal = braillePositionVals[((y % 4) * 2) + (x % 2)];
+
+    /* Either turn off or turn on the bit */
+    if (!value) {
+        *p &= ~positionVal;
+    } else {
+        *p |= positionVal;
+    }
+
+    return 0;
+}
+
+void drawLine(Surface *s, float x1, float y1, float x2, float y2);
+
+/*----------------------------------------------------------------------------
+ * clipSegment
+ *
+ * Clip the segment from x1, y1 to x2, y2 to the box from x0, y0 to x3, y3
+ * with the Cohen-Sutherland method. Return 0 if none of it is inside.
+ *----------------------------------------------------------------------------*/
+static int outCode(float x, float y, float x0, float y0, float x3, float y3)
+{
+    return (x < x0) | (x > x3) << 1 | (y < y0) << 2 | (y > y3) << 3;
+}
+
+static int clipSegment(float *x1, float *y1, float *x2, float *y2, float x0, float y0, float x3, float y3)
+{
+    int c1 = outCode(*x1, *y1, x0, y0, x3, y3), c2 = outCode(*x2, *y2, x0, y0, x3, y3);
+
+    while (c1 | c2) {
+        if (c1 & c2)
+            return 0;
+
+        int c = c1 ? c1 : c2;
+        float x, y;
+        if (c & 8) {
+            x = *x1 + (*x2 - *x1) * (y3 - *y1) / (*y2 - *y1);
+            y = y3;
+        } else if (c & 4) {
+            x = *x1 + (*x2 - *x1) * (y0 - *y1) / (*y2 - *y1);
+            y = y0;
+        } else if (c & 2) {
+            y = *y1 + (*y2 - *y1) * (x3 - *x1) / (*x2 - *x1);
+            x = x3;
+        } else {
+            y = *y1 + (*y2 - *y1) * (x0 - *x1) / (*x2 - *x1);
+            x = x0;
+        }
+
+        if (c == c1) {
+            *x1 = x, *y1 = y;
+            c1 = outCode(x, y, x0, y0, x3, y3);
+        } else {
+            *x2 = x, *y2 = y;
+            c2 = outCode(x, y, x0, y0, x3, y3);
+        }
+    }
+
+    return 1;
+}
+
+/*----------------------------------------------------------------------------
+ * snapStart, snapEnd
+ *
+ * drawLine steps a dot at a time along the longer axis from where it
+ * starts, so a segment whose start was clipped would land on other dots
+ * than the whole one. Move the clipped start on to the next of the whole
+ * segment's steps, which is at most a dot further along. drawLine also
+ * stops short of its end, where the whole segment would have gone on, so
+ * snapEnd moves a clipped end back on to the last step before it, to be
+ * drawn as well. stepsAlong gives how far a point is along the segment, in
+ * steps times the length of the longer axis, to tell whether a short piece
+ * holds any step at all.
+ *----------------------------------------------------------------------------*/
+static void snapStart(float *x, float *y, float x1, float y1, float x2, float y2)
+{
+    float dx = x2 - x1, dy = y2 - y1;
+
+    if (*x == x1 && *y == y1)
+        return;
+
+    if (fabsf(dy) < fabsf(dx)) {
+        *x = x1 + copysignf(ceilf(fabsf(*x - x1)), dx);
+        *y = y1 + dy * (*x - x1) / dx;
+    } else {
+        *y = y1 + copysignf(ceilf(fabsf(*y - y1)), dy);
+        *x = x1 + dx * (*y - y1) / dy;
+    }
+}
+
+static void snapEnd(float *x, float *y, float x1, float y1, float x2, float y2)
+{
+    float dx = x2 - x1, dy = y2 - y1;
+
+    if (fabsf(dy) < fabsf(dx)) {
+        *x = x1 + copysignf(floorf(fabsf(*x - x1)), dx);
+        *y = y1 + dy * (*x - x1) / dx;
+    } else {
+        *y = y1 + copysignf(floorf(fabsf(*y - y1)), dy);
+        *x = x1 + dx * (*y - y1) / dy;
+    }
+}
+
+static float stepsAlong(float x, float y, float x1, float y1, float x2, float y2)
+{
+    float dx = x2 - x1, dy = y2 - y1;
+
+    return (fabsf(dy) < fabsf(dx)) ? (x - x1) * dx : (y - y1) * dy;
+}
+
+/*----------------------------------------------------------------------------
+ * drawClippedLine, clipToSurface
+ *
+ * Draw the part of the segment from x1, y1 to x2, y2 that drawLine would set
+ * inside the box from x0, y0 to x3, y3, without stepping through the rest.
+ * Return 0 if none of it is inside. The box should hold the points drawPoint
+ * rounds on to the dots wanted, less CLIP_EDGE all round, so that rounding
+ * in drawLine can't carry a dot over the edge. Where the steps of the
+ * whole segment would fall on a half, the piece may set the dot beside.
+ *
+ * clipToSurface draws a segment that way against the whole Surface if an
+ * end lies more than the Surface's own width or height off it, and returns 0
+ * for drawLine to step through it if not. Nearer segments take few wasted
+ * steps, and are drawn exactly as before.
+ *----------------------------------------------------------------------------*/
+#define CLIP_EDGE 0.0001f
+
+static int drawClippedLine(Surface *s, float x1, float y1, float x2, float y2, float x0, float y0, float x3, float y3)
+{
+    float ax = x1, ay = y1, bx = x2, by = y2;
+
+    if (!clipSegment(&ax, &ay, &bx, &by, x0, y0, x3, y3))
+        return 0;
+
+    int clippedStart = ax != x1 || ay != y1, clippedEnd = bx != x2 || by != y2;
+    snapStart(&ax, &ay, x1, y1, x2, y2);
+    if (clippedEnd)
+        snapEnd(&bx, &by, x1, y1, x2, y2);
+
+    /* The whole segment sets a clipped end's dot, but not its own end's */
+    float a = stepsAlong(ax, ay, x1, y1, x2, y2), b = stepsAlong(bx, by, x1, y1, x2, y2);
+    if (!(b > a || (b == a && (clippedEnd || !clippedStart))))
+        return 0;
+
+    drawLine(s, ax, ay, bx, by);
+    if (clippedEnd)
+        drawPoint(s, bx, by, 1);
+
+    return 1;
+}
+
+static int clipToSurface(Surface *s, float x1, float y1, float x2, float y2)
+{
+    int w = s->width * 2, h = s->height * 4;
+
+    if (!(outCode(x1, y1, -w, -h, 2 * w, 2 * h) | outCode(x2, y2, -w, -h, 2 * w, 2 * h)))
+        return 0;
+    drawClippedLine(s, x1, y1, x2, y2, -1.5f + CLIP_EDGE, -1.5f + CLIP_EDGE, w - 0.5f - CLIP_EDGE,
+                    h - 0.5f - CLIP_EDGE);
+    return 1;
+}
+
+/*----------------------------------------------------------------------------
+ * drawLine
+ *
+ * Take two points and draw a line segment.
+ *----------------------------------------------------------------------------*/
+void drawLine(Surface *s, float x1, float y1, float x2, float y2)
+{
+    float slope, yint;
+    int inf = 0;
+
+    if (mapTopLevel(&x1, &y1)) {
+        mapPoints(&x2, &y2, &x2, &y2, 1);
+        if (!onSurfacePlane(x1, y1) || !onSurfacePlane(x2, y2))
+            return;
+    }
+
+    if (trace.fp) {
+        float args[4] = {x1, y1, x2, y2};
+        traceCall(s, TRACE_LINE, args, 4);
+    }
+    ++traceDepth;
+
+    /* An end far off the Surface, as a transform can give, would be stepped
+     * towards a dot at a time. Only the outermost call clips, as the pieces
+     * it draws lie on the Surface. */
+    if (traceDepth == 1 && clipToSurface(s, x1, y1, x2, y2)) {
+        --traceDepth;
+        return;
+    }
+
+    /* Account for the undefined slope */
+    if (x1 == x2) {
+        inf = 1;
+    } else {
+        slope = (y2 - y1) / (x2 - x1);
+        yint = y1 - (slope * x1);
+    }
+
+    drawPoint(s, x1, y1, 1);
+    while (fAbs(x1, x2) > 1 || fAbs(y1, y2) > 1) {
+        /* An undefined slope is just a vertical line */
+        if (inf) {
+            y1 += (y1 < y2) ? 1.0f : -1.0f;
+        /* A slight incline needs more X-axis points to fill out the line */
+        } else if (slope < 1 && slope > -1) {
+            x1 += (x1 < x2) ? 1.0f : -1.0f;
+            y1 = x1 * slope + yint;
+        /* A steeper slope needs more Y-axis points */
+        } else {
+            y1 += (y1 < y2) ? 1.0f : -1.0f;
+            x1 = (y1 - yint) / slope;
+        }
+        drawPoint(s, x1, y1, 1);
+    }
+
+    --traceDepth;
+}
+
+/*----------------------------------------------------------------------------
+ * drawCurve
+ *
+ * Take a starting point on the X axis and the three coefficients of a
+ * quadratic equation to determine the curve, slope, and y-intercept. Draw the
+ * resulting curve. Under a transform, the points are mapped and drawn as
+ * drawPoints does. At less than full detail, the steps are longer.
+ *----------------------------------------------------------------------------*/
+void drawPoints(Surface *s, const float *x, const float *y, int n);
+
+void drawCurve(Surface *s, float x1, float x2, float a, float b, float c)
+{
+    float step = traceDepth ? 0.2f : 0.2f / frameDetail();
+    int y;
+
+    if (!traceDepth && transforms.t[transforms.top].mapped) {
+        float xs[TRANSFORM_BLOCK], ys[TRANSFORM_BLOCK];
+        int n = 0;
+        while (x1 < x2) {
+            x1 += step;
+            y = (a * (x1 * x1)) + (b * x1) + c;
+            xs[n] = x1;
+            ys[n] = y / 10;
+            if (++n == TRANSFORM_BLOCK) {
+                drawPoints(s, xs, ys, n);
+                n = 0;
+            }
+        }
+        drawPoints(s, xs, ys, n);
+        return;
+    }
+
+    if (trace.fp) {
+        float args[5] = {x1, x2, a, b, c};
+        traceCall(s, TRACE_CURVE, args, 5);
+    }
+    ++traceDepth;
+
+    while (x1 < x2) {
+        x1 += step;
+
+        /* Quadratic equation */
+        y = (a * (x1 * x1)) + (b * x1) + c;
+
+        /* Exaggerate the X axis */
+        y /= 10;
+
+        drawPoint(s, x1, y, 1);
+    }
+
+    --traceDepth;
+}
+
+/*----------------------------------------------------------------------------
+ * drawPoints, drawPolyline
+ *
+ * Map n points through the current transform and draw them, as dots or as
+ * lines joining each to the next. Points that don't map to anywhere, such as
+ * NaN or zero on a log scale, are left out, and break the polyline. Points
+ * between two breaks are drawn as dots. At less than full detail,
+ * drawPolyline joins every few points, keeping the last and those either
+ * side of a break, judged once the points are mapped. Both record the mapped points a block at a time when
+ * tracing.
+ *----------------------------------------------------------------------------*/
+static void traceBlock(Surface *s, int op, const float *x, const float *y, int n)
+{
+    float count = n;
+
+    if (traceDepth)
+        return;
+    traceRecord(op, traceSurface(s, 0), &count, 1);
+    fwrite(x, sizeof(float), n, trace.fp);
+    fwrite(y, sizeof(float), n, trace.fp);
+}
+
+static void mapBlock(const float *x, const float *y, float *outX, float *outY, int n)
+{
+    if (!traceDepth)
+        mapPoints(x, y, outX, outY, n);
+    else if (outX != x) {
+        memcpy(outX, x, n * sizeof(float));
+        memcpy(outY, y, n * sizeof(float));
+    }
+}
+
+void drawPoints(Surface *s, const float *x, const float *y, int n)
+{
+    float mx[TRANSFORM_BLOCK], my[TRANSFORM_BLOCK];
+
+    for (int first = 0; first < n; first += TRANSFORM_BLOCK) {
+        int count = (n - first < TRANSFORM_BLOCK) ? n - first : TRANSFORM_BLOCK;
+
+        mapBlock(x + first, y + first, mx, my, count);
+        if (trace.fp)
+            traceBlock(s, TRACE_POINTS, mx, my, count);
+        ++traceDepth;
+
+        for (int i = 0; i < count; ++i)
+            if (onSurfacePlane(mx[i], my[i]))
+                drawPoint(s, mx[i], my[i], 1);
+
+        --traceDepth;
+    }
+}
+
+static void polylineBlock(Surface *s, float *x, float *y, int count)
+{
+    if (trace.fp)
+        traceBlock(s, TRACE_POLYLINE, x, y, count);
+    ++traceDepth;
+
+    int prev = 0;
+    for (int i = 0; i < count; ++i) {
+        int here = onSurfacePlane(x[i], y[i]);
+        if (here && prev && !clipToSurface(s, x[i - 1], y[i - 1], x[i], y[i]))
+            drawLine(s, x[i - 1], y[i - 1], x[i], y[i]);
+        else if (here && (i + 1 == count || !onSurfacePlane(x[i + 1], y[i + 1])))
+            drawPoint(s, x[i], y[i], 1);
+        prev = here;
+    }
+
+    --traceDepth;
+}
+
+void drawPolyline(Surface *s, const float *x, const float *y, int n)
+{
+    float mx[TRANSFORM_BLOCK + 1], my[TRANSFORM_BLOCK + 1];
+    float bx[TRANSFORM_BLOCK], by[TRANSFORM_BLOCK];
+    int stride = traceDepth ? 1 : lodStride();
+    int count = 0, carried = 0, prevGap = 1;
+
+    for (int first = 0; first < n; first += TRANSFORM_BLOCK) {
+        int m = (n - first < TRANSFORM_BLOCK) ? n - first : TRANSFORM_BLOCK;
+
+        /* One point more, to tell whether the last borders a break */
+        mapBlock(x + first, y + first, mx, my, (first + m < n) ? m + 1 : m);
+
+        for (int j = 0; j < m; ++j) {
+            int i = first + j, gap = !onSurfacePlane(mx[j], my[j]);
+            int thin = stride > 1 && i % stride && i + 1 < n && !prevGap && !gap &&
+                onSurfacePlane(mx[j + 1], my[j + 1]);
+            prevGap = gap;
+            if (thin)
+                continue;
+            bx[count] = mx[j];
+            by[count] = my[j];
+            carried = 0;
+
+            /* Blocks overlap by a point so that the line between them is
+             * drawn */
+            if (++count == TRANSFORM_BLOCK) {
+                polylineBlock(s, bx, by, count);
+                bx[0] = mx[j];
+                by[0] = my[j];
+                count = 1;
+                carried = 1;
+            }
+        }
+    }
+    if (count > 1 || (count == 1 && !carried))
+        polylineBlock(s, bx, by, count);
+}
+
+/*----------------------------------------------------------------------------
+ * fillRect
+ *
+ * Set every dot from x0, y0 to x1, y1 a cell row at a time, filling the runs
+ * of whole cells with the fill kernel. Coordinates are clipped the way
+ * drawPoint rounds them, so the result is the same as drawing each point.
+ *----------------------------------------------------------------------------*/
+static void fillRect(Surface *s, int x0, int y0, int x1, int y1)
+{
+    if (x1 < x0 || y1 < y0)
+        return;
+
+    /* drawPoint rounds -1 up to 0 and drops anything further out */
+    x0 = (x0 < 0) ? 0 : x0;
+    y0 = (y0 < 0) ? 0 : y0;
+    x1 = (x1 == -1) ? 0 : (x1 >= s->width * 2) ? s->width * 2 - 1 : x1;
+    y1 = (y1 == -1) ? 0 : (y1 >= s->height * 4) ? s->height * 4 - 1 : y1;
+    if (x1 < x0 || y1 < y0)
+        return;
+
+    for (int cy = y0 / 4; cy <= y1 / 4; ++cy) {
+        int top = (y1 < cy * 4 + 3) ? y1 : cy * 4 + 3;
+        unsigned char left = 0, right = 0;
+        for (int ry = (y0 > cy * 4) ? y0 : cy * 4; ry <= top; ++ry) {
+            left |= braillePositionVals[(ry % 4) * 2];
+            right |= braillePositionVals[(ry % 4) * 2 + 1];
+        }
+
+        unsigned char *row = s->data + (s->height - 1 - cy) * s->width;
+        int c0 = x0 / 2, c1 = x1 / 2;
+        if (x0 & 1)
+            row[c0++] |= right;
+        if (c0 <= c1 && !(x1 & 1))
+            row[c1--] |= left;
+        if (c0 <= c1)
+            kernels.fill(row + c0, left | right, c1 - c0 + 1);
+    }
+}
+
+/*----------------------------------------------------------------------------
+ * drawRect
+ *
+ * Take x and y coordinates and draw a w by h rectangle, filled or unfilled,
+ * using the drawPoint function.
+ *----------------------------------------------------------------------------*/
+void drawRect(Surface *s, int x, int y, int w, int h, int fill)
+{
+    if (trace.fp) {
+        float args[5] = {x, y, w, h, fill};
+        traceCall(s, TRACE_RECT, args, 5);
+    }
+    ++traceDepth;
+
+    if (fill) {
+        fillRect(s, x, y, x + w - 1, y + h - 1);
+    } else {
+        for (int i = 0; i < w; ++i) {
+            drawPoint(s, x + i, y, 1);
+            drawPoint(s, x + i, y + h - 1, 1);
+        }
+        for (int i = 1; i < h - 1; ++i) {
+            drawPoint(s, x, y + i, 1);
+            drawPoint(s, x + w - 1, y + i, 1);
+        }
+    }
+
+    --traceDepth;
+}
+
+/*----------------------------------------------------------------------------
+ * drawCircle
+ *
+ * Draw a circle of radius r around cx, cy, filled or unfilled, stepping
+ * round an eighth of it with the midpoint algorithm and mirroring the rest.
+ * A filled circle is drawn as a horizontal span for each of its rows.
+ *----------------------------------------------------------------------------*/
+void drawCircle(Surface *s, int cx, int cy, int r, int fill)
+{
+    int x = r, y = 0, err = 1 - r;
+
+    if (trace.fp) {
+        float args[4] = {cx, cy, r, fill};
+        traceCall(s, TRACE_CIRCLE, args, 4);
+    }
+    ++traceDepth;
+
+    while (x >= y) {
+        if (fill) {
+            drawRect(s, cx - x, cy + y, 2 * x + 1, 1, 1);
+            drawRect(s, cx - x, cy - y, 2 * x + 1, 1, 1);
+            drawRect(s, cx - y, cy + x, 2 * y + 1, 1, 1);
+            drawRect(s, cx - y, cy - x, 2 * y + 1, 1, 1);
+        } else {
+            drawPoint(s, cx + x, cy + y, 1);
+            drawPoint(s, cx - x, cy + y, 1);
+            drawPoint(s, cx + x, cy - y, 1);
+            drawPoint(s, cx - x, cy - y, 1);
+            drawPoint(s, cx + y, cy + x, 1);
+            drawPoint(s, cx - y, cy + x, 1);
+            drawPoint(s, cx + y, cy - x, 1);
+            drawPoint(s, cx - y, cy - x, 1);
+        }
+
+        ++y;
+        if (err < 0) {
+            err += 2 * y + 1;
+        } else {
+            --x;
+            err += 2 * (y - x) + 1;
+        }
+    }
+
+    --traceDepth;
+}
+
+/*----------------------------------------------------------------------------
+ * drawBitmap
+ *
+ * Draw a bitmap, an array of ones and zeros representing pixels, to the
+ * screen at position x, y, using drawPoint.
+ *----------------------------------------------------------------------------*/
+void drawBitmap(Surface *s, Surface *bitmap, int x, int y)
+{
+    unsigned char *p = bitmap->data;
+
+    if (trace.fp && !traceDepth) {
+        float args[3] = {traceSurface(bitmap, 1), x, y};
+        traceCall(s, TRACE_DRAW_BITMAP, args, 3);
+    }
+    ++traceDepth;
+
+    /* Even though the Y origin of our coordinate system is at the bottom of
+     * the screen, BMP data is already "upside down", so we can read the data
+     * in the usual top to bottom way. */
+    for (int i = 0; i < bitmap->height; ++i) {
+        for (int j = 0; j < bitmap->width; ++j) {
+            drawPoint(s, x + j, y + i, *p++);
+        }
+    }
+
+    --traceDepth;
+}
+
+/*----------------------------------------------------------------------------
+ * bayerThreshold, drawDitheredPoint
+ *
+ * Braille dots are either on or off, so shades of intensity are approximated
+ * by ordered dithering: each dot is compared against a threshold from a 4x4
+ * Bayer matrix, and a patch of dots at intensity 0.25 ends up with a quarter
+ * of them set. The intensity is expected to be in the range 0 to 1.
+ *----------------------------------------------------------------------------*/
+float bayerThreshold(int x, int y)
+{
+    static const unsigned char bayer[16] = {
+        0, 8, 2, 10,
+        12, 4, 14, 6,
+        3, 11, 1, 9,
+        15, 7, 13, 5
+    };
+
+    return (bayer[((y & 3) << 2) | (x & 3)] + 0.5f) / 16.0f;
+}
+
+int drawDitheredPoint(Surface *s, int x, int y, float intensity)
+{
+    if (trace.fp) {
+        float args[3] = {x, y, intensity};
+        traceCall(s, TRACE_DITHER, args, 3);
+    }
+
+    ++traceDepth;
+    int result = drawPoint(s, x, y, intensity > bayerThreshold(x, y));
+    --traceDepth;
+
+    return result;
+}
+
+/*----------------------------------------------------------------------------
+ * drawDitheredSpan
+ *
+ * Dither n dots along row y from x, with one intensity each. The whole cells
+ * in the middle of the row go through the dither kernel.
+ *----------------------------------------------------------------------------*/
+void drawDitheredSpan(Surface *s, int x, int y, const float *intensity, int n)
+{
+    int a = (x < 0) ? 0 : (x + 1) & ~1;
+    int b = (x + n - 1 >= s->width * 2) ? s->width * 2 - 1 : x + n - 1;
+
+    if (!(b & 1))
+        --b;
+
+    /* Tracing sees each point, and the edges are done a point at a time */
+    if (trace.fp || y < 0 || y >= s->height * 4 || b < a) {
+        for (int i = 0; i < n; ++i)
+            drawDitheredPoint(s, x + i, y, intensity[i]);
+        return;
+    }
+    for (int i = x; i < a; ++i)
+        drawDitheredPoint(s, i, y, intensity[i - x]);
+    for (int i = b + 1; i < x + n; ++i)
+        drawDitheredPoint(s, i, y, intensity[i - x]);
+
+    float threshold[4];
+    for (int k = 0; k < 4; ++k)
+        threshold[k] = bayerThreshold(a + k, y);
+    unsigned char bits[2] = {braillePositionVals[(y % 4) * 2], braillePositionVals[(y % 4) * 2 + 1]};
+
+    unsigned char *row = s->data + (s->height - 1 - y / 4) * s->width;
+    kernels.dither(row + a / 2, intensity + (a - x), (b - a + 1) / 2, threshold, bits);
+}
+
+/*----------------------------------------------------------------------------
+ * Expressions
+ *
+ * A small language for formulas such as "a*sin(x*t) + x^2/10", so that curves
+ * other than the quadratic drawCurve knows can be plotted without recompiling.
+ * A formula is parsed once into a flat program for a stack machine. The
+ * program is then run over blocks of EXPR_BLOCK x values at a time, each
+ * instruction looping over the whole block, so interpretation costs next to
+ * nothing per value and the arithmetic loops are vectorized by the compiler.
+ *
+ * Numbers, + - * / ^, unary minus, parentheses, the constants pi and e, and
+ * the functions below are understood. The variable x is the input, and any
+ * other single letter is a parameter whose value is set with setExprParam.
+ *----------------------------------------------------------------------------*/
+#define EXPR_BLOCK 64
+
+enum {
+    EXPR_CONST, EXPR_X, EXPR_PARAM,
+    EXPR_ADD, EXPR_SUB, EXPR_MUL, EXPR_DIV, EXPR_POW, EXPR_NEG,
+    EXPR_SIN, EXPR_COS, EXPR_TAN, EXPR_ASIN, EXPR_ACOS, EXPR_ATAN,
+    EXPR_SINH, EXPR_COSH, EXPR_TANH, EXPR_EXP, EXPR_LOG, EXPR_LOG10,
+    EXPR_SQRT, EXPR_ABS, EXPR_FLOOR, EXPR_CEIL
+};
+
+static const char *exprFuncs[] = {
+    "sin", "cos", "tan", "asin", "acos", "atan", "sinh", "cosh", "tanh",
+    "exp", "log", "log10", "sqrt", "abs", "floor", "ceil"
+};
+
+typedef struct ExprOp {
+    unsigned char op;
+    unsigned char param;
+    float value;
+} ExprOp;
+
+typedef struct Expr {
+    ExprOp *code;
+    int len;
+    int cap;
+    int depth;
+    int maxDepth;
+    float params[26];
+    const char *src;
+    const char *pos;
+    const char *error;
+} Expr;
+
+/*----------------------------------------------------------------------------
+ * exprEmit, exprSkip, exprAdd, exprTerm, exprUnary, exprPower, exprPrimary
+ *
+ * Recursive descent parser. Each rule emits the code for what it parsed and
+ * keeps track of the deepest the stack can get. Operations whose operands are
+ * all constants are folded as they are emitted.
+ *----------------------------------------------------------------------------*/
+static float exprApply(int op, float a, float b)
+{
+    switch (op) {
+    case EXPR_ADD: return a + b;
+    case EXPR_SUB: return a - b;
+    case EXPR_MUL: return a * b;
+    case EXPR_DIV: return a / b;
+    case EXPR_POW: return powf(a, b);
+    case EXPR_NEG: return -a;
+    case EXPR_SIN: return sinf(a);
+    case EXPR_COS: return cosf(a);
+    case EXPR_TAN: return tanf(a);
+    case EXPR_ASIN: return asinf(a);
+    case EXPR_ACOS: return acosf(a);
+    case EXPR_ATAN: return atanf(a);
+    case EXPR_SINH: return sinhf(a);
+    case EXPR_COSH: return coshf(a);
+    case EXPR_TANH: return tanhf(a);
+    case EXPR_EXP: return expf(a);
+    case EXPR_LOG: return logf(a);
+    case EXPR_LOG10: return log10f(a);
+    case EXPR_SQRT: return sqrtf(a);
+    case EXPR_ABS: return fabsf(a);
+    case EXPR_FLOOR: return floorf(a);
+    default: return ceilf(a);
+    }
+}
+
+static void exprEmit(Expr *e, int op, int param, float value)
+{
+    int binary = op >= EXPR_ADD && op <= EXPR_POW;
+    int unary = op >= EXPR_NEG;
+
+    if (e->len > 0) {
+        ExprOp *top = e->code + e->len - 1;
+        if (binary && e->len >= 2 && top[-1].op == EXPR_CONST && top->op == EXPR_CONST) {
+            top[-1].value = exprApply(op, top[-1].value, top->value);
+            --e->len;
+            --e->depth;
+            return;
+        }
+        if (unary && top->op == EXPR_CONST) {
+            top->value = exprApply(op, top->value, 0.0f);
+            return;
+        }
+    }
+
+    if (e->len == e->cap) {
+        e->cap = e->cap ? e->cap * 2 : 16;
+        e->code = (ExprOp *)realloc(e->code, e->cap * sizeof(ExprOp));
+    }
+    e->code[e->len].op = op;
+    e->code[e->len].param = param;
+    e->code[e->len].value = value;
+    ++e->len;
+
+    if (op <= EXPR_PARAM && ++e->depth > e->maxDepth)
+        e->maxDepth = e->depth;
+    else if (binary)
+        --e->depth;
+}
+
+static void exprSkip(Expr *e)
+{
+    while (*e->pos == ' ' || *e->pos == '\t')
+        ++e->pos;
+}
+
+static void exprAdd(Expr *e);
+
+static void exprPrimary(Expr *e)
+{
+    char name[8];
+    int len = 0;
+
+    exprSkip(e);
+    if (e->error)
+        return;
+
+    if ((*e->pos >= '0' && *e->pos <= '9') || *e->pos == '.') {
+        char *end;
+        exprEmit(e, EXPR_CONST, 0, strtof(e->pos, &end));
+        e->pos = end;
+    } else if (*e->pos == '(') {
+        ++e->pos;
+        exprAdd(e);
+        exprSkip(e);
+        if (*e->pos != ')') {
+            e->error = "expected )";
+            return;
+        }
+        ++e->pos;
+    } else if (*e->pos >= 'a' && *e->pos <= 'z') {
+        while (((e->pos[len] >= 'a' && e->pos[len] <= 'z') || (len && e->pos[len] >= '0' && e->pos[len] <= '9')) && len < 7) {
+            name[len] = e->pos[len];
+            ++len;
+        }
+        name[len] = '\0';
+
+        if (len == 1) {
+            e->pos += len;
+            if (name[0] == 'x')
+                exprEmit(e, EXPR_X, 0, 0.0f);
+            else if (name[0] == 'e')
+                exprEmit(e, EXPR_CONST, 0, (float)M_E);
+            else
+                exprEmit(e, EXPR_PARAM, name[0] - 'a', 0.0f);
+            return;
+        }
+        if (!strcmp(name, "pi")) {
+            e->pos += len;
+            exprEmit(e, EXPR_CONST, 0, (float)M_PI);
+            return;
+        }
+        for (int i = 0; i < (int)(sizeof(exprFuncs) / sizeof(*exprFuncs)); ++i) {
+            if (!strcmp(name, exprFuncs[i])) {
+                e->pos += len;
+                exprSkip(e);
+                if (*e->pos != '(') {
+                    e->error = "expected (";
+                    return;
+                }
+                exprPrimary(e);
+                exprEmit(e, EXPR_SIN + i, 0, 0.0f);
+                return;
+            }
+        }
+        e->error = "unknown name";
+    } else {
+        e->error = *e->pos ? "unexpected character" : "unexpected end";
+    }
+}
+
+static void exprUnary(Expr *e);
+
+static void exprPower(Expr *e)
+{
+    exprPrimary(e);
+    exprSkip(e);
+    if (!e->error && *e->pos == '^') {
+        /* Right associative, and binds tighter than a minus on its left */
+        ++e->pos;
+        exprUnary(e);
+        exprEmit(e, EXPR_POW, 0, 0.0f);
+    }
+}
+
+static void exprUnary(Expr *e)
+{
+    exprSkip(e);
+    if (*e->pos == '-') {
+        ++e->pos;
+        exprUnary(e);
+        exprEmit(e, EXPR_NEG, 0, 0.0f);
+    } else if (*e->pos == '+') {
+        ++e->pos;
+        exprUnary(e);
+    } else {
+        exprPower(e);
+    }
+}
+
+static void exprTerm(Expr *e)
+{
+    exprUnary(e);
+    for (exprSkip(e); !e->error && (*e->pos == '*' || *e->pos == '/'); exprSkip(e)) {
+        int op = (*e->pos++ == '*') ? EXPR_MUL : EXPR_DIV;
+        exprUnary(e);
+        exprEmit(e, op, 0, 0.0f);
+    }
+}
+
+static void exprAdd(Expr *e)
+{
+    exprTerm(e);
+    for (exprSkip(e); !e->error && (*e->pos == '+' || *e->pos == '-'); exprSkip(e)) {
+        int op = (*e->pos++ == '+') ? EXPR_ADD : EXPR_SUB;
+        exprTerm(e);
+        exprEmit(e, op, 0, 0.0f);
+    }
+}
+
+/*----------------------------------------------------------------------------
+ * compileExpr
+ *
+ * Parse a formula into the Expr struct. Return 0 on success, or the offset
+ * into the source at which parsing failed, plus one, with a description of
+ * the problem left in e->error. Parameters keep their values when an Expr is
+ * compiled again, so a formula can be replaced while it is being animated.
+ *----------------------------------------------------------------------------*/
+int compileExpr(Expr *e, const char *src)
+{
+    e->len = 0;
+    e->depth = 0;
+    e->maxDepth = 0;
+    e->src = src;
+    e->pos = src;
+    e->error = NULL;
+
+    exprAdd(e);
+    exprSkip(e);
+    if (!e->error && *e->pos)
+        e->error = "unexpected character";
+
+    return e->error ? (int)(e->pos - src) + 1 : 0;
+}
+
+/*----------------------------------------------------------------------------
+ * setExprParam, freeExpr
+ *
+ * Set a named parameter, a to z, for the next evaluation of a formula, and
+ * release a compiled formula.
+ *----------------------------------------------------------------------------*/
+void setExprParam(Expr *e, char name, float value)
+{
+    if (name >= 'a' && name <= 'z')
+        e->params[name - 'a'] = value;
+}
+
+void freeExpr(Expr *e)
+{
+    free(e->code);
+    e->code = NULL;
+    e->len = e->cap = 0;
+}
+
+/*----------------------------------------------------------------------------
+ * evalExpr
+ *
+ * Evaluate a compiled formula for n values of x, storing the results in y.
+ * A formula that didn't compile gives NAN for every x.
+ *----------------------------------------------------------------------------*/
+void evalExpr(Expr *e, const float *x, float *y, int n)
+{
+    float stackBuf[16][EXPR_BLOCK];
+    float (*stack)[EXPR_BLOCK] = stackBuf;
+
+    if (e->maxDepth > 16)
+        stack = (float (*)[EXPR_BLOCK])malloc(e->maxDepth * sizeof(*stack));
+
+    for (int base = 0; base < n; base += EXPR_BLOCK) {
+        int m = (n - base < EXPR_BLOCK) ? n - base : EXPR_BLOCK;
+        int sp = -1;
+
+        for (ExprOp *op = e->code; op < e->code + e->len; ++op) {
+            float *a, *b, v;
+
+            switch (op->op) {
+            case EXPR_CONST:
+            case EXPR_PARAM:
+                v = (op->op == EXPR_CONST) ? op->value : e->params[op->param];
+                a = stack[++sp];
+                for (int i = 0; i < m; ++i)
+                    a[i] = v;
+                break;
+            case EXPR_X:
+                memcpy(stack[++sp], x + base, m * sizeof(float));
+                break;
+            case EXPR_ADD:
+                b = stack[sp];
+                a = stack[--sp];
+                for (int i = 0; i < m; ++i)
+                    a[i] += b[i];
+                break;
+            case EXPR_SUB:
+                b = stack[sp];
+                a = stack[--sp];
+                for (int i = 0; i < m; ++i)
+                    a[i] -= b[i];
+                break;
+            case EXPR_MUL:
+                b = stack[sp];
+                a = stack[--sp];
+                for (int i = 0; i < m; ++i)
+                    a[i] *= b[i];
+                break;
+            case EXPR_DIV:
+                b = stack[sp];
+                a = stack[--sp];
+                for (int i = 0; i < m; ++i)
+                    a[i] /= b[i];
+                break;
+            case EXPR_POW:
+                b = stack[sp];
+                a = stack[--sp];
+                for (int i = 0; i < m; ++i)
+                    a[i] = powf(a[i], b[i]);
+                break;
+            case EXPR_NEG:
+                a = stack[sp];
+                for (int i = 0; i < m; ++i)
+                    a[i] = -a[i];
+                break;
+            default:
+                a = stack[sp];
+                for (int i = 0; i < m; ++i)
+                    a[i] = exprApply(op->op, a[i], 0.0f);
+                break;
+            }
+        }
+
+        if (sp == 0)
+            memcpy(y + base, stack[0], m * sizeof(float));
+        else
+            for (int i = 0; i < m; ++i)
+                y[base + i] = NAN;
+    }
+
+    if (stack != stackBuf)
+        free(stack);
+}
+
+/*----------------------------------------------------------------------------
+ * plotExpr
+ *
+ * Plot a formula over the window xmin to xmax, ymin to ymax, which is mapped
+ * onto the whole Surface. The formula is evaluated once per column of dots,
+ * or every few columns at less than full detail, and neighboring values are
+ * joined with lines. The plot is broken wherever the value is undefined or
+ * leaps across the whole window, as at the asymptotes of tan(x).
+ *----------------------------------------------------------------------------*/
+static inline int plotColumn(int j, int stride, int w)
+{
+    return (j * stride < w - 1) ? j * stride : w - 1;
+}
+
+void plotExpr(Surface *s, Expr *e, float xmin, float xmax, float ymin, float ymax)
+{
+    int w = s->width * 2, h = s->height * 4;
+    int stride = lodStride();
+    int n = (w - 1 + stride - 1) / stride + 1;
+    float *x = (float *)malloc(n * 2 * sizeof(float));
+    float *y = x + n;
+
+    for (int j = 0; j < n; ++j)
+        x[j] = xmin + (xmax - xmin) * plotColumn(j, stride, w) / (w - 1);
+    evalExpr(e, x, y, n);
+
+    /* Map to dots, clamping to just outside the Surface so that lines to
+     * far-off points stay short. */
+    float scale = (h - 1) / (ymax - ymin);
+    for (int j = 0; j < n; ++j) {
+        float dy = (y[j] - ymin) * scale;
+        y[j] = (dy != dy) ? NAN : (dy < -1.0f) ? -1.0f : (dy > h) ? h : dy;
+    }
+
+    pushTransform();
+    resetTransform();
+
+    for (int j = 0; j < n; ++j) {
+        int col = plotColumn(j, stride, w);
+        if (y[j] != y[j])
+            continue;
+        if (j == 0 || y[j - 1] != y[j - 1] || fAbs(y[j - 1], y[j]) > h) {
+            drawPoint(s, col, y[j], 1);
+        } else {
+            drawLine(s, plotColumn(j - 1, stride, w), y[j - 1], col, y[j]);
+        }
+    }
+
+    popTransform();
+    free(x);
+}
+
+
+/*----------------------------------------------------------------------------
+ * encodeCells
+ *
+ * Write the UTF-8 encoding of n cells to dst, three bytes each.
+ *----------------------------------------------------------------------------*/
+static void encodeCells(unsigned char *dst, const unsigned char *src, int n)
+{
+    kernels.encode(dst, src, n);
+}
+
+/*----------------------------------------------------------------------------
+ * Virtual terminal
+ *
+ * A VTerm is a small model of the terminal louis draws on: a grid of cells,
+ * a cursor with the usual deferred wrap at the right margin, and a parser for
+ * the UTF-8 text and escape sequences the library writes (cursor position,
+ * clear screen and line, cursor visibility, carriage return and newline).
+ * Feeding it the output of render, renderDamage or renderThrottled leaves it
+ * showing what a real terminal would, so compareVTerm can check the picture
+ * against the Surface it came from.
+ *
+ * After setOutputSink(vt), everything the library writes goes to vt instead
+ * of STDOUT, which makes it a headless terminal for benchmarks and automated
+ * checks. The byte, escape sequence and glyph counts it keeps show what each
+ * frame costs to send.
+ *----------------------------------------------------------------------------*/
+typedef struct VTerm {
+    int width;
+    int height;
+    unsigned int *cells;
+    int x;
+    int y;
+    int wrap;
+    int cursorVisible;
+    int state;
+    int params[8];
+    int nparams;
+    int privateMode;
+    unsigned int code;
+    int more;
+    long bytes;
+    long escapes;
+    long glyphs;
+} VTerm;
+
+enum {VT_GROUND, VT_ESCAPE, VT_CSI};
+
+static VTerm *outputSink;
+
+/*----------------------------------------------------------------------------
+ * initVTerm, freeVTerm, resetVTermStats
+ *
+ * A new VTerm is blank, with the cursor at the top left.
+ *----------------------------------------------------------------------------*/
+void initVTerm(VTerm *vt, int width, int height)
+{
+    memset(vt, 0, sizeof(VTerm));
+    vt->width = width;
+    vt->height = height;
+    vt->cells = (unsigned int *)malloc(width * height * sizeof(unsigned int));
+    vt->cursorVisible = 1;
+    for (int i = 0; i < width * height; ++i)
+        vt->cells[i] = ' ';
+}
+
+void freeVTerm(VTerm *vt)
+{
+    if (outputSink == vt)
+        outputSink = NULL;
+    free(vt->cells);
+    vt->cells = NULL;
+}
+
+void resetVTermStats(VTerm *vt)
+{
+    vt->bytes = 0;
+    vt->escapes = 0;
+    vt->glyphs = 0;
+}
+
+/*----------------------------------------------------------------------------
+ * vtPut, vtCsi
+ *
+ * Put a character at the cursor, and carry out a control sequence. A
+ * character written in the last column leaves the cursor there until the next
+ * one, which goes to the start of the next line, scrolling at the bottom.
+ *----------------------------------------------------------------------------*/
+static void vtPut(VTerm *vt, unsigned int c)
+{
+    if (vt->wrap) {
+        vt->x = 0;
+        vt->wrap = 0;
+        if (++vt->y == vt->height) {
+            memmove(vt->cells, vt->cells + vt->width, (vt->height - 1) * vt->width * sizeof(unsigned int));
+            --vt->y;
+            for (int x = 0; x < vt->width; ++x)
+                vt->cells[vt->y * vt->width + x] = ' ';
+        }
+    }
+
+    vt->cells[vt->y * vt->width + vt->x] = c;
+    ++vt->glyphs;
+    if (vt->x == vt->width - 1)
+        vt->wrap = 1;
+    else
+        ++vt->x;
+}
+
+static void vtCsi(VTerm *vt, char final)
+{
+    int p0 = vt->nparams > 0 ? vt->params[0] : 0;
+    int p1 = vt->nparams > 1 ? vt->params[1] : 0;
+    int from = 0, to = 0;
+
+    switch (final) {
+    case 'H':
+    case 'f':
+        vt->y = p0 < 1 ? 0 : (p0 > vt->height ? vt->height - 1 : p0 - 1);
+        vt->x = p1 < 1 ? 0 : (p1 > vt->width ? vt->width - 1 : p1 - 1);
+        break;
+    case 'A': vt->y -= p0 < 1 ? 1 : p0; break;
+    case 'B': vt->y += p0 < 1 ? 1 : p0; break;
+    case 'C': vt->x += p0 < 1 ? 1 : p0; break;
+    case 'D': vt->x -= p0 < 1 ? 1 : p0; break;
+    case 'J':
+    case 'K':
+        /* Erase from the cursor to the end, from the start to the cursor, or
+         * all, of the screen or the line */
+        if (final == 'J') {
+            from = (p0 == 0) ? vt->y * vt->width + vt->x : 0;
+            to = (p0 == 1) ? vt->y * vt->width + vt->x + 1 : vt->width * vt->height;
+        } else {
+            from = vt->y * vt->width + ((p0 == 0) ? vt->x : 0);
+            to = vt->y * vt->width + ((p0 == 1) ? vt->x + 1 : vt->width);
+        }
+        for (int i = from; i < to; ++i)
+            vt->cells[i] = ' ';
+        break;
+    case 'h':
+    case 'l':
+        if (vt->privateMode && p0 == 25)
+            vt->cursorVisible = (final == 'h');
+        break;
+    }
+
+    if (vt->x < 0) vt->x = 0;
+    if (vt->y < 0) vt->y = 0;
+    if (vt->x >= vt->width) vt->x = vt->width - 1;
+    if (vt->y >= vt->height) vt->y = vt->height - 1;
+    vt->wrap = 0;
+}
+
+/*----------------------------------------------------------------------------
+ * feedVTerm
+ *
+ * Run n bytes of terminal output through the model.
+ *----------------------------------------------------------------------------*/
+void feedVTerm(VTerm *vt, const unsigned char *buf, int n)
+{
+    vt->bytes += n;
+
+    for (int i = 0; i < n; ++i) {
+        unsigned char c = buf[i];
+
+        if (vt->state == VT_ESCAPE) {
+            vt->state = VT_GROUND;
+            if (c == '[') {
+                vt->state = VT_CSI;
+                vt->nparams = 0;
+                vt->privateMode = 0;
+                memset(vt->params, 0, sizeof(vt->params));
+            }
+            continue;
+        }
+
+        if (vt->state == VT_CSI) {
+            if (c >= '0' && c <= '9') {
+                if (vt->nparams == 0)
+                    vt->nparams = 1;
+                if (vt->nparams <= 8)
+                    vt->params[vt->nparams - 1] = vt->params[vt->nparams - 1] * 10 + (c - '0');
+            } else if (c == ';') {
+                if (vt->nparams == 0)
+                    vt->nparams = 1;
+                ++vt->nparams;
+            } else if (c == '?') {
+                vt->privateMode = 1;
+            } else if (c >= 0x40 && c <= 0x7E) {
+                vtCsi(vt, c);
+                vt->state = VT_GROUND;
+            }
+            continue;
+        }
+
+        /* Continue or start a UTF-8 sequence */
+        if (vt->more && (c & 0xC0) == 0x80) {
+            vt->code = (vt->code << 6) | (c & 0x3F);
+            if (--vt->more == 0)
+                vtPut(vt, vt->code);
+            continue;
+        }
+        vt->more = 0;
+
+        if (c == 0x1B) {
+            vt->state = VT_ESCAPE;
+            ++vt->escapes;
+        } else if (c == '\r') {
+            vt->x = 0;
+            vt->wrap = 0;
+        } else if (c == '\n') {
+            if (vt->y < vt->height - 1)
+                ++vt->y;
+            vt->wrap = 0;
+        } else if (c == '\b') {
+            if (vt->x > 0)
+                --vt->x;
+            vt->wrap = 0;
+        } else if (c >= 0xF0) {
+            vt->code = c & 0x07;
+            vt->more = 3;
+        } else if (c >= 0xE0) {
+            vt->code = c & 0x0F;
+            vt->more = 2;
+        } else if (c >= 0xC0) {
+            vt->code = c & 0x1F;
+            vt->more = 1;
+        } else if (c >= ' ' && c < 0x7F) {
+            vtPut(vt, c);
+        }
+    }
+}
+
+/*----------------------------------------------------------------------------
+ * compareVTerm
+ *
+ * Return the number of cells where the terminal doesn't show the Surface,
+ * checking the cells of the size they share. A blank, as left by clearing,
+ * passes for an empty braille cell.
+ *----------------------------------------------------------------------------*/
+int compareVTerm(VTerm *vt, Surface *s)
+{
+    int w = s->width < vt->width ? s->width : vt->width;
+    int h = s->height < vt->height ? s->height : vt->height;
+    int wrong = 0;
+
+    for (int y = 0; y < h; ++y) {
+        for (int x = 0; x < w; ++x) {
+            unsigned int c = vt->cells[y * vt->width + x];
+            unsigned char b = s->data[y * s->width + x];
+            wrong += !(c == 0x2800u + b || (c == ' ' && b == 0));
+        }
+    }
+
+    return wrong;
+}
+
+/*----------------------------------------------------------------------------
+ * Render threads
+ *
+ * On very large terminals, encoding the cells takes a good part of each frame.
+ * After setRenderThreads(n), render splits the rows into n bands of equal
+ * size and encodes them at the same time, the calling thread taking the first
+ * band and a pool of n - 1 worker threads the rest. Every band lands at its
+ * own place in the screen buffer, and the pieces are written with a single
+ * writev, so the output is byte for byte what the serial encoder produces.
+ * Surfaces too small to be worth waking the workers for are still encoded on
+ * the calling thread.
+ *----------------------------------------------------------------------------*/
+#define RENDER_MIN_BAND_CELLS 4096
+#define RENDER_MAX_THREADS 64
+
+static struct RenderPool {
+    pthread_t threads[RENDER_MAX_THREADS];
+    int count;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t finished;
+    unsigned long generation;
+    int pending;
+    int quit;
+    const unsigned char *src;
+    unsigned char *dst;
+    int width;
+    int rows;
+    int bands;
+} renderPool = {.lock = PTHREAD_MUTEX_INITIALIZER, .start = PTHREAD_COND_INITIALIZER,
+                .finished = PTHREAD_COND_INITIALIZER};
+
+/*----------------------------------------------------------------------------
+ * encodeBand, renderWorker
+ *
+ * Band i of the current frame covers rows i * rows / bands up to the start
+ * of band i + 1. Workers sleep until the generation changes, encode their
+ * band, and report back.
+ *----------------------------------------------------------------------------*/
+static void encodeBand(struct RenderPool *rp, int band)
+{
+    int row0 = band * rp->rows / rp->bands;
+    int row1 = (band + 1) * rp->rows / rp->bands;
+    int first = row0 * rp->width;
+
+    encodeCells(rp->dst + first * 3, rp->src + first, (row1 - row0) * rp->width);
+}
+
+static void *renderWorker(void *arg)
+{
+    struct RenderPool *rp = &renderPool;
+    int band = (int)(size_t)arg;
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&rp->lock);
+    for (;;) {
+        while (rp->generation == seen && !rp->quit)
+            pthread_cond_wait(&rp->start, &rp->lock);
+        if (rp->quit)
+            break;
+        seen = rp->generation;
+
+        if (band < rp->bands) {
+            pthread_mutex_unlock(&rp->lock);
+            encodeBand(rp, band);
+            pthread_mutex_lock(&rp->lock);
+            if (--rp->pending == 0)
+                pthread_cond_signal(&rp->finished);
+        }
+    }
+    pthread_mutex_unlock(&rp->lock);
+
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------
+ * setRenderThreads
+ *
+ * Choose how many threads render encodes with, 1 meaning the calling thread
+ * alone, and start or stop workers to match.
+ *----------------------------------------------------------------------------*/
+void setRenderThreads(int n)
+{
+    struct RenderPool *rp = &renderPool;
+
+    if (n < 1)
+        n = 1;
+    if (n > RENDER_MAX_THREADS)
+        n = RENDER_MAX_THREADS;
+
+    if (rp->count) {
+        pthread_mutex_lock(&rp->lock);
+        rp->quit = 1;
+        pthread_cond_broadcast(&rp->start);
+        pthread_mutex_unlock(&rp->lock);
+        for (int i = 0; i < rp->count; ++i)
+            pthread_join(rp->threads[i], NULL);
+        rp->count = 0;
+        rp->quit = 0;
+    }
+
+    /* New workers start out having seen generation 0, so restart the count
+     * rather than have them take the last frame for a new one */
+    rp->generation = 0;
+    for (int i = 1; i < n; ++i) {
+        if (pthread_create(&rp->threads[rp->count], NULL, renderWorker, (void *)(size_t)i))
+            break;
+        ++rp->count;
+    }
+}
+
+/*----------------------------------------------------------------------------
+ * io_uring output
+ *
+ * With useIoUring(1), render hands finished frames to the kernel through an
+ * io_uring instead of calling write, so the frame loop never waits for the
+ * terminal to take the bytes. Frames are encoded into one of two buffers
+ * registered with the kernel ahead of time. One frame at a time is in flight,
+ * which keeps frames in order; a frame finished while another is still being
+ * written waits in the second buffer, and is replaced if yet another frame
+ * comes along first, since only the latest picture matters. Anything else
+ * written meanwhile, such as a status line over the frame or the changes
+ * renderDamage sends, is added after the frame waiting in the second buffer,
+ * or becomes the waiting write itself, and is replaced with it: a new frame
+ * covers the whole screen. Completions are collected, and short writes
+ * continued, on each call to render, or with flushOutput, which waits for
+ * everything to be written.
+ *
+ * Programs turn it on with useIoUring(1), or by setting LOUIS_IO_URING in
+ * the environment, which initLouis checks. Where io_uring is missing or not
+ * permitted, useIoUring returns -1 and render keeps writing as before.
+ *----------------------------------------------------------------------------*/
+#ifdef LOUIS_IO_URING
+#define URING_APPEND 4096
+
+static struct Uring {
+    int fd;
+    unsigned int *sqHead;
+    unsigned int *sqTail;
+    unsigned int *sqMask;
+    unsigned int *sqArray;
+    unsigned int *cqHead;
+    unsigned int *cqTail;
+    unsigned int *cqMask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sqRing;
+    void *cqRing;
+    size_t sqRingSize;
+    size_t cqRingSize;
+    size_t sqesSize;
+    unsigned char *buffers[2];
+    int bufferSize;
+    int length[2];
+    int inFlight;
+    int sent;
+    int pending;
+} uring = {.fd = -1, .inFlight = -1, .pending = -1};
+
+/*----------------------------------------------------------------------------
+ * uringSubmit, uringReap
+ *
+ * Queue a write of the unsent part of the buffer in flight, and collect
+ * completed writes, optionally waiting for at least one.
+ *----------------------------------------------------------------------------*/
+static void uringSubmit()
+{
+    unsigned int tail = *uring.sqTail;
+    unsigned int idx = tail & *uring.sqMask;
+    struct io_uring_sqe *sqe = &uring.sqes[idx];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITE_FIXED;
+    sqe->fd = 1;
+    sqe->off = (unsigned long long)-1;
+    sqe->addr = (unsigned long)(uring.buffers[uring.inFlight] + uring.sent);
+    sqe->len = uring.length[uring.inFlight] - uring.sent;
+    sqe->buf_index = uring.inFlight;
+
+    uring.sqArray[idx] = idx;
+    __atomic_store_n(uring.sqTail, tail + 1, __ATOMIC_RELEASE);
+    syscall(__NR_io_uring_enter, uring.fd, 1, 0, 0, NULL, 0);
+}
+
+static void uringReap(int wait)
+{
+    if (wait && uring.inFlight >= 0)
+        syscall(__NR_io_uring_enter, uring.fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+
+    unsigned int head = *uring.cqHead;
+    while (head != __atomic_load_n(uring.cqTail, __ATOMIC_ACQUIRE)) {
+        int res = uring.cqes[head & *uring.cqMask].res;
+        ++head;
+
+        /* On an error the rest of the frame is given up on; the next one
+         * draws the whole screen again anyway. */
+        uring.sent += res > 0 ? res : uring.length[uring.inFlight];
+        if (uring.sent < uring.length[uring.inFlight]) {
+            uringSubmit();
+            continue;
+        }
+
+        uring.inFlight = uring.pending;
+        uring.pending = -1;
+        uring.sent = 0;
+        if (uring.inFlight >= 0)
+            uringSubmit();
+    }
+    __atomic_store_n(uring.cqHead, head, __ATOMIC_RELEASE);
+}
+
+/*----------------------------------------------------------------------------
+ * uringBuffers
+ *
+ * Make sure the registered buffers hold at least size bytes, registering
+ * bigger ones if needed. Return -1 if they can't be set up.
+ *----------------------------------------------------------------------------*/
+static int uringBuffers(int size)
+{
+    struct iovec iov[2];
+
+    if (size <= uring.bufferSize)
+        return 0;
+
+    /* The old buffers must not be replaced while the kernel uses them */
+    while (uring.inFlight >= 0)
+        uringReap(1);
+    if (uring.bufferSize)
+        syscall(__NR_io_uring_register, uring.fd, IORING_UNREGISTER_BUFFERS, NULL, 0);
+
+    for (int i = 0; i < 2; ++i) {
+        free(uring.buffers[i]);
+        uring.buffers[i] = (unsigned char *)malloc(size);
+        iov[i].iov_base = uring.buffers[i];
+        iov[i].iov_len = size;
+    }
+    uring.bufferSize = size;
+
+    if (!uring.buffers[0] || !uring.buffers[1] ||
+        syscall(__NR_io_uring_register, uring.fd, IORING_REGISTER_BUFFERS, iov, 2) < 0) {
+        uring.bufferSize = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------------
+ * uringAppend
+ *
+ * Queue n bytes to be written after everything handed to the io_uring so
+ * far. Return -1 if there is no room for them in the waiting buffer.
+ *----------------------------------------------------------------------------*/
+static int uringAppend(const void *buf, int n)
+{
+    uringReap(0);
+    if (!uring.bufferSize && uringBuffers(URING_APPEND) < 0)
+        return -1;
+
+    int slot = uring.pending;
+    if (slot < 0)
+        slot = (uring.inFlight == 0) ? 1 : 0;
+    int used = (slot == uring.pending) ? uring.length[slot] : 0;
+    if (used + n > uring.bufferSize)
+        return -1;
+
+    memcpy(uring.buffers[slot] + used, buf, n);
+    uring.length[slot] = used + n;
+    if (uring.inFlight < 0) {
+        uring.inFlight = slot;
+        uring.sent = 0;
+        uringSubmit();
+    } else {
+        uring.pending = slot;
+    }
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------------
+ * uringClose
+ *
+ * Wait for the frames still being written, then unmap the rings, close the
+ * io_uring and free its buffers.
+ *----------------------------------------------------------------------------*/
+static void uringClose()
+{
+    if (uring.fd < 0)
+        return;
+
+    while (uring.inFlight >= 0)
+        uringReap(1);
+
+    munmap(uring.sqes, uring.sqesSize);
+    if (uring.cqRing != uring.sqRing)
+        munmap(uring.cqRing, uring.cqRingSize);
+    munmap(uring.sqRing, uring.sqRingSize);
+    close(uring.fd);
+    free(uring.buffers[0]);
+    free(uring.buffers[1]);
+
+    memset(&uring, 0, sizeof(uring));
+    uring.fd = -1;
+    uring.inFlight = -1;
+    uring.pending = -1;
+}
+#endif
+
+/*----------------------------------------------------------------------------
+ * useIoUring
+ *
+ * Switch render to io_uring output, or back to plain writes. Return 0 on
+ * success and -1 if io_uring isn't available, in which case nothing changes.
+ *----------------------------------------------------------------------------*/
+int useIoUring(int enable)
+{
+#ifdef LOUIS_IO_URING
+    struct io_uring_params p;
+
+    if (!enable) {
+        uringClose();
+        return 0;
+    }
+    if (uring.fd >= 0)
+        return 0;
+
+    memset(&p, 0, sizeof(p));
+    int fd = syscall(__NR_io_uring_setup, 4, &p);
+    if (fd < 0)
+        return -1;
+
+    uring.sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    uring.cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (uring.cqRingSize > uring.sqRingSize)
+            uring.sqRingSize = uring.cqRingSize;
+        uring.cqRingSize = uring.sqRingSize;
+    }
+
+    uring.sqRing = mmap(NULL, uring.sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        fd, IORING_OFF_SQ_RING);
+    uring.cqRing = (p.features & IORING_FEAT_SINGLE_MMAP) ? uring.sqRing :
+        mmap(NULL, uring.cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    uring.sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+    uring.sqes = (struct io_uring_sqe *)mmap(NULL, uring.sqesSize, PROT_READ | PROT_WRITE,
+                                             MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (uring.sqRing == MAP_FAILED || uring.cqRing == MAP_FAILED || uring.sqes == MAP_FAILED) {
+        if (uring.sqes != MAP_FAILED)
+            munmap(uring.sqes, uring.sqesSize);
+        if (uring.cqRing != MAP_FAILED && uring.cqRing != uring.sqRing)
+            munmap(uring.cqRing, uring.cqRingSize);
+        if (uring.sqRing != MAP_FAILED)
+            munmap(uring.sqRing, uring.sqRingSize);
+        close(fd);
+        return -1;
+    }
+
+    unsigned char *sq = (unsigned char *)uring.sqRing, *cq = (unsigned char *)uring.cqRing;
+    uring.sqHead = (unsigned int *)(sq + p.sq_off.head);
+    uring.sqTail = (unsigned int *)(sq + p.sq_off.tail);
+    uring.sqMask = (unsigned int *)(sq + p.sq_off.ring_mask);
+    uring.sqArray = (unsigned int *)(sq + p.sq_off.array);
+    uring.cqHead = (unsigned int *)(cq + p.cq_off.head);
+    uring.cqTail = (unsigned int *)(cq + p.cq_off.tail);
+    uring.cqMask = (unsigned int *)(cq + p.cq_off.ring_mask);
+    uring.cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    uring.fd = fd;
+
+    return 0;
+#else
+    return enable ? -1 : 0;
+#endif
+}
+
+/*----------------------------------------------------------------------------
+ * flushOutput
+ *
+ * Wait until every frame handed to io_uring has been written. Programs that
+ * write to STDOUT themselves, other than through writeOutput, call this
+ * first.
+ *----------------------------------------------------------------------------*/
+void flushOutput()
+{
+#ifdef LOUIS_IO_URING
+    while (uring.fd >= 0 && uring.inFlight >= 0)
+        uringReap(1);
+#endif
+}
+
+/*----------------------------------------------------------------------------
+ * setOutputSink, louisWrite, writeOutput
+ *
+ * Send the library's output to vt, or to STDOUT again when vt is NULL.
+ * Output to STDOUT goes after the frames io_uring is still writing, queued
+ * behind them where there is room and otherwise once they are done, so that
+ * it can't land in the middle of one. writeOutput sends a program's own
+ * output, such as a status line drawn over the last frame, the same way.
+ *----------------------------------------------------------------------------*/
+void setOutputSink(VTerm *vt)
+{
+    outputSink = vt;
+}
+
+static void louisWrite(const void *buf, int n)
+{
+    if (outputSink) {
+        feedVTerm(outputSink, (const unsigned char *)buf, n);
+        return;
+    }
+#ifdef LOUIS_IO_URING
+    if (uring.fd >= 0 && uringAppend(buf, n) == 0)
+        return;
+#endif
+    flushOutput();
+    write(1, buf, n);
+}
+
+void writeOutput(const void *buf, int n)
+{
+    louisWrite(buf, n);
+}
+
+/*----------------------------------------------------------------------------
+ * render
+ *
+ * Convert the lower-byte-UCS values in the data buffer to their UTF-8 encoded
+ * values, storing them in another buffer, and write that buffer to STDOUT.
+ *----------------------------------------------------------------------------*/
+void render(Surface *s)
+{
+    struct RenderPool *rp = &renderPool;
+    struct iovec iov[RENDER_MAX_THREADS + 2];
+    unsigned char *base = NULL;
+    int slot = -1;
+
+    int len = s->width * s->height;
+
+    if (trace.fp)
+        traceFrame(s);
+
+#ifdef LOUIS_IO_URING
+    /* Encode straight into whichever registered buffer isn't being written */
+    if (uring.fd >= 0 && !outputSink) {
+        uringReap(0);
+        if (uringBuffers((len * 3) + 12 + URING_APPEND) == 0) {
+            slot = (uring.inFlight == 0) ? 1 : 0;
+            base = uring.buffers[slot];
+        }
+    }
+#endif
+
+    if (!base) {
+        if (!screenBuffer)
+            screenBuffer = (unsigned char *)malloc((s->width * s->height * 3) + 12);
+        base = screenBuffer;
+    }
+
+    unsigned char *p = base;
+    memcpy(p, "\x1b[?25l", 6);
+    p += 6;
+    memcpy(p, "\x1b[H", 3);
+    p += 3;
+
+    int bands = rp->count + 1;
+    if (bands > s->height)
+        bands = s->height;
+    if (bands > len / RENDER_MIN_BAND_CELLS)
+        bands = len / RENDER_MIN_BAND_CELLS;
+
+    if (bands <= 1) {
+        encodeCells(p, s->data, len);
+    } else {
+        pthread_mutex_lock(&rp->lock);
+        rp->src = s->data;
+        rp->dst = p;
+        rp->width = s->width;
+        rp->rows = s->height;
+        rp->bands = bands;
+        rp->pending = bands - 1;
+        ++rp->generation;
+        pthread_cond_broadcast(&rp->start);
+        pthread_mutex_unlock(&rp->lock);
+
+        encodeBand(rp, 0);
+
+        pthread_mutex_lock(&rp->lock);
+        while (rp->pending)
+            pthread_cond_wait(&rp->finished, &rp->lock);
+        pthread_mutex_unlock(&rp->lock);
+    }
+    memcpy(p + len * 3, "\x1b[H", 3);
+
+#ifdef LOUIS_IO_URING
+    if (slot >= 0) {
+        uring.length[slot] = (len * 3) + 12;
+        if (uring.inFlight < 0) {
+            uring.inFlight = slot;
+            uring.sent = 0;
+            uringSubmit();
+        } else {
+            uring.pending = slot;
+        }
+        return;
+    }
+#endif
+
+    if (bands <= 1) {
+        louisWrite(base, (len * 3) + 12);
+        return;
+    }
+
+    /* Header, one segment per band, trailer */
+    iov[0].iov_base = base;
+    iov[0].iov_len = 9;
+    for (int i = 0; i < bands; ++i) {
+        int row0 = i * s->height / bands, row1 = (i + 1) * s->height / bands;
+        iov[i + 1].iov_base = p + row0 * s->width * 3;
+        iov[i + 1].iov_len = (row1 - row0) * s->width * 3;
+    }
+    iov[bands + 1].iov_base = p + len * 3;
+    iov[bands + 1].iov_len = 3;
+
+    if (outputSink) {
+        for (int i = 0; i < bands + 2; ++i)
+            louisWrite(iov[i].iov_base, iov[i].iov_len);
+        return;
+    }
+    flushOutput();
+    writev(1, iov, bands + 2);
+}
+
+/*----------------------------------------------------------------------------
+ * clearSurface
+ *
+ * Set the whole block of Surface data to 0.
+ *----------------------------------------------------------------------------*/
+void clearSurface(Surface *s)
+{
+    if (trace.fp)
+        traceCall(s, TRACE_CLEAR, NULL, 0);
+
+    for (int y = 0; y < s->height; ++y) {
+        for (int x = 0; x < s->width; ++x) {
+            *(s->data + (y * s->width) + x) = 0;
+        }
+    }
+}
+
+/*----------------------------------------------------------------------------
+ * scrollSurface
+ *
+ * Move everything on the Surface dx dots to the right and dy dots up; negative
+ * values move left and down. The distances need not be multiples of the cell
+ * size, so dots are carried across cell boundaries. Space uncovered by the
+ * move is left empty.
+ *----------------------------------------------------------------------------*/
+static unsigned int gridAt(Surface *s, unsigned char *src, int cx, int cy)
+{
+    if (cx < 0 || cy < 0 || cx >= s->width || cy >= s->height)
+        return 0;
+    return cellToGrid[src[(s->height - 1 - cy) * s->width + cx]];
+}
+
+static unsigned int gridRaised(Surface *s, unsigned char *src, int cx, int cy, int q, int r)
+{
+    /* The cell q cells below moves up r dot rows, and the top rows of the
+     * one below that move up into its vacated bottom rows. */
+    unsigned int g = gridAt(s, src, cx, cy - q) << (r * 2);
+    if (r)
+        g |= gridAt(s, src, cx, cy - q - 1) >> (8 - r * 2);
+    return g & 0xFF;
+}
+
+void scrollSurface(Surface *s, int dx, int dy)
+{
+    if (trace.fp) {
+        float args[2] = {dx, dy};
+        traceCall(s, TRACE_SCROLL, args, 2);
+    }
+
+    int len = s->width * s->height;
+    unsigned char *src = (unsigned char *)malloc(len);
+    memcpy(src, s->data, len);
+
+    /* Split each distance into whole cells and a remainder of dots, with
+     * the remainder always non-negative. */
+    int p = dx >> 1, m = dx & 1;
+    int q = dy >> 2, r = dy & 3;
+
+    unsigned char *d = s->data;
+    for (int cy = s->height - 1; cy >= 0; --cy) {
+        for (int cx = 0; cx < s->width; ++cx) {
+            unsigned int g = gridRaised(s, src, cx - p, cy, q, r);
+            if (m) {
+                /* Left column moves to the right column, and the right
+                 * column of the neighbor on the left moves in beside it. */
+                g = ((g & 0x55) << 1) | ((gridRaised(s, src, cx - p - 1, cy, q, r) & 0xAA) >> 1);
+            }
+            *d++ = gridToCell[g];
+        }
+    }
+
+    free(src);
+}
+
+/*----------------------------------------------------------------------------
+ * initSurface
+ *
+ * Initialize a Surface struct with the width and height of the terminal window
+ * and a zeroed block of memory.
+ *----------------------------------------------------------------------------*/
+void initSurface(Surface *s)
+{
+    struct winsize ws;
+
+    /* Standard input may be a pipe carrying data rather than the terminal */
+    if (ioctl(0, TIOCGWINSZ, &ws) < 0)
+        ioctl(1, TIOCGWINSZ, &ws);
+
+    s->width = ws.ws_col;
+    s->height = ws.ws_row;
+
+    s->data = (unsigned char *)malloc(s->width * s->height);
+
+    clearSurface(s);
+}
+
+/*----------------------------------------------------------------------------
+ * Primitives
+ *
+ * A Primitive describes one call to a drawing routine, so that drawing can be
+ * recorded, compared, and replayed. The meaning of the parameters follows the
+ * argument order of the routine named by the type.
+ *----------------------------------------------------------------------------*/
+enum {
+    PRIM_LINE,      /* x1, y1, x2, y2 */
+    PRIM_CURVE,     /* x1, x2, a, b, c */
+    PRIM_RECT,      /* x, y, w, h, fill */
+    PRIM_BITMAP,    /* x, y, with the bitmap pointer */
+    PRIM_CLEAR      /* no parameters */
+};
+
+typedef struct Primitive {
+    int type;
+    float p[5];
+    Surface *bitmap;
+} Primitive;
+
+/*----------------------------------------------------------------------------
+ * drawPrimitive
+ *
+ * Hand a Primitive to the routine that draws it.
+ *----------------------------------------------------------------------------*/
+void drawPrimitive(Surface *s, Primitive *p)
+{
+    float detail = lod.detail;
+
+    pushTransform();
+    resetTransform();
+    lod.detail = 1.0f;
+
+    switch (p->type) {
+    case PRIM_LINE:
+        drawLine(s, p->p[0], p->p[1], p->p[2], p->p[3]);
+        break;
+    case PRIM_CURVE:
+        drawCurve(s, p->p[0], p->p[1], p->p[2], p->p[3], p->p[4]);
+        break;
+    case PRIM_RECT:
+        drawRect(s, p->p[0], p->p[1], p->p[2], p->p[3], p->p[4]);
+        break;
+    case PRIM_BITMAP:
+        drawBitmap(s, p->bitmap, p->p[0], p->p[1]);
+        break;
+    case PRIM_CLEAR:
+        clearSurface(s);
+        break;
+    }
+
+    lod.detail = detail;
+    popTransform();
+}
+
+/*----------------------------------------------------------------------------
+ * tracePrimitive
+ *
+ * Record a Primitive drawn some other way as the call drawPrimitive makes.
+ *----------------------------------------------------------------------------*/
+static void tracePrimitive(Surface *s, Primitive *p)
+{
+    float args[3];
+
+    switch (p->type) {
+    case PRIM_LINE:
+        traceCall(s, TRACE_LINE, p->p, 4);
+        break;
+    case PRIM_CURVE:
+        traceCall(s, TRACE_CURVE, p->p, 5);
+        break;
+    case PRIM_RECT:
+        traceCall(s, TRACE_RECT, p->p, 5);
+        break;
+    case PRIM_BITMAP:
+        if (traceDepth)
+            break;
+        args[0] = traceSurface(p->bitmap, 1);
+        args[1] = p->p[0];
+        args[2] = p->p[1];
+        traceCall(s, TRACE_DRAW_BITMAP, args, 3);
+        break;
+    case PRIM_CLEAR:
+        traceCall(s, TRACE_CLEAR, NULL, 0);
+        break;
+    }
+}
+
+/*----------------------------------------------------------------------------
+ * primitiveBounds
+ *
+ * Find the block of cells a Primitive can touch, as columns x0 to x1 and
+ * rows y0 to y1 of the Surface data, counting rows from the top as the data
+ * is stored. Return 0 if it falls entirely off the Surface.
+ *----------------------------------------------------------------------------*/
+int primitiveBounds(Surface *s, Primitive *p, int *x0, int *y0, int *x1, int *y1)
+{
+    float minX, minY, maxX, maxY;
+
+    switch (p->type) {
+    case PRIM_LINE:
+        /* drawLine can round a dot past either end point */
+        minX = (p->p[0] < p->p[2] ? p->p[0] : p->p[2]) - 1;
+        maxX = (p->p[0] < p->p[2] ? p->p[2] : p->p[0]) + 1;
+        minY = (p->p[1] < p->p[3] ? p->p[1] : p->p[3]) - 1;
+        maxY = (p->p[1] < p->p[3] ? p->p[3] : p->p[1]) + 1;
+        break;
+    case PRIM_CURVE: {
+        /* Follow the same steps drawCurve takes */
+        float x = p->p[0];
+        int y;
+        minX = maxX = x;
+        minY = 1e30f;
+        maxY = -1e30f;
+        while (x < p->p[1]) {
+            x += 0.2f;
+            y = (p->p[2] * (x * x)) + (p->p[3] * x) + p->p[4];
+            y /= 10;
+            if (y < minY)
+                minY = y;
+            if (y > maxY)
+                maxY = y;
+        }
+        maxX = x + 1;
+        if (minY > maxY)
+            return 0;
+        break;
+    }
+    case PRIM_RECT:
+        /* An outline with no width or height still draws its sides */
+        minX = maxX = (int)p->p[0];
+        minY = maxY = (int)p->p[1];
+        if (p->p[2] >= 1)
+            maxX += (int)p->p[2] - 1;
+        else
+            minX += (int)p->p[2] - 1;
+        if (p->p[3] >= 1)
+            maxY += (int)p->p[3] - 1;
+        else
+            minY += (int)p->p[3] - 1;
+        break;
+    case PRIM_BITMAP:
+        minX = (int)p->p[0];
+        minY = (int)p->p[1];
+        maxX = minX + p->bitmap->width - 1;
+        maxY = minY + p->bitmap->height - 1;
+        break;
+    default:
+        minX = minY = 0;
+        maxX = s->width * 2 - 1;
+        maxY = s->height * 4 - 1;
+        break;
+    }
+
+    int dx0 = fRound(minX), dy0 = fRound(minY), dx1 = fRound(maxX), dy1 = fRound(maxY);
+    if (dx0 < 0)
+        dx0 = 0;
+    if (dy0 < 0)
+        dy0 = 0;
+    if (dx1 >= s->width * 2)
+        dx1 = s->width * 2 - 1;
+    if (dy1 >= s->height * 4)
+        dy1 = s->height * 4 - 1;
+    if (dx0 > dx1 || dy0 > dy1)
+        return 0;
+
+    /* Dots count up from the bottom, rows down from the top */
+    *x0 = dx0 / 2;
+    *x1 = dx1 / 2;
+    *y0 = s->height - 1 - dy1 / 4;
+    *y1 = s->height - 1 - dy0 / 4;
+
+    return 1;
+}
+
+/*----------------------------------------------------------------------------
+ * Rasterization cache
+ *
+ * Frames often redraw the same curves, rectangles, and bitmaps with the same
+ * parameters. A RasterCache remembers what such a Primitive did to the cells
+ * it touched, and the next time the same Primitive is drawn onto a Surface of
+ * the same size, the cells are patched from memory instead of plotting each
+ * dot again. Entries are kept in least-recently-used order, and the oldest
+ * are dropped whenever the cache grows past its memory budget.
+ *
+ * For each cell in its footprint an entry holds the dots the Primitive sets,
+ * and, for bitmaps, which can also clear dots, a mask of the dots it leaves
+ * alone. Bitmaps are known by their address, not their contents, so a
+ * bitmap that is changed in place, or freed and another allocated where it
+ * was, has to be dropped from the cache with forgetBitmap first.
+ *----------------------------------------------------------------------------*/
+#define RASTER_CACHE_BUCKETS 1024
+
+typedef struct CacheEntry {
+    Primitive key;
+    int surfaceWidth;
+    int surfaceHeight;
+    int x;
+    int y;
+    int w;
+    int h;
+    unsigned char *set;
+    unsigned char *keep;
+    size_t bytes;
+    unsigned int hash;
+    struct CacheEntry *chain;
+    struct CacheEntry *newer;
+    struct CacheEntry *older;
+} CacheEntry;
+
+typedef struct RasterCache {
+    CacheEntry *buckets[RASTER_CACHE_BUCKETS];
+    CacheEntry *newest;
+    CacheEntry *oldest;
+    size_t budget;
+    size_t used;
+    Surface scratch;
+    long hits;
+    long misses;
+} RasterCache;
+
+/*----------------------------------------------------------------------------
+ * initRasterCache, freeRasterCache
+ *
+ * Set up an empty cache that may use up to budget bytes, and release it.
+ *----------------------------------------------------------------------------*/
+void initRasterCache(RasterCache *rc, size_t budget)
+{
+    memset(rc, 0, sizeof(RasterCache));
+    rc->budget = budget;
+}
+
+static void cacheRemove(RasterCache *rc, CacheEntry *e)
+{
+    CacheEntry **pp = &rc->buckets[e->hash & (RASTER_CACHE_BUCKETS - 1)];
+    while (*pp != e)
+        pp = &(*pp)->chain;
+    *pp = e->chain;
+
+    if (e->newer)
+        e->newer->older = e->older;
+    else
+        rc->newest = e->older;
+    if (e->older)
+        e->older->newer = e->newer;
+    else
+        rc->oldest = e->newer;
+
+    rc->used -= e->bytes;
+    free(e->set);
+    free(e->keep);
+    free(e);
+}
+
+static unsigned int cacheHash(Primitive *p, Surface *s)
+{
+    unsigned int h = 2166136261u;
+    unsigned int words[8];
+
+    words[0] = p->type;
+    memcpy(words + 1, p->p, sizeof(p->p));
+    words[6] = (unsigned int)(size_t)p->bitmap;
+    words[7] = s->width << 16 ^ s->height;
+    for (int i = 0; i < 8; ++i)
+        h = (h ^ words[i]) * 16777619u;
+
+    return h;
+}
+
+void freeRasterCache(RasterCache *rc)
+{
+    while (rc->oldest)
+        cacheRemove(rc, rc->oldest);
+    free(rc->scratch.data);
+    rc->scratch.data = NULL;
+}
+
+/*----------------------------------------------------------------------------
+ * cacheFill
+ *
+ * Set the cells of the scratch Surface in a block to one value.
+ *----------------------------------------------------------------------------*/
+static void cacheFill(Surface *s, int x0, int y0, int x1, int y1, int value)
+{
+    for (int y = y0; y <= y1; ++y)
+        memset(s->data + y * s->width + x0, value, x1 - x0 + 1);
+}
+
+/*----------------------------------------------------------------------------
+ * cachedDraw
+ *
+ * Draw a Primitive through the cache: patch it in if it is there, or else
+ * draw it on the scratch Surface, record the footprint, and patch that in.
+ *----------------------------------------------------------------------------*/
+void cachedDraw(RasterCache *rc, Surface *s, Primitive *p)
+{
+    unsigned int hash = cacheHash(p, s);
+    unsigned int bucket = hash & (RASTER_CACHE_BUCKETS - 1);
+    CacheEntry *e;
+    int x0, y0, x1, y1;
+
+    if (p->type == PRIM_CLEAR) {
+        clearSurface(s);
+        return;
+    }
+
+    if (trace.fp)
+        tracePrimitive(s, p);
+    ++traceDepth;
+
+    for (e = rc->buckets[bucket]; e; e = e->chain) {
+        if (e->key.type == p->type && !memcmp(e->key.p, p->p, sizeof(p->p)) &&
+            e->key.bitmap == p->bitmap && e->surfaceWidth == s->width && e->surfaceHeight == s->height)
+            break;
+    }
+
+    if (e) {
+        ++rc->hits;
+
+        /* Move to the front of the LRU list */
+        if (e->newer) {
+            e->newer->older = e->older;
+            if (e->older)
+                e->older->newer = e->newer;
+            else
+                rc->oldest = e->newer;
+            e->older = rc->newest;
+            e->newer = NULL;
+            rc->newest->newer = e;
+            rc->newest = e;
+        }
+    } else {
+        ++rc->misses;
+
+        if (!primitiveBounds(s, p, &x0, &y0, &x1, &y1)) {
+            --traceDepth;
+            return;
+        }
+
+        Surface *sc = &rc->scratch;
+        if (sc->width != s->width || sc->height != s->height) {
+            free(sc->data);
+            sc->width = s->width;
+            sc->height = s->height;
+            sc->data = (unsigned char *)calloc(s->width * s->height, 1);
+        }
+
+        e = (CacheEntry *)calloc(1, sizeof(CacheEntry));
+        e->key = *p;
+        e->surfaceWidth = s->width;
+        e->surfaceHeight = s->height;
+        e->x = x0;
+        e->y = y0;
+        e->w = x1 - x0 + 1;
+        e->h = y1 - y0 + 1;
+        e->set = (unsigned char *)malloc(e->w * e->h);
+
+        /* The dots it sets show up on an empty Surface... */
+        drawPrimitive(sc, p);
+        for (int y = 0; y < e->h; ++y)
+            memcpy(e->set + y * e->w, sc->data + (y0 + y) * sc->width + x0, e->w);
+        cacheFill(sc, x0, y0, x1, y1, 0);
+
+        /* ...and the dots it clears show up on a full one */
+        if (p->type == PRIM_BITMAP) {
+            e->keep = (unsigned char *)malloc(e->w * e->h);
+            cacheFill(sc, x0, y0, x1, y1, 0xFF);
+            drawPrimitive(sc, p);
+            for (int y = 0; y < e->h; ++y)
+                memcpy(e->keep + y * e->w, sc->data + (y0 + y) * sc->width + x0, e->w);
+            cacheFill(sc, x0, y0, x1, y1, 0);
+        }
+
+        e->bytes = sizeof(CacheEntry) + e->w * e->h * (e->keep ? 2 : 1);
+        e->hash = hash;
+        e->chain = rc->buckets[bucket];
+        rc->buckets[bucket] = e;
+        e->older = rc->newest;
+        if (rc->newest)
+            rc->newest->newer = e;
+        else
+            rc->oldest = e;
+        rc->newest = e;
+        rc->used += e->bytes;
+    }
+
+    for (int y = 0; y < e->h; ++y)
+        kernels.blit(s->data + (e->y + y) * s->width + e->x, e->set + y * e->w,
+                     e->keep ? e->keep + y * e->w : NULL, e->w);
+
+    /* Evict, but never the entry just drawn */
+    while (rc->used > rc->budget && rc->oldest != e)
+        cacheRemove(rc, rc->oldest);
+
+    --traceDepth;
+}
+
+/*----------------------------------------------------------------------------
+ * cachedLine, cachedCurve, cachedRect, cachedBitmap, forgetBitmap
+ *
+ * Cached counterparts of drawLine, drawCurve, drawRect, and drawBitmap.
+ * cachedBitmap goes by the bitmap's address, and draws what the bitmap held
+ * when it was cached until forgetBitmap drops every entry made from it.
+ *----------------------------------------------------------------------------*/
+void cachedLine(RasterCache *rc, Surface *s, float x1, float y1, float x2, float y2)
+{
+    Primitive p = {PRIM_LINE, {x1, y1, x2, y2, 0}, NULL};
+    cachedDraw(rc, s, &p);
+}
+
+void cachedCurve(RasterCache *rc, Surface *s, float x1, float x2, float a, float b, float c)
+{
+    Primitive p = {PRIM_CURVE, {x1, x2, a, b, c}, NULL};
+    cachedDraw(rc, s, &p);
+}
+
+void cachedRect(RasterCache *rc, Surface *s, int x, int y, int w, int h, int fill)
+{
+    Primitive p = {PRIM_RECT, {x, y, w, h, fill}, NULL};
+    cachedDraw(rc, s, &p);
+}
+
+void cachedBitmap(RasterCache *rc, Surface *s, Surface *bitmap, int x, int y)
+{
+    Primitive p = {PRIM_BITMAP, {x, y, 0, 0, 0}, bitmap};
+    cachedDraw(rc, s, &p);
+}
+
+void forgetBitmap(RasterCache *rc, Surface *bitmap)
+{
+    for (CacheEntry *e = rc->oldest, *next; e; e = next) {
+        next = e->newer;
+        if (e->key.type == PRIM_BITMAP && e->key.bitmap == bitmap)
+            cacheRemove(rc, e);
+    }
+}
+
+/*----------------------------------------------------------------------------
+ * Display lists
+ *
+ * Instead of drawing straight onto a Surface, a frame can be recorded into a
+ * DisplayList and drawn all at once with drawDisplayList. Knowing the whole
+ * frame in advance lets louis skip work that would be thrown away: before
+ * drawing, the list is divided into tiles of TILE_WIDTH by TILE_HEIGHT cells,
+ * and a primitive is dropped when every tile it touches is later covered
+ * completely by a clear or a filled rectangle.
+ *
+ * Each primitive carries the tag in effect when it was added, typically the
+ * id of the widget that drew it, so overdrawReport can tell which widgets
+ * spend their time drawing dots that end up hidden.
+ *----------------------------------------------------------------------------*/
+#define TILE_WIDTH 8
+#define TILE_HEIGHT 4
+
+typedef struct DisplayList {
+    Primitive *prims;
+    int *tags;
+    int *tiles;
+    int *hiddenTiles;
+    int count;
+    int cap;
+    int tag;
+    unsigned char *covered;
+    int coveredSize;
+} DisplayList;
+
+/*----------------------------------------------------------------------------
+ * initDisplayList, freeDisplayList, resetDisplayList
+ *
+ * Set up an empty list, release one, and empty one to record the next frame.
+ *----------------------------------------------------------------------------*/
+void initDisplayList(DisplayList *dl)
+{
+    memset(dl, 0, sizeof(DisplayList));
+}
+
+void freeDisplayList(DisplayList *dl)
+{
+    free(dl->prims);
+    free(dl->tags);
+    free(dl->tiles);
+    free(dl->hiddenTiles);
+    free(dl->covered);
+    initDisplayList(dl);
+}
+
+void resetDisplayList(DisplayList *dl)
+{
+    dl->count = 0;
+    dl->tag = 0;
+}
+
+/*----------------------------------------------------------------------------
+ * setTag, addPrimitive, addLine, addCurve, addRect, addBitmap, addClear
+ *
+ * Record drawing calls. The arguments are the same as those of the drawing
+ * routines, minus the Surface.
+ *----------------------------------------------------------------------------*/
+void setTag(DisplayList *dl, int tag)
+{
+    dl->tag = tag;
+}
+
+void addPrimitive(DisplayList *dl, Primitive *p)
+{
+    if (dl->count == dl->cap) {
+        dl->cap = dl->cap ? dl->cap * 2 : 64;
+        dl->prims = (Primitive *)realloc(dl->prims, dl->cap * sizeof(Primitive));
+        dl->tags = (int *)realloc(dl->tags, dl->cap * sizeof(int));
+        dl->tiles = (int *)realloc(dl->tiles, dl->cap * sizeof(int));
+        dl->hiddenTiles = (int *)realloc(dl->hiddenTiles, dl->cap * sizeof(int));
+    }
+
+    dl->prims[dl->count] = *p;
+    dl->tags[dl->count] = dl->tag;
+    dl->tiles[dl->count] = 0;
+    dl->hiddenTiles[dl->count] = 0;
+    ++dl->count;
+}
+
+void addLine(DisplayList *dl, float x1, float y1, float x2, float y2)
+{
+    Primitive p = {PRIM_LINE, {x1, y1, x2, y2, 0}, NULL};
+    addPrimitive(dl, &p);
+}
+
+void addCurve(DisplayList *dl, float x1, float x2, float a, float b, float c)
+{
+    Primitive p = {PRIM_CURVE, {x1, x2, a, b, c}, NULL};
+    addPrimitive(dl, &p);
+}
+
+void addRect(DisplayList *dl, int x, int y, int w, int h, int fill)
+{
+    Primitive p = {PRIM_RECT, {x, y, w, h, fill}, NULL};
+    addPrimitive(dl, &p);
+}
+
+void addBitmap(DisplayList *dl, Surface *bitmap, int x, int y)
+{
+    Primitive p = {PRIM_BITMAP, {x, y, 0, 0, 0}, bitmap};
+    addPrimitive(dl, &p);
+}
+
+void addClear(DisplayList *dl)
+{
+    Primitive p = {PRIM_CLEAR, {0, 0, 0, 0, 0}, NULL};
+    addPrimitive(dl, &p);
+}
+
+/*----------------------------------------------------------------------------
+ * coversTile
+ *
+ * Decide whether a clear or a filled rectangle sets every dot of the tile
+ * with its top left cell at column tx, row ty.
+ *----------------------------------------------------------------------------*/
+static int coversTile(Surface *s, Primitive *p, int tx, int ty)
+{
+    if (p->type == PRIM_CLEAR)
+        return 1;
+    if (p->type != PRIM_RECT || !p->p[4])
+        return 0;
+
+    /* The tile's extent in dots, clipped to the Surface */
+    int tx1 = tx + TILE_WIDTH - 1, ty1 = ty + TILE_HEIGHT - 1;
+    if (tx1 >= s->width)
+        tx1 = s->width - 1;
+    if (ty1 >= s->height)
+        ty1 = s->height - 1;
+    int dx0 = tx * 2, dx1 = tx1 * 2 + 1;
+    int dy0 = (s->height - 1 - ty1) * 4, dy1 = (s->height - 1 - ty) * 4 + 3;
+
+    int x = p->p[0], y = p->p[1], w = p->p[2], h = p->p[3];
+    return x <= dx0 && x + w - 1 >= dx1 && y <= dy0 && y + h - 1 >= dy1;
+}
+
+/*----------------------------------------------------------------------------
+ * cullDisplayList
+ *
+ * Walk the list from the last primitive to the first, keeping track of which
+ * tiles are already covered by what comes later. Count for every primitive
+ * the tiles it touches and how many of those are hidden. Return the number of
+ * primitives that are hidden entirely and will not be drawn.
+ *----------------------------------------------------------------------------*/
+int cullDisplayList(DisplayList *dl, Surface *s)
+{
+    int cols = (s->width + TILE_WIDTH - 1) / TILE_WIDTH;
+    int rows = (s->height + TILE_HEIGHT - 1) / TILE_HEIGHT;
+    int culled = 0;
+    int x0, y0, x1, y1;
+
+    if (dl->coveredSize < cols * rows) {
+        dl->coveredSize = cols * rows;
+        dl->covered = (unsigned char *)realloc(dl->covered, dl->coveredSize);
+    }
+    memset(dl->covered, 0, cols * rows);
+
+    for (int i = dl->count - 1; i >= 0; --i) {
+        Primitive *p = &dl->prims[i];
+
+        dl->tiles[i] = dl->hiddenTiles[i] = 0;
+        if (!primitiveBounds(s, p, &x0, &y0, &x1, &y1))
+            continue;
+
+        int opaque = p->type == PRIM_CLEAR || (p->type == PRIM_RECT && p->p[4]);
+        for (int ty = y0 / TILE_HEIGHT; ty <= y1 / TILE_HEIGHT; ++ty) {
+            for (int tx = x0 / TILE_WIDTH; tx <= x1 / TILE_WIDTH; ++tx) {
+                unsigned char *c = &dl->covered[ty * cols + tx];
+                ++dl->tiles[i];
+                if (*c)
+                    ++dl->hiddenTiles[i];
+                else if (opaque && coversTile(s, p, tx * TILE_WIDTH, ty * TILE_HEIGHT))
+                    *c = 1;
+            }
+        }
+
+        if (dl->hiddenTiles[i] == dl->tiles[i])
+            ++culled;
+    }
+
+    return culled;
+}
+
+/*----------------------------------------------------------------------------
+ * drawDisplayList
+ *
+ * Cull the list and draw what is left onto the Surface, through the
+ * rasterization cache if one is given.
+ *----------------------------------------------------------------------------*/
+void drawDisplayList(DisplayList *dl, Surface *s, RasterCache *rc)
+{
+    cullDisplayList(dl, s);
+
+    for (int i = 0; i < dl->count; ++i) {
+        if (dl->tiles[i] == 0 || dl->hiddenTiles[i] == dl->tiles[i])
+            continue;
+        if (rc)
+            cachedDraw(rc, s, &dl->prims[i]);
+        else
+            drawPrimitive(s, &dl->prims[i]);
+    }
+}
+
+/*----------------------------------------------------------------------------
+ * overdrawReport
+ *
+ * Print, for every tag in the list as last culled, how many primitives it
+ * recorded and how many of them were culled, and how many of the tiles drawn
+ * by the rest were drawn over by something later anyway.
+ *----------------------------------------------------------------------------*/
+void overdrawReport(DisplayList *dl, FILE *fp)
+{
+    unsigned char *done = (unsigned char *)calloc(dl->count ? dl->count : 1, 1);
+
+    for (int i = 0; i < dl->count; ++i) {
+        int prims = 0, culled = 0, tiles = 0, hidden = 0;
+
+        if (done[i])
+            continue;
+        for (int j = i; j < dl->count; ++j) {
+            if (dl->tags[j] != dl->tags[i])
+                continue;
+            done[j] = 1;
+            ++prims;
+            if (dl->tiles[j] && dl->hiddenTiles[j] == dl->tiles[j]) {
+                ++culled;
+            } else {
+                hidden += dl->hiddenTiles[j];
+                tiles += dl->tiles[j];
+            }
+        }
+
+        fprintf(fp, "tag %d: %d primitives, %d culled, %d of %d drawn tiles overdrawn (%.1f%%)\n",
+                dl->tags[i], prims, culled, hidden, tiles, tiles ? 100.0 * hidden / tiles : 0.0);
+    }
+
+    free(done);
+}
+
+/*----------------------------------------------------------------------------
+ * Damage regions
+ *
+ * When little changes from one frame to the next, only the changed part of
+ * the screen needs to be drawn again and sent to the terminal. A DamageRegion
+ * collects the blocks of cells that changed and merges them before they are
+ * redrawn with redrawDamage and sent with renderDamage.
+ *
+ * Merging follows a cost model in bytes of terminal output. Sending a block
+ * costs one cursor movement per row, or one for the whole block when it spans
+ * the full width and the rows run on from one another, plus three bytes per
+ * cell. Two blocks are replaced by the block enclosing both whenever that is
+ * no more expensive than sending them separately. The cost of a cursor
+ * movement starts out as an estimate and is then kept up to date from what
+ * renderDamage actually writes.
+ *----------------------------------------------------------------------------*/
+typedef struct DamageRect {
+    int x0;
+    int y0;
+    int x1;
+    int y1;
+} DamageRect;
+
+typedef struct DamageRegion {
+    DamageRect *rects;
+    int count;
+    int cap;
+    float moveCost;
+    long bytes;
+    int moves;
+    Surface scratch;
+    unsigned char *buffer;
+    int bufferSize;
+} DamageRegion;
+
+/*----------------------------------------------------------------------------
+ * initDamageRegion, freeDamageRegion, clearDamage
+ *
+ * Set up an empty DamageRegion, release it, and forget its rectangles for
+ * the next frame while keeping its buffers.
+ *----------------------------------------------------------------------------*/
+void initDamageRegion(DamageRegion *dr)
+{
+    memset(dr, 0, sizeof(DamageRegion));
+    dr->moveCost = 8.0f;
+}
+
+void freeDamageRegion(DamageRegion *dr)
+{
+    free(dr->rects);
+    free(dr->scratch.data);
+    free(dr->buffer);
+    initDamageRegion(dr);
+}
+
+void clearDamage(DamageRegion *dr)
+{
+    dr->count = 0;
+}
+
+/*----------------------------------------------------------------------------
+ * addDamage, addPrimitiveDamage
+ *
+ * Mark a block of cells as changed, given as columns x0 to x1 and rows y0 to
+ * y1 of the Surface data, or as whatever a Primitive may have touched.
+ *----------------------------------------------------------------------------*/
+void addDamage(DamageRegion *dr, int x0, int y0, int x1, int y1)
+{
+    if (dr->count == dr->cap) {
+        dr->cap = dr->cap ? dr->cap * 2 : 32;
+        dr->rects = (DamageRect *)realloc(dr->rects, dr->cap * sizeof(DamageRect));
+    }
+
+    DamageRect r = {x0, y0, x1, y1};
+    dr->rects[dr->count++] = r;
+}
+
+void addPrimitiveDamage(DamageRegion *dr, Surface *s, Primitive *p)
+{
+    int x0, y0, x1, y1;
+
+    if (primitiveBounds(s, p, &x0, &y0, &x1, &y1))
+        addDamage(dr, x0, y0, x1, y1);
+}
+
+/*----------------------------------------------------------------------------
+ * diffDisplayLists
+ *
+ * Compare the display lists of two frames primitive by primitive, and add the
+ * area of every primitive that differs, was added, or was removed. Bitmaps
+ * are compared by pointer, so a bitmap whose pixels change in place has to be
+ * marked with addPrimitiveDamage by the caller.
+ *----------------------------------------------------------------------------*/
+void diffDisplayLists(DisplayList *prev, DisplayList *cur, Surface *s, DamageRegion *dr)
+{
+    int n = prev->count > cur->count ? prev->count : cur->count;
+
+    for (int i = 0; i < n; ++i) {
+        Primitive *a = i < prev->count ? &prev->prims[i] : NULL;
+        Primitive *b = i < cur->count ? &cur->prims[i] : NULL;
+
+        if (a && b && a->type == b->type && a->bitmap == b->bitmap && !memcmp(a->p, b->p, sizeof(a->p)))
+            continue;
+        if (a)
+            addPrimitiveDamage(dr, s, a);
+        if (b)
+            addPrimitiveDamage(dr, s, b);
+    }
+}
+
+/*----------------------------------------------------------------------------
+ * damageCost, mergeDamage
+ *
+ * Estimate the bytes it takes to send a block, and merge blocks for as long
+ * as doing so makes the total cheaper.
+ *----------------------------------------------------------------------------*/
+static float damageCost(DamageRegion *dr, Surface *s, DamageRect *r)
+{
+    int w = r->x1 - r->x0 + 1, h = r->y1 - r->y0 + 1;
+    int moves = (w == s->width) ? 1 : h;
+
+    return moves * dr->moveCost + w * h * 3.0f;
+}
+
+void mergeDamage(DamageRegion *dr, Surface *s)
+{
+    /* Clip to the Surface and drop what falls off it */
+    int n = 0;
+    for (int i = 0; i < dr->count; ++i) {
+        DamageRect r = dr->rects[i];
+        r.x0 = r.x0 < 0 ? 0 : r.x0;
+        r.y0 = r.y0 < 0 ? 0 : r.y0;
+        r.x1 = r.x1 >= s->width ? s->width - 1 : r.x1;
+        r.y1 = r.y1 >= s->height ? s->height - 1 : r.y1;
+        if (r.x0 <= r.x1 && r.y0 <= r.y1)
+            dr->rects[n++] = r;
+    }
+    dr->count = n;
+
+    /* Greedily take the most profitable merge until none is left */
+    while (dr->count > 1) {
+        float best = -1.0f;
+        int bi = 0, bj = 0;
+        DamageRect bm = {0, 0, 0, 0};
+
+        for (int i = 0; i < dr->count; ++i) {
+            DamageRect *a = &dr->rects[i];
+            float ca = damageCost(dr, s, a);
+            for (int j = i + 1; j < dr->count; ++j) {
+                DamageRect *b = &dr->rects[j];
+                DamageRect m = {
+                    a->x0 < b->x0 ? a->x0 : b->x0, a->y0 < b->y0 ? a->y0 : b->y0,
+                    a->x1 > b->x1 ? a->x1 : b->x1, a->y1 > b->y1 ? a->y1 : b->y1
+                };
+                float gain = ca + damageCost(dr, s, b) - damageCost(dr, s, &m);
+                if (gain > best) {
+                    best = gain;
+                    bi = i;
+                    bj = j;
+                    bm = m;
+                }
+            }
+        }
+
+        if (best < 0.0f)
+            break;
+        dr->rects[bi] = bm;
+        dr->rects[bj] = dr->rects[--dr->count];
+    }
+}
+
+/*----------------------------------------------------------------------------
+ * redrawDamage
+ *
+ * Draw the damaged blocks of a frame again from its display list. Only the
+ * primitives that reach into a damaged block are drawn, onto a scratch
+ * Surface, and only the damaged blocks are copied from there to the Surface,
+ * so that the rest of it is left exactly as it was.
+ *----------------------------------------------------------------------------*/
+void redrawDamage(DisplayList *dl, Surface *s, DamageRegion *dr)
+{
+    Surface *sc = &dr->scratch;
+    int x0, y0, x1, y1;
+
+    if (sc->width != s->width || sc->height != s->height) {
+        free(sc->data);
+        sc->width = s->width;
+        sc->height = s->height;
+        sc->data = (unsigned char *)malloc(s->width * s->height);
+    }
+
+    for (int i = 0; i < dr->count; ++i) {
+        DamageRect *r = &dr->rects[i];
+        for (int y = r->y0; y <= r->y1; ++y)
+            memset(sc->data + y * sc->width + r->x0, 0, r->x1 - r->x0 + 1);
+    }
+
+    ++traceDepth;
+    cullDisplayList(dl, s);
+    for (int p = 0; p < dl->count; ++p) {
+        if (dl->hiddenTiles[p] == dl->tiles[p] || !primitiveBounds(s, &dl->prims[p], &x0, &y0, &x1, &y1))
+            continue;
+        for (int i = 0; i < dr->count; ++i) {
+            DamageRect *r = &dr->rects[i];
+            if (x0 <= r->x1 && x1 >= r->x0 && y0 <= r->y1 && y1 >= r->y0) {
+                drawPrimitive(sc, &dl->prims[p]);
+                break;
+            }
+        }
+    }
+
+    --traceDepth;
+
+    for (int i = 0; i < dr->count; ++i) {
+        DamageRect *r = &dr->rects[i];
+        for (int y = r->y0; y <= r->y1; ++y)
+            memcpy(s->data + y * s->width + r->x0, sc->data + y * sc->width + r->x0, r->x1 - r->x0 + 1);
+        if (trace.fp)
+            traceCells(s, r->x0, r->y0, r->x1, r->y1);
+    }
+}
+
+/*----------------------------------------------------------------------------
+ * renderDamage
+ *
+ * Like render, but send only the damaged blocks, moving the cursor to the
+ * start of each row of each block. Afterwards dr->bytes and dr->moves hold
+ * what was written, and the cost of a cursor movement is updated from them.
+ *----------------------------------------------------------------------------*/
+void renderDamage(Surface *s, DamageRegion *dr)
+{
+    int need = 12;
+
+    if (trace.fp)
+        traceFrame(s);
+
+    for (int i = 0; i < dr->count; ++i) {
+        DamageRect *r = &dr->rects[i];
+        need += (r->y1 - r->y0 + 1) * ((r->x1 - r->x0 + 1) * 3 + 16);
+    }
+    if (need > dr->bufferSize) {
+        dr->bufferSize = need;
+        dr->buffer = (unsigned char *)realloc(dr->buffer, need);
+    }
+
+    unsigned char *p = dr->buffer;
+    int moveBytes = 0;
+    dr->moves = 0;
+
+    memcpy(p, "\x1b[?25l", 6);
+    p += 6;
+    for (int i = 0; i < dr->count; ++i) {
+        DamageRect *r = &dr->rects[i];
+        int full = r->x0 == 0 && r->x1 == s->width - 1;
+        for (int y = r->y0; y <= r->y1; ++y) {
+            /* Full rows wrap onto the next one by themselves */
+            if (y == r->y0 || !full) {
+                int len = sprintf((char *)p, "\x1b[%d;%dH", y + 1, r->x0 + 1);
+                p += len;
+                moveBytes += len;
+                ++dr->moves;
+            }
+            for (int x = r->x0; x <= r->x1; ++x) {
+                memcpy(p, brailleTab + s->data[y * s->width + x], 3);
+                p += 3;
+            }
+        }
+    }
+    memcpy(p, "\x1b[H", 3);
+    p += 3;
+
+    dr->bytes = p - dr->buffer;
+    if (dr->moves)
+        dr->moveCost = dr->moveCost * 0.75f + (float)moveBytes / dr->moves * 0.25f;
+
+    louisWrite(dr->buffer, dr->bytes);
+}
+
+/*----------------------------------------------------------------------------
+ * Throttled rendering
+ *
+ * Over a slow link, a full frame from render can take longer to arrive than
+ * the time between frames, and the frames back up. renderThrottled instead
+ * compares the Surface with what the terminal was last sent, and sends no
+ * more than a fixed number of bytes of the difference per frame: first the
+ * changes inside the focus rectangle, then the rest, biggest change first.
+ * Whatever doesn't fit is still different next frame and is sent then, so
+ * the screen converges as soon as the picture holds still, and at most one
+ * frame's budget is ever in transit.
+ *----------------------------------------------------------------------------*/
+typedef struct ThrottleRun {
+    int y;
+    int x0;
+    int x1;
+    int focus;
+} ThrottleRun;
+
+typedef struct Throttle {
+    int budget;
+    unsigned char *shown;
+    int width;
+    int height;
+    int focus;
+    int fx0;
+    int fy0;
+    int fx1;
+    int fy1;
+    ThrottleRun *runs;
+    int runCap;
+    unsigned char *buffer;
+    long bytes;
+} Throttle;
+
+/*----------------------------------------------------------------------------
+ * initThrottle, freeThrottle, setThrottleFocus
+ *
+ * Set up throttled rendering with a budget in bytes per frame, release it,
+ * and choose the block of cells, columns x0 to x1 and rows y0 to y1 from the
+ * top, whose changes go first. A block with x0 > x1 clears the focus.
+ *----------------------------------------------------------------------------*/
+void initThrottle(Throttle *t, int budget)
+{
+    memset(t, 0, sizeof(Throttle));
+    t->budget = budget < 64 ? 64 : budget;
+}
+
+void freeThrottle(Throttle *t)
+{
+    free(t->shown);
+    free(t->runs);
+    free(t->buffer);
+    memset(t, 0, sizeof(Throttle));
+}
+
+void setThrottleFocus(Throttle *t, int x0, int y0, int x1, int y1)
+{
+    t->focus = x0 <= x1 && y0 <= y1;
+    t->fx0 = x0;
+    t->fy0 = y0;
+    t->fx1 = x1;
+    t->fy1 = y1;
+}
+
+/*----------------------------------------------------------------------------
+ * throttleAddRun, compareRuns
+ *
+ * Record a changed run of cells, split where it crosses the edges of the
+ * focus, and order runs focus first, then longest first.
+ *----------------------------------------------------------------------------*/
+static void throttleAddRun(Throttle *t, int *n, int y, int x0, int x1)
+{
+    int inFocus = t->focus && y >= t->fy0 && y <= t->fy1;
+
+    if (inFocus && x0 < t->fx0 && x1 >= t->fx0) {
+        throttleAddRun(t, n, y, x0, t->fx0 - 1);
+        x0 = t->fx0;
+    }
+    if (inFocus && x0 <= t->fx1 && x1 > t->fx1) {
+        throttleAddRun(t, n, y, t->fx1 + 1, x1);
+        x1 = t->fx1;
+    }
+
+    if (*n == t->runCap) {
+        t->runCap = t->runCap ? t->runCap * 2 : 256;
+        t->runs = (ThrottleRun *)realloc(t->runs, t->runCap * sizeof(ThrottleRun));
+    }
+    ThrottleRun r = {y, x0, x1, inFocus && x0 >= t->fx0 && x1 <= t->fx1};
+    t->runs[(*n)++] = r;
+}
+
+static int compareRuns(const void *a, const void *b)
+{
+    const ThrottleRun *ra = (const ThrottleRun *)a, *rb = (const ThrottleRun *)b;
+
+    if (ra->focus != rb->focus)
+        return rb->focus - ra->focus;
+    if (ra->x1 - ra->x0 != rb->x1 - rb->x0)
+        return (rb->x1 - rb->x0) - (ra->x1 - ra->x0);
+    return (ra->y != rb->y) ? ra->y - rb->y : ra->x0 - rb->x0;
+}
+
+/*----------------------------------------------------------------------------
+ * renderThrottled
+ *
+ * Send the most important part of what changed, within the byte budget.
+ * Return the number of cells still out of date on the terminal afterwards.
+ *----------------------------------------------------------------------------*/
+int renderThrottled(Surface *s, Throttle *t)
+{
+    int len = s->width * s->height;
+    int n = 0, stale = 0, used;
+    unsigned char *p;
+
+    if (trace.fp)
+        traceFrame(s);
+
+    /* Start from a blank screen, which matches a Surface of zeros */
+    if (!t->shown || t->width != s->width || t->height != s->height) {
+        free(t->shown);
+        free(t->buffer);
+        t->shown = (unsigned char *)calloc(len, 1);
+        t->buffer = (unsigned char *)malloc(t->budget + 32);
+        t->width = s->width;
+        t->height = s->height;
+        louisWrite("\x1b[2J", 4);
+    }
+
+    /* Find the changed runs of each row. Runs closer together than a cursor
+     * movement costs are sent as one. */
+    for (int y = 0; y < s->height; ++y) {
+        unsigned char *a = s->data + y * s->width, *b = t->shown + y * s->width;
+        for (int x = 0; x < s->width;) {
+            if (a[x] == b[x]) {
+                ++x;
+                continue;
+            }
+            int x0 = x, x1 = x;
+            for (++x; x < s->width; ++x) {
+                if (a[x] != b[x])
+                    x1 = x;
+                else if (x - x1 > 3)
+                    break;
+            }
+            throttleAddRun(t, &n, y, x0, x1);
+        }
+    }
+    qsort(t->runs, n, sizeof(ThrottleRun), compareRuns);
+
+    p = t->buffer;
+    memcpy(p, "\x1b[?25l", 6);
+    p += 6;
+    for (int i = 0; i < n; ++i) {
+        ThrottleRun *r = &t->runs[i];
+        char move[32];
+        int moveLen = sprintf(move, "\x1b[%d;%dH", r->y + 1, r->x0 + 1);
+        int room = (t->budget - (int)(p - t->buffer) - moveLen - 3) / 3;
+        int count = r->x1 - r->x0 + 1;
+
+        /* Send as much of the run as fits */
+        if (count > room)
+            count = room;
+        if (count <= 0) {
+            for (int x = r->x0; x <= r->x1; ++x)
+                stale += s->data[r->y * s->width + x] != t->shown[r->y * s->width + x];
+            continue;
+        }
+
+        memcpy(p, move, moveLen);
+        p += moveLen;
+        unsigned char *src = s->data + r->y * s->width + r->x0;
+        encodeCells(p, src, count);
+        memcpy(t->shown + r->y * s->width + r->x0, src, count);
+        p += count * 3;
+
+        for (int x = r->x0 + count; x <= r->x1; ++x)
+            stale += s->data[r->y * s->width + x] != t->shown[r->y * s->width + x];
+    }
+    memcpy(p, "\x1b[H", 3);
+    p += 3;
+
+    used = n ? p - t->buffer : 0;
+    t->bytes = used;
+    if (used)
+        louisWrite(t->buffer, used);
+
+    return stale;
+}
+
+/*----------------------------------------------------------------------------
+ * Sample queues
+ *
+ * A SampleQueue carries numbers from threads that produce them, such as
+ * metric collectors, to the thread that draws, without either of them ever
+ * taking a lock. It is a ring with a power-of-two number of slots. With one
+ * producer the ring is a plain single-producer queue, where each side only
+ * writes its own index. With several producers, they reserve slots by
+ * advancing the head with compare-and-swap, and a sequence number per slot
+ * tells the reader when a reserved slot has actually been filled.
+ *
+ * Producers never wait. If the drawing thread falls so far behind that the
+ * ring is full, pushSample drops the sample and counts it in dropped, so the
+ * ring should hold at least a couple of frames' worth of samples.
+ *----------------------------------------------------------------------------*/
+typedef struct SampleQueue {
+    float *values;
+    atomic_uint *seq;
+    unsigned int mask;
+    int multi;
+    alignas(64) atomic_uint head;
+    alignas(64) atomic_uint tail;
+    alignas(64) atomic_ulong dropped;
+} SampleQueue;
+
+/*----------------------------------------------------------------------------
+ * initSampleQueue, freeSampleQueue
+ *
+ * Set up a queue holding at least capacity samples, for the given number of
+ * producer threads. Return -1 if memory runs out.
+ *----------------------------------------------------------------------------*/
+int initSampleQueue(SampleQueue *q, int capacity, int producers)
+{
+    unsigned int size = 2;
+    while (size < (unsigned int)capacity)
+        size <<= 1;
+
+    q->values = (float *)malloc(size * sizeof(float));
+    q->seq = NULL;
+    q->mask = size - 1;
+    q->multi = producers > 1;
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+    atomic_init(&q->dropped, 0);
+
+    if (q->multi) {
+        q->seq = (atomic_uint *)malloc(size * sizeof(*q->seq));
+        if (q->seq) {
+            for (unsigned int i = 0; i < size; ++i)
+                atomic_init(&q->seq[i], i);
+        }
+    }
+
+    return (!q->values || (q->multi && !q->seq)) ? -1 : 0;
+}
+
+void freeSampleQueue(SampleQueue *q)
+{
+    free(q->values);
+    free((void *)q->seq);
+    q->values = NULL;
+    q->seq = NULL;
+}
+
+/*----------------------------------------------------------------------------
+ * pushSample
+ *
+ * Add a sample from a producer thread. Return 0, or -1 if the queue was full
+ * and the sample was dropped.
+ *----------------------------------------------------------------------------*/
+int pushSample(SampleQueue *q, float value)
+{
+    unsigned int head = atomic_load_explicit(&q->head, memory_order_relaxed);
+
+    if (!q->multi) {
+        unsigned int tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+        if (head - tail > q->mask) {
+            atomic_fetch_add_explicit(&q->dropped, 1, memory_order_relaxed);
+            return -1;
+        }
+        q->values[head & q->mask] = value;
+        atomic_store_explicit(&q->head, head + 1, memory_order_release);
+        return 0;
+    }
+
+    /* A slot is free for position head when its sequence number equals
+     * head; the reader sets it to head plus the ring size after taking the
+     * value out. */
+    for (;;) {
+        unsigned int seq = atomic_load_explicit(&q->seq[head & q->mask], memory_order_acquire);
+        int diff = (int)(seq - head);
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->head, &head, head + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            atomic_fetch_add_explicit(&q->dropped, 1, memory_order_relaxed);
+            return -1;
+        } else {
+            head = atomic_load_explicit(&q->head, memory_order_relaxed);
+        }
+    }
+
+    q->values[head & q->mask] = value;
+    atomic_store_explicit(&q->seq[head & q->mask], head + 1, memory_order_release);
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------------
+ * drainSamples
+ *
+ * Take up to max samples out of the queue, oldest first, on the drawing
+ * thread, and return how many were taken.
+ *----------------------------------------------------------------------------*/
+int drainSamples(SampleQueue *q, float *out, int max)
+{
+    unsigned int tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    int n = 0;
+
+    if (!q->multi) {
+        unsigned int head = atomic_load_explicit(&q->head, memory_order_acquire);
+        while (n < max && tail != head)
+            out[n++] = q->values[tail++ & q->mask];
+        atomic_store_explicit(&q->tail, tail, memory_order_release);
+        return n;
+    }
+
+    /* Stop at the first slot that is reserved but not yet filled */
+    while (n < max) {
+        atomic_uint *seq = &q->seq[tail & q->mask];
+        if (atomic_load_explicit(seq, memory_order_acquire) != tail + 1)
+            break;
+        out[n++] = q->values[tail & q->mask];
+        atomic_store_explicit(seq, tail + q->mask + 1, memory_order_release);
+        ++tail;
+    }
+    atomic_store_explicit(&q->tail, tail, memory_order_relaxed);
+
+    return n;
+}
+
+/*----------------------------------------------------------------------------
+ * Charts
+ *
+ * A Chart keeps the most recent values of a series and draws them as a line
+ * graph, one value per column of dots, scrolling as new values arrive. The
+ * vertical range follows the visible values unless it is fixed with
+ * setChartRange.
+ *----------------------------------------------------------------------------*/
+typedef struct Chart {
+    float *values;
+    int capacity;
+    int count;
+    int next;
+    float min;
+    float max;
+    int fixed;
+} Chart;
+
+/*----------------------------------------------------------------------------
+ * initChart, freeChart, setChartRange
+ *
+ * Set up a Chart that shows the last capacity values, scaled to fit them,
+ * and release it. setChartRange fixes the scale at min to max instead, or
+ * scales to fit again when min isn't below max.
+ *----------------------------------------------------------------------------*/
+void initChart(Chart *c, int capacity)
+{
+    c->values = (float *)malloc(capacity * sizeof(float));
+    c->capacity = capacity;
+    c->count = 0;
+    c->next = 0;
+    c->fixed = 0;
+}
+
+void freeChart(Chart *c)
+{
+    free(c->values);
+    c->values = NULL;
+}
+
+void setChartRange(Chart *c, float min, float max)
+{
+    c->min = min;
+    c->max = max;
+    c->fixed = min < max;
+}
+
+/*----------------------------------------------------------------------------
+ * chartPush, chartDrain
+ *
+ * Append values to a Chart, either directly or by draining everything that
+ * has arrived on a SampleQueue since the last frame. chartDrain returns the
+ * number of samples taken.
+ *----------------------------------------------------------------------------*/
+void chartPush(Chart *c, const float *v, int n)
+{
+    /* Only the newest capacity values can matter */
+    if (n > c->capacity) {
+        v += n - c->capacity;
+        n = c->capacity;
+    }
+
+    for (int i = 0; i < n; ++i) {
+        c->values[c->next] = v[i];
+        if (++c->next == c->capacity)
+            c->next = 0;
+    }
+    c->count = (c->count + n > c->capacity) ? c->capacity : c->count + n;
+}
+
+int chartDrain(Chart *c, SampleQueue *q)
+{
+    float batch[256];
+    int total = 0, n;
+
+    while ((n = drainSamples(q, batch, 256)) > 0) {
+        chartPush(c, batch, n);
+        total += n;
+    }
+
+    return total;
+}
+
+/*----------------------------------------------------------------------------
+ * drawChart
+ *
+ * Draw the last w values of a Chart as a line graph in the w by h block of
+ * dots with its lower left corner at x, y, newest value on the right. At
+ * less than full detail, only every few values are joined, picked by where
+ * they are kept so that the same ones stay picked as the chart scrolls.
+ *----------------------------------------------------------------------------*/
+void drawChart(Surface *s, Chart *c, int x, int y, int w, int h)
+{
+    int n = c->count < w ? c->count : w;
+    int first = c->next - n;
+    float min = c->min, max = c->max;
+    float prev = 0.0f;
+    int prevX = 0;
+    int stride = lodStride();
+
+    if (first < 0)
+        first += c->capacity;
+
+    if (!c->fixed) {
+        int head = (first + n > c->capacity) ? c->capacity - first : n;
+        min = 1e30f;
+        max = -1e30f;
+        kernels.minMax(c->values + first, head, &min, &max);
+        kernels.minMax(c->values, n - head, &min, &max);
+        if (max <= min)
+            max = min + 1.0f;
+    }
+
+    pushTransform();
+    resetTransform();
+
+    float scale = (h - 1) / (max - min);
+    for (int i = 0, k = first; i < n; ++i, k = (k + 1 == c->capacity) ? 0 : k + 1) {
+        if (k % stride && i > 0 && i + 1 < n)
+            continue;
+        float v = (c->values[k] - min) * scale;
+        v = (v < 0) ? 0 : (v > h - 1) ? h - 1 : v;
+        int px = x + w - n + i;
+        if (i == 0)
+            drawPoint(s, px, y + v, 1);
+        else
+            drawLine(s, prevX, y + prev, px, y + v);
+        prev = v;
+        prevX = px;
+    }
+
+    popTransform();
+}
+
+/*----------------------------------------------------------------------------
+ * Bars
+ *
+ * A BarSeries holds a bar per time step and draws a window of them as
+ * candlesticks or box plots. A candlestick is an open, high, low and close,
+ * such as a minute of trading. A box is a minimum, lower quartile, median,
+ * upper quartile and maximum, such as a second of request latencies. Either
+ * way a bar is a wick, drawn as a vertical span from the low to the high,
+ * and a body, drawn a cell at a time with fillRect. A falling candle's body
+ * is filled and a rising one's hollow. Boxes are hollow, with the median
+ * across them.
+ *
+ * A window with more bars than dot columns is drawn a column at a time,
+ * every column standing for all the bars under it. To make that cost no more
+ * than the columns on the screen, the series keeps a pyramid of merged bars:
+ * level k holds one bar for each complete run of 2^k bars, so any span is
+ * put together from a few of them. Merged candles take the open of the first
+ * bar and the close of the last. Merged boxes keep the true extremes, but
+ * their quartiles and median are averages of those of the bars in them.
+ *----------------------------------------------------------------------------*/
+enum {BARS_CANDLE, BARS_BOX};
+
+#define BAR_LEVELS 32
+
+typedef struct BarSeries {
+    int kind;
+    int fields;
+    float *levels[BAR_LEVELS];
+    long counts[BAR_LEVELS];
+    long caps[BAR_LEVELS];
+} BarSeries;
+
+/*----------------------------------------------------------------------------
+ * initBarSeries, freeBarSeries, barCount
+ *
+ * Set up an empty series of BARS_CANDLE or BARS_BOX bars, release it, and
+ * tell how many bars have been added.
+ *----------------------------------------------------------------------------*/
+void initBarSeries(BarSeries *b, int kind)
+{
+    memset(b, 0, sizeof(BarSeries));
+    b->kind = kind;
+    b->fields = (kind == BARS_BOX) ? 5 : 4;
+}
+
+void freeBarSeries(BarSeries *b)
+{
+    for (int k = 0; k < BAR_LEVELS; ++k)
+        free(b->levels[k]);
+    initBarSeries(b, b->kind);
+}
+
+long barCount(BarSeries *b)
+{
+    return b->counts[0];
+}
+
+/*----------------------------------------------------------------------------
+ * mergeBar
+ *
+ * Merge bar r, standing for n bars, into acc, which stands for the m bars
+ * just before them.
+ *----------------------------------------------------------------------------*/
+static void mergeBar(BarSeries *b, float *acc, long m, const float *r, long n)
+{
+    if (b->kind == BARS_CANDLE) {
+        acc[1] = (r[1] > acc[1]) ? r[1] : acc[1];
+        acc[2] = (r[2] < acc[2]) ? r[2] : acc[2];
+        acc[3] = r[3];
+    } else {
+        acc[0] = (r[0] < acc[0]) ? r[0] : acc[0];
+        for (int i = 1; i < 4; ++i)
+            acc[i] = (acc[i] * m + r[i] * n) / (m + n);
+        acc[4] = (r[4] > acc[4]) ? r[4] : acc[4];
+    }
+}
+
+/*----------------------------------------------------------------------------
+ * addBar, addCandle, addBox
+ *
+ * Append a bar, and a merged bar to every level whose run it completes.
+ *----------------------------------------------------------------------------*/
+static void addBar(BarSeries *b, const float *v)
+{
+    float merged[5];
+
+    for (int k = 0; k < BAR_LEVELS; ++k) {
+        if (b->counts[k] == b->caps[k]) {
+            b->caps[k] = b->caps[k] ? b->caps[k] * 2 : 256;
+            b->levels[k] = (float *)realloc(b->levels[k], b->caps[k] * b->fields * sizeof(float));
+        }
+
+        float *r = b->levels[k] + b->counts[k]++ * b->fields;
+        memcpy(r, v, b->fields * sizeof(float));
+        if (b->counts[k] & 1)
+            break;
+
+        /* Pair it with the bar before for the level above */
+        memcpy(merged, r - b->fields, b->fields * sizeof(float));
+        mergeBar(b, merged, 1, r, 1);
+        v = merged;
+    }
+}
+
+void addCandle(BarSeries *b, float open, float high, float low, float close)
+{
+    float v[4] = {open, high, low, close};
+    addBar(b, v);
+}
+
+void addBox(BarSeries *b, float min, float q1, float median, float q3, float max)
+{
+    float v[5] = {min, q1, median, q3, max};
+    addBar(b, v);
+}
+
+/*----------------------------------------------------------------------------
+ * spanBar
+ *
+ * Put together the merged bar for bars first up to but not including end,
+ * from the largest runs in the pyramid that fit, so in a few steps however
+ * long the span.
+ *----------------------------------------------------------------------------*/
+static void spanBar(BarSeries *b, long first, long end, float *out)
+{
+    long merged = 0;
+
+    while (first < end) {
+        int k = 0;
+        while (k + 1 < BAR_LEVELS && !(first & ((2L << k) - 1)) && first + (2L << k) <= end)
+            ++k;
+
+        const float *r = b->levels[k] + (first >> k) * b->fields;
+        if (merged == 0)
+            memcpy(out, r, b->fields * sizeof(float));
+        else
+            mergeBar(b, out, merged, r, 1L << k);
+        merged += 1L << k;
+        first += 1L << k;
+    }
+}
+
+/*----------------------------------------------------------------------------
+ * barY
+ *
+ * The row of dots value v falls on, clamped to the range drawn.
+ *----------------------------------------------------------------------------*/
+static int barY(float v, float min, float max, float scale)
+{
+    v = (v < min) ? min : (v > max) ? max : v;
+    return (int)((v - min) * scale + 0.5f);
+}
+
+/*----------------------------------------------------------------------------
+ * drawBars
+ *
+ * Draw count bars from first in the w by h block of dots with its lower left
+ * corner at x, y, scaled so that min and max are the bottom and top. If min
+ * isn't below max, the range follows the bars shown. Bars wider than a
+ * column get an even share of the width, less a gap; beyond w bars, each
+ * column is the merge of the bars under it.
+ *----------------------------------------------------------------------------*/
+void drawBars(Surface *s, BarSeries *b, long first, long count, int x, int y, int w, int h,
+              float min, float max)
+{
+    first = (first < 0) ? 0 : first;
+    count = (first + count > barCount(b)) ? barCount(b) - first : count;
+    if (count <= 0 || w <= 0 || h <= 0)
+        return;
+
+    int n = (count > w) ? w : count;
+    int pitch = w / n;
+    int body = (pitch > 2) ? pitch - (pitch + 2) / 4 : pitch;
+    int lo = (b->kind == BARS_BOX) ? 0 : 2;
+    int hi = (b->kind == BARS_BOX) ? 4 : 1;
+    float *bars = (float *)malloc(n * (b->fields + 2) * sizeof(float));
+    float *lows = bars + n * b->fields, *highs = lows + n;
+
+    for (int i = 0; i < n; ++i) {
+        float *r = bars + i * b->fields;
+        spanBar(b, first + count * i / n, first + count * (i + 1) / n, r);
+        lows[i] = r[lo];
+        highs[i] = r[hi];
+    }
+
+    if (!(min < max)) {
+        float unused = -1e30f;
+        min = 1e30f;
+        max = -1e30f;
+        kernels.minMax(lows, n, &min, &unused);
+        kernels.minMax(highs, n, &unused, &max);
+        if (max <= min)
+            max = min + 1.0f;
+    }
+
+    float scale = (h - 1) / (max - min);
+
+    for (int i = 0; i < n; ++i) {
+        float *r = bars + i * b->fields;
+        float bottom, top;
+        int hollow;
+
+        if (b->kind == BARS_BOX) {
+            bottom = r[1], top = r[3], hollow = 1;
+        } else {
+            bottom = (r[0] < r[3]) ? r[0] : r[3];
+            top = (r[0] < r[3]) ? r[3] : r[0];
+            hollow = r[3] > r[0];
+        }
+
+        int left = x + i * pitch, mid = left + (body - 1) / 2;
+        int y0 = y + barY(r[lo], min, max, scale), y1 = y + barY(bottom, min, max, scale);
+        int y2 = y + barY(top, min, max, scale), y3 = y + barY(r[hi], min, max, scale);
+
+        if (body < 3 || y2 - y1 < 2) {
+            drawRect(s, mid, y0, 1, y3 - y0 + 1, 1);
+            drawRect(s, left, y1, body, y2 - y1 + 1, 1);
+            continue;
+        }
+
+        drawRect(s, mid, y0, 1, y1 - y0, 1);
+        drawRect(s, mid, y2 + 1, 1, y3 - y2, 1);
+        drawRect(s, left, y1, body, y2 - y1 + 1, !hollow);
+        if (b->kind == BARS_BOX)
+            drawRect(s, left, y + barY(r[2], min, max, scale), body, 1, 1);
+    }
+
+    free(bars);
+}
+
+/*----------------------------------------------------------------------------
+ * Quantile charts
+ *
+ * A QuantileChart shows how a measure such as request latency is spread over
+ * time, as bands between quantiles: by default from the median to the 90th
+ * percentile, and from there to the 99th. Each time step is a column,
+ * newest on the right. Threads serving requests record their latencies with
+ * recordQuantile while the chart is on the screen, and the program calls
+ * advanceQuantileChart to start each new time step.
+ *
+ * No samples are kept. Each time step has a sketch instead: a count of the
+ * values that fell in each of QUANTILE_BINS bins, each bin 1 + 2 alpha times
+ * as wide as the one before it, with alpha QUANTILE_ACCURACY. Any quantile
+ * read from the counts is then within alpha of the true one, relative to its
+ * size (Masson, Rim and Lee, DDSketch). Recording a value is a logarithm and
+ * an atomic add, so threads never wait on each other, and two sketches are
+ * merged by adding their counts, which unlike the averaged quartiles of a
+ * merged box plot gives exactly the sketch of all their values. The
+ * quantiles of a time step are worked out once it is over and kept with it,
+ * so a frame only reads through the counts of the current step.
+ *----------------------------------------------------------------------------*/
+#define QUANTILE_ACCURACY 0.01f
+#define QUANTILE_BINS 2048
+#define QUANTILE_MAX_BANDS 4
+#define QUANTILE_MIN_VALUE 1e-30f
+
+typedef struct QuantileSketch {
+    atomic_uint counts[QUANTILE_BINS];
+    atomic_uint total;
+} QuantileSketch;
+
+typedef struct QuantileChart {
+    QuantileSketch *steps;
+    float (*values)[QUANTILE_MAX_BANDS];
+    unsigned char *known;
+    int capacity;
+    int count;
+    atomic_int current;
+    float minValue;
+    float binsPerLog;
+    float gamma;
+    float quantiles[QUANTILE_MAX_BANDS];
+    int nquantiles;
+} QuantileChart;
+
+/*----------------------------------------------------------------------------
+ * initQuantileChart, freeQuantileChart, setQuantiles
+ *
+ * Set up a chart that keeps capacity time steps, counting values at or
+ * below minValue as minValue, and release it. The bins reach up to about
+ * minValue times 6e17, and values beyond are counted in the last one. The
+ * bins grow by a factor, so minValue must be positive: anything smaller
+ * than QUANTILE_MIN_VALUE, zero included, is raised to it. setQuantiles
+ * replaces the quantiles drawn, n of them from 0 to 1 in increasing order,
+ * the first drawn as a line and the space up to each of the others as a
+ * band. With none, the median alone is drawn.
+ *----------------------------------------------------------------------------*/
+void initQuantileChart(QuantileChart *qc, int capacity, float minValue)
+{
+    static const float quantiles[3] = {0.5f, 0.9f, 0.99f};
+
+    memset(qc, 0, sizeof(QuantileChart));
+    qc->steps = (QuantileSketch *)calloc(capacity, sizeof(QuantileSketch));
+    qc->values = (float (*)[QUANTILE_MAX_BANDS])malloc(capacity * sizeof(*qc->values));
+    qc->known = (unsigned char *)calloc(capacity, 1);
+    qc->capacity = capacity;
+    qc->count = 1;
+    qc->minValue = (minValue > QUANTILE_MIN_VALUE) ? minValue : QUANTILE_MIN_VALUE;
+    qc->gamma = (1 + QUANTILE_ACCURACY) / (1 - QUANTILE_ACCURACY);
+    qc->binsPerLog = 1 / logf(qc->gamma);
+    memcpy(qc->quantiles, quantiles, sizeof(quantiles));
+    qc->nquantiles = 3;
+}
+
+void freeQuantileChart(QuantileChart *qc)
+{
+    free(qc->steps);
+    free(qc->values);
+    free(qc->known);
+    memset(qc, 0, sizeof(QuantileChart));
+}
+
+void setQuantiles(QuantileChart *qc, const float *q, int n)
+{
+    static const float median = 0.5f;
+
+    qc->nquantiles = (n < 1) ? 1 : (n > QUANTILE_MAX_BANDS) ? QUANTILE_MAX_BANDS : n;
+    memcpy(qc->quantiles, (n < 1) ? &median : q, qc->nquantiles * sizeof(float));
+    memset(qc->known, 0, qc->capacity);
+}
+
+/*----------------------------------------------------------------------------
+ * recordQuantile
+ *
+ * Count a value in the current time step. Any number of threads may record
+ * at once, and while the chart is being drawn. A value recorded just as the
+ * step advances may be counted in the step before.
+ *----------------------------------------------------------------------------*/
+void recordQuantile(QuantileChart *qc, float v)
+{
+    QuantileSketch *sk = &qc->steps[atomic_load_explicit(&qc->current, memory_order_acquire)];
+    int bin = 0;
+
+    if (v > qc->minValue) {
+        float f = ceilf(logf(v / qc->minValue) * qc->binsPerLog);
+        bin = (f < QUANTILE_BINS - 1) ? (int)f : QUANTILE_BINS - 1;
+    }
+    atomic_fetch_add_explicit(&sk->counts[bin], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&sk->total, 1, memory_order_relaxed);
+}
+
+/*----------------------------------------------------------------------------
+ * mergeSketch, sketchQuantiles
+ *
+ * Add the counts of one sketch to another, and read n quantiles, in
+ * increasing order, from a sketch. A quantile is given as the middle of its
+ * bin, or as 0 if nothing has been counted.
+ *----------------------------------------------------------------------------*/
+void mergeSketch(QuantileSketch *dst, QuantileSketch *src)
+{
+    for (int i = 0; i < QUANTILE_BINS; ++i) {
+        unsigned int n = atomic_load_explicit(&src->counts[i], memory_order_relaxed);
+        if (n)
+            atomic_fetch_add_explicit(&dst->counts[i], n, memory_order_relaxed);
+    }
+    atomic_fetch_add_explicit(&dst->total, atomic_load_explicit(&src->total, memory_order_relaxed),
+                              memory_order_relaxed);
+}
+
+void sketchQuantiles(QuantileChart *qc, QuantileSketch *sk, const float *q, int n, float *out)
+{
+    unsigned long total = atomic_load_explicit(&sk->total, memory_order_relaxed), seen = 0;
+    int bin = 0;
+
+    for (int k = 0; k < n; ++k) {
+        if (total == 0) {
+            out[k] = 0;
+            continue;
+        }
+
+        /* The bin holding the value of this rank, going on from the last */
+        unsigned long rank = q[k] * (total - 1);
+        while (bin < QUANTILE_BINS - 1) {
+            unsigned int c = atomic_load_explicit(&sk->counts[bin], memory_order_relaxed);
+            if (seen + c > rank)
+                break;
+            seen += c;
+            ++bin;
+        }
+        out[k] = bin ? qc->minValue * 2 * powf(qc->gamma, bin) / (qc->gamma + 1) : qc->minValue;
+    }
+}
+
+/*----------------------------------------------------------------------------
+ * advanceQuantileChart
+ *
+ * Start a new time step, reusing the oldest once the chart is full. Only one
+ * thread should advance a chart.
+ *----------------------------------------------------------------------------*/
+void advanceQuantileChart(QuantileChart *qc)
+{
+    int next = atomic_load_explicit(&qc->current, memory_order_relaxed) + 1;
+
+    if (next == qc->capacity)
+        next = 0;
+
+    QuantileSketch *sk = &qc->steps[next];
+    for (int i = 0; i < QUANTILE_BINS; ++i)
+        atomic_store_explicit(&sk->counts[i], 0, memory_order_relaxed);
+    atomic_store_explicit(&sk->total, 0, memory_order_relaxed);
+    qc->known[next] = 0;
+
+    atomic_store_explicit(&qc->current, next, memory_order_release);
+    if (qc->count < qc->capacity)
+        ++qc->count;
+}
+
+/*----------------------------------------------------------------------------
+ * drawQuantileChart
+ *
+ * Draw the last w time steps of a QuantileChart in the w by h block of dots
+ * with its lower left corner at x, y, scaled to fit. The first quantile is
+ * a line, and the bands above it are dithered, each lighter than the one
+ * below.
+ *----------------------------------------------------------------------------*/
+void drawQuantileChart(Surface *s, QuantileChart *qc, int x, int y, int w, int h)
+{
+    int n = qc->count < w ? qc->count : w;
+    int current = atomic_load_explicit(&qc->current, memory_order_acquire);
+    int first = current - n + 1, nq = qc->nquantiles;
+    float lo = 1e30f, hi = -1e30f;
+
+    if (nq < 1 || n < 1)
+        return;
+    if (first < 0)
+        first += qc->capacity;
+
+    /* Steps that are over keep their quantiles, so only the current one is
+     * read every frame */
+    for (int i = 0, k = first; i < n; ++i, k = (k + 1 == qc->capacity) ? 0 : k + 1) {
+        if (!qc->known[k] || k == current) {
+            sketchQuantiles(qc, &qc->steps[k], qc->quantiles, nq, qc->values[k]);
+            qc->known[k] = k != current;
+        }
+        if (atomic_load_explicit(&qc->steps[k].total, memory_order_relaxed) == 0)
+            continue;
+        lo = (qc->values[k][0] < lo) ? qc->values[k][0] : lo;
+        hi = (qc->values[k][nq - 1] > hi) ? qc->values[k][nq - 1] : hi;
+    }
+    if (lo > hi)
+        return;
+    if (hi <= lo)
+        hi = lo + 1.0f;
+
+    pushTransform();
+    resetTransform();
+
+    float scale = (h - 1) / (hi - lo);
+    int prev = -1, prevX = 0;
+    for (int i = 0, k = first; i < n; ++i, k = (k + 1 == qc->capacity) ? 0 : k + 1) {
+        int px = x + w - n + i;
+        if (atomic_load_explicit(&qc->steps[k].total, memory_order_relaxed) == 0) {
+            prev = -1;
+            continue;
+        }
+
+        int dots[QUANTILE_MAX_BANDS];
+        for (int b = 0; b < nq; ++b)
+            dots[b] = (qc->values[k][b] - lo) * scale;
+
+        for (int b = 1; b < nq; ++b) {
+            float intensity = 0.6f / b;
+            for (int d = dots[b - 1] + 1; d <= dots[b]; ++d)
+                drawDitheredPoint(s, px, y + d, intensity);
+        }
+        if (prev >= 0)
+            drawLine(s, prevX, y + prev, px, y + dots[0]);
+        else
+            drawPoint(s, px, y + dots[0], 1);
+        prev = dots[0];
+        prevX = px;
+    }
+
+    popTransform();
+}
+
+/*----------------------------------------------------------------------------
+ * Graphs
+ *
+ * A Graph is a set of nodes joined by edges, such as services and the calls
+ * between them, laid out by a force simulation and drawn as circles joined
+ * by lines. Every node pushes every other away, every edge pulls its ends
+ * together like a spring, and a weak pull toward the middle keeps pieces
+ * that aren't connected from drifting apart. Each step, a node moves along
+ * the sum of its forces, but no further than the temperature, which cools
+ * from step to step. layoutGraph runs a few steps a frame, so the layout
+ * settles over a number of frames and can be drawn as it goes; adding nodes
+ * or edges warms it up again, and once it is cold layoutGraph does nothing.
+ *
+ * Summing the push between every pair of nodes would cost n^2 a step, so
+ * the nodes are sorted into a quadtree first, which records the weight and
+ * centre of mass of each cell. A node is pushed by a whole cell at once when
+ * the cell looks small from where the node is, its size over its distance
+ * being under GRAPH_THETA, which makes a step n log n (Barnes and Hut). The
+ * pushes on different nodes don't depend on each other, so they are summed
+ * by a pool of threads, which take shares of the nodes until none are left.
+ *----------------------------------------------------------------------------*/
+#define GRAPH_THETA 0.8f
+#define GRAPH_MAX_DEPTH 24
+#define GRAPH_MIN_SHARE 256
+#define GRAPH_MAX_THREADS 64
+
+typedef struct QuadCell {
+    float x;
+    float y;
+    float mass;
+    float cx;
+    float cy;
+    float half;
+    int child;
+    int body;
+} QuadCell;
+
+typedef struct Graph {
+    float *x;
+    float *y;
+    float *dx;
+    float *dy;
+    int count;
+    int cap;
+    int *edges;
+    int nedges;
+    int edgeCap;
+    QuadCell *cells;
+    int ncells;
+    int cellCap;
+    float temperature;
+    pthread_t threads[GRAPH_MAX_THREADS];
+    int nthreads;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t finished;
+    unsigned long generation;
+    int pending;
+    int quit;
+    int shares;
+    atomic_int nextShare;
+} Graph;
+
+/*----------------------------------------------------------------------------
+ * newCells, insertBody, buildQuadtree
+ *
+ * Cells are kept in one array and refer to each other by index, the four
+ * children of a cell being next to each other. A leaf holds a single node,
+ * or at GRAPH_MAX_DEPTH any number that are too close to tell apart, marked
+ * with a body of -2. Every cell on the way down adds the node to its totals,
+ * which are turned into centres of mass once all the nodes are in.
+ *----------------------------------------------------------------------------*/
+static int newCells(Graph *g, QuadCell *parent)
+{
+    float cx = parent->cx, cy = parent->cy, half = parent->half / 2;
+    int first = g->ncells;
+
+    if (g->ncells + 4 > g->cellCap) {
+        g->cellCap = g->cellCap ? g->cellCap * 2 : 1024;
+        g->cells = (QuadCell *)realloc(g->cells, g->cellCap * sizeof(QuadCell));
+    }
+    for (int k = 0; k < 4; ++k) {
+        QuadCell *c = &g->cells[g->ncells++];
+        memset(c, 0, sizeof(QuadCell));
+        c->cx = cx + ((k & 1) ? half : -half);
+        c->cy = cy + ((k & 2) ? half : -half);
+        c->half = half;
+        c->child = -1;
+        c->body = -1;
+    }
+
+    return first;
+}
+
+static void insertBody(Graph *g, int i)
+{
+    float bx = g->x[i], by = g->y[i];
+    int c = 0;
+
+    for (int depth = 0;; ++depth) {
+        QuadCell *q = &g->cells[c];
+        q->x += bx;
+        q->y += by;
+        q->mass += 1;
+
+        if (q->child < 0) {
+            if (q->body == -1 && q->mass == 1) {
+                q->body = i;
+                return;
+            }
+            if (depth == GRAPH_MAX_DEPTH || q->body == -2) {
+                q->body = -2;
+                return;
+            }
+
+            /* Split the leaf, moving the node already there down a level */
+            int b = q->body;
+            int first = newCells(g, q);
+            q = &g->cells[c];
+            q->child = first;
+            q->body = -1;
+
+            QuadCell *to = &g->cells[first + (g->x[b] >= q->cx) + 2 * (g->y[b] >= q->cy)];
+            to->x = g->x[b];
+            to->y = g->y[b];
+            to->mass = 1;
+            to->body = b;
+        }
+
+        c = q->child + (bx >= q->cx) + 2 * (by >= q->cy);
+    }
+}
+
+static void buildQuadtree(Graph *g)
+{
+    float xmin = 1e30f, xmax = -1e30f, ymin = 1e30f, ymax = -1e30f;
+
+    kernels.minMax(g->x, g->count, &xmin, &xmax);
+    kernels.minMax(g->y, g->count, &ymin, &ymax);
+
+    QuadCell root;
+    root.cx = (xmin + xmax) / 2;
+    root.cy = (ymin + ymax) / 2;
+    root.half = ((xmax - xmin > ymax - ymin) ? xmax - xmin : ymax - ymin) + 1.0f;
+
+    /* The root is the first of a set of four, the others left empty */
+    g->ncells = 0;
+    newCells(g, &root);
+    g->cells[0].cx = root.cx;
+    g->cells[0].cy = root.cy;
+    g->cells[0].half = root.half / 2;
+
+    for (int i = 0; i < g->count; ++i)
+        insertBody(g, i);
+
+    for (int c = 0; c < g->ncells; ++c) {
+        if (g->cells[c].mass > 0) {
+            g->cells[c].x /= g->cells[c].mass;
+            g->cells[c].y /= g->cells[c].mass;
+        }
+    }
+}
+
+/*----------------------------------------------------------------------------
+ * repelShare
+ *
+ * Sum the push from the rest of the graph on every node in share j. Nodes
+ * that sit on top of each other are pushed apart in a direction that
+ * depends on their index, since they have no direction between them.
+ *----------------------------------------------------------------------------*/
+static void repelShare(Graph *g, int j)
+{
+    int stack[4 * GRAPH_MAX_DEPTH + 4];
+    int first = (long)j * g->count / g->shares, last = (long)(j + 1) * g->count / g->shares;
+
+    for (int i = first; i < last; ++i) {
+        float xi = g->x[i], yi = g->y[i];
+        float fx = 0, fy = 0;
+        int n = 0;
+
+        stack[n++] = 0;
+        while (n > 0) {
+            QuadCell *q = &g->cells[stack[--n]];
+            if (q->mass == 0 || q->body == i)
+                continue;
+
+            float dx = xi - q->x, dy = yi - q->y;
+            float d2 = dx * dx + dy * dy;
+
+            if (q->child >= 0 && 4 * q->half * q->half >= GRAPH_THETA * GRAPH_THETA * d2) {
+                for (int k = 0; k < 4; ++k)
+                    stack[n++] = q->child + k;
+                continue;
+            }
+
+            if (d2 < 1e-6f) {
+                dx = 0.01f * ((i * 7919) % 13 - 6);
+                dy = 0.01f * ((i * 104729) % 13 - 6);
+                d2 = dx * dx + dy * dy + 1e-6f;
+            }
+            fx += dx * q->mass / d2;
+            fy += dy * q->mass / d2;
+        }
+
+        g->dx[i] = fx;
+        g->dy[i] = fy;
+    }
+}
+
+/*----------------------------------------------------------------------------
+ * takeShares, graphWorker
+ *
+ * Workers sleep until the generation changes, then take shares alongside the
+ * calling thread until there are none left, and report back.
+ *----------------------------------------------------------------------------*/
+static void takeShares(Graph *g)
+{
+    int j;
+
+    while ((j = atomic_fetch_add(&g->nextShare, 1)) < g->shares)
+        repelShare(g, j);
+}
+
+static void *graphWorker(void *arg)
+{
+    Graph *g = (Graph *)arg;
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&g->lock);
+    for (;;) {
+        while (g->generation == seen && !g->quit)
+            pthread_cond_wait(&g->start, &g->lock);
+        if (g->quit)
+            break;
+        seen = g->generation;
+
+        pthread_mutex_unlock(&g->lock);
+        takeShares(g);
+        pthread_mutex_lock(&g->lock);
+        if (--g->pending == 0)
+            pthread_cond_signal(&g->finished);
+    }
+    pthread_mutex_unlock(&g->lock);
+
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------
+ * initGraph, freeGraph
+ *
+ * Start an empty Graph whose layout runs on n threads, 1 meaning the calling
+ * thread alone.
+ *----------------------------------------------------------------------------*/
+void initGraph(Graph *g, int n)
+{
+    memset(g, 0, sizeof(Graph));
+    pthread_mutex_init(&g->lock, NULL);
+    pthread_cond_init(&g->start, NULL);
+    pthread_cond_init(&g->finished, NULL);
+
+    n = (n > GRAPH_MAX_THREADS) ? GRAPH_MAX_THREADS : n;
+    for (int i = 1; i < n; ++i) {
+        if (pthread_create(&g->threads[g->nthreads], NULL, graphWorker, g))
+            break;
+        ++g->nthreads;
+    }
+}
+
+void freeGraph(Graph *g)
+{
+    pthread_mutex_lock(&g->lock);
+    g->quit = 1;
+    pthread_cond_broadcast(&g->start);
+    pthread_mutex_unlock(&g->lock);
+    for (int i = 0; i < g->nthreads; ++i)
+        pthread_join(g->threads[i], NULL);
+
+    pthread_mutex_destroy(&g->lock);
+    pthread_cond_destroy(&g->start);
+    pthread_cond_destroy(&g->finished);
+    free(g->x);
+    free(g->y);
+    free(g->dx);
+    free(g->dy);
+    free(g->edges);
+    free(g->cells);
+    g->x = g->y = g->dx = g->dy = NULL;
+    g->edges = NULL;
+    g->cells = NULL;
+}
+
+/*----------------------------------------------------------------------------
+ * addNode, addEdge
+ *
+ * New nodes are placed on a spiral out from the middle, so that no two start
+ * in the same place. addNode returns the node's index, and addEdge ignores
+ * edges from a node to itself or to nodes that don't exist.
+ *----------------------------------------------------------------------------*/
+static void warmGraph(Graph *g)
+{
+    float heat = 1.0f + sqrtf(g->count) / 4;
+
+    if (g->temperature < heat)
+        g->temperature = heat;
+}
+
+int addNode(Graph *g)
+{
+    if (g->count == g->cap) {
+        g->cap = g->cap ? g->cap * 2 : 64;
+        g->x = (float *)realloc(g->x, g->cap * sizeof(float));
+        g->y = (float *)realloc(g->y, g->cap * sizeof(float));
+        g->dx = (float *)realloc(g->dx, g->cap * sizeof(float));
+        g->dy = (float *)realloc(g->dy, g->cap * sizeof(float));
+    }
+
+    int i = g->count++;
+    g->x[i] = sqrtf(i) * cosf(i * 2.39996f);
+    g->y[i] = sqrtf(i) * sinf(i * 2.39996f);
+    warmGraph(g);
+
+    return i;
+}
+
+void addEdge(Graph *g, int a, int b)
+{
+    if (a == b || a < 0 || b < 0 || a >= g->count || b >= g->count)
+        return;
+
+    if (g->nedges == g->edgeCap) {
+        g->edgeCap = g->edgeCap ? g->edgeCap * 2 : 64;
+        g->edges = (int *)realloc(g->edges, g->edgeCap * 2 * sizeof(int));
+    }
+    g->edges[g->nedges * 2] = a;
+    g->edges[g->nedges * 2 + 1] = b;
+    ++g->nedges;
+    warmGraph(g);
+}
+
+/*----------------------------------------------------------------------------
+ * layoutGraph
+ *
+ * Run up to steps steps of the layout. Return how far the node that moved
+ * most went in the last step, which is 0 once the layout has settled.
+ *----------------------------------------------------------------------------*/
+float layoutGraph(Graph *g, int steps)
+{
+    float moved = 0;
+
+    for (int step = 0; step < steps && g->temperature > 0 && g->count > 1; ++step) {
+        buildQuadtree(g);
+
+        /* Enough shares that threads finishing early find more to do */
+        int threads = g->nthreads + 1;
+        g->shares = g->count / GRAPH_MIN_SHARE;
+        g->shares = (g->shares > threads * 4) ? threads * 4 : (g->shares < 1) ? 1 : g->shares;
+        atomic_store(&g->nextShare, 0);
+
+        if (g->shares > 1 && g->nthreads > 0) {
+            pthread_mutex_lock(&g->lock);
+            g->pending = g->nthreads;
+            ++g->generation;
+            pthread_cond_broadcast(&g->start);
+            pthread_mutex_unlock(&g->lock);
+
+            takeShares(g);
+
+            pthread_mutex_lock(&g->lock);
+            while (g->pending)
+                pthread_cond_wait(&g->finished, &g->lock);
+            pthread_mutex_unlock(&g->lock);
+        } else {
+            takeShares(g);
+        }
+
+        for (int e = 0; e < g->nedges; ++e) {
+            int a = g->edges[e * 2], b = g->edges[e * 2 + 1];
+            float dx = g->x[b] - g->x[a], dy = g->y[b] - g->y[a];
+            float d = sqrtf(dx * dx + dy * dy);
+            g->dx[a] += dx * d;
+            g->dy[a] += dy * d;
+            g->dx[b] -= dx * d;
+            g->dy[b] -= dy * d;
+        }
+
+        moved = 0;
+        for (int i = 0; i < g->count; ++i) {
+            float dx = g->dx[i] - 0.05f * g->x[i], dy = g->dy[i] - 0.05f * g->y[i];
+            float d = sqrtf(dx * dx + dy * dy);
+            if (d > g->temperature) {
+                dx *= g->temperature / d;
+                dy *= g->temperature / d;
+                d = g->temperature;
+            }
+            g->x[i] += dx;
+            g->y[i] += dy;
+            moved = (d > moved) ? d : moved;
+        }
+
+        g->temperature *= 0.97f;
+        if (g->temperature < 0.005f)
+            g->temperature = 0;
+    }
+
+    return moved;
+}
+
+/*----------------------------------------------------------------------------
+ * drawGraph
+ *
+ * Draw a Graph scaled to fit the w by h block of dots with its lower left
+ * corner at x, y, edges as lines and nodes as filled circles of radius r.
+ *----------------------------------------------------------------------------*/
+void drawGraph(Surface *s, Graph *g, int x, int y, int w, int h, int r)
+{
+    float xmin = 1e30f, xmax = -1e30f, ymin = 1e30f, ymax = -1e30f;
+
+    if (g->count == 0)
+        return;
+
+    kernels.minMax(g->x, g->count, &xmin, &xmax);
+    kernels.minMax(g->y, g->count, &ymin, &ymax);
+
+    float sx = (w - 1 - 2 * r) / (xmax - xmin + 1e-6f), sy = (h - 1 - 2 * r) / (ymax - ymin + 1e-6f);
+    float scale = (sx < sy) ? sx : sy;
+    float ox = x + r + (w - 1 - 2 * r - (xmax - xmin) * scale) / 2 - xmin * scale;
+    float oy = y + r + (h - 1 - 2 * r - (ymax - ymin) * scale) / 2 - ymin * scale;
+
+    pushTransform();
+    resetTransform();
+
+    for (int e = 0; e < g->nedges; ++e) {
+        int a = g->edges[e * 2], b = g->edges[e * 2 + 1];
+        drawLine(s, (int)(ox + g->x[a] * scale), (int)(oy + g->y[a] * scale),
+                 (int)(ox + g->x[b] * scale), (int)(oy + g->y[b] * scale));
+    }
+    for (int i = 0; i < g->count; ++i)
+        drawCircle(s, ox + g->x[i] * scale, oy + g->y[i] * scale, r, 1);
+
+    popTransform();
+}
+
+/*----------------------------------------------------------------------------
+ * Vector maps
+ *
+ * A VectorMap is a set of polylines in world coordinates, such as
+ * coastlines, the walls of a floor plan, or the links of a network, drawn
+ * through a view that can be panned and zoomed. A feature whose first and
+ * last vertices are the same is a closed outline.
+ *
+ * Maps with millions of vertices stay quick to draw because almost all of
+ * them are skipped. The features are indexed by an R-tree, packed bottom up
+ * with the sort-tile-recursive method, so that only the features whose
+ * bounding boxes cross the view are looked at. A feature that is smaller
+ * than a dot is drawn as one. The rest are drawn simplified with the
+ * Douglas-Peucker method, to within half a dot at the scale they are shown
+ * at; a simplified feature is worked out the first time it is needed at one
+ * of MAP_LEVELS zoom levels, each twice as coarse as the one before, and
+ * kept for the next frame. Each segment is clipped to the view with the
+ * Cohen-Sutherland method before it is given to drawLine, and the ends are
+ * moved on to the whole segment's steps, so that the same dots are set
+ * inside the view as for the whole segment, but for the odd dot lying on a
+ * rounding boundary, where the clipped slope may round the other way.
+ *
+ * On disk a map is the 8 bytes "LOUISMP1", the number of features and of
+ * vertices as 32-bit integers, the vertex count of every feature as a
+ * 32-bit integer, and then the vertices as pairs of 32-bit floats, all in
+ * the byte order of the machine.
+ *----------------------------------------------------------------------------*/
+#define MAP_NODE_SIZE 16
+#define MAP_LEVELS 16
+
+typedef struct MapItem {
+    float x0;
+    float y0;
+    float x1;
+    float y1;
+    int first;
+    int count;
+    int leaf;
+} MapItem;
+
+typedef struct MapLevel {
+    int *start;
+    int *count;
+    int *pool;
+    long used;
+    long cap;
+} MapLevel;
+
+typedef struct VectorMap {
+    float *xy;
+    long nvertices;
+    long vertexCap;
+    MapItem *features;
+    int nfeatures;
+    int featureCap;
+    MapItem *nodes;
+    int nnodes;
+    float tolerance;
+    MapLevel levels[MAP_LEVELS];
+    unsigned char *keep;
+    int *stack;
+    int scratch;
+} VectorMap;
+
+/*----------------------------------------------------------------------------
+ * initMap, freeMap
+ *
+ * Set up an empty map, and release a map with its index and simplified
+ * features.
+ *----------------------------------------------------------------------------*/
+void initMap(VectorMap *m)
+{
+    memset(m, 0, sizeof(VectorMap));
+}
+
+static void freeMapLevels(VectorMap *m)
+{
+    for (int k = 0; k < MAP_LEVELS; ++k) {
+        free(m->levels[k].start);
+        free(m->levels[k].count);
+        free(m->levels[k].pool);
+    }
+    memset(m->levels, 0, sizeof(m->levels));
+}
+
+void freeMap(VectorMap *m)
+{
+    freeMapLevels(m);
+    free(m->xy);
+    free(m->features);
+    free(m->nodes);
+    free(m->keep);
+    free(m->stack);
+    initMap(m);
+}
+
+/*----------------------------------------------------------------------------
+ * addMapFeature
+ *
+ * Add a polyline of n vertices, given as x, y pairs. buildMap has to be
+ * called before the map is drawn again.
+ *----------------------------------------------------------------------------*/
+void addMapFeature(VectorMap *m, const float *xy, int n)
+{
+    if (n < 1)
+        return;
+
+    if (m->nfeatures == m->featureCap) {
+        m->featureCap = m->featureCap ? m->featureCap * 2 : 256;
+        m->features = (MapItem *)realloc(m->features, m->featureCap * sizeof(MapItem));
+    }
+    if (m->nvertices + n > m->vertexCap) {
+        while (m->nvertices + n > m->vertexCap)
+            m->vertexCap = m->vertexCap ? m->vertexCap * 2 : 4096;
+        m->xy = (float *)realloc(m->xy, m->vertexCap * 2 * sizeof(float));
+    }
+
+    MapItem *f = &m->features[m->nfeatures++];
+    f->first = m->nvertices;
+    f->count = n;
+    f->leaf = 0;
+    f->x0 = f->x1 = xy[0];
+    f->y0 = f->y1 = xy[1];
+    for (int i = 0; i < n; ++i) {
+        float x = xy[i * 2], y = xy[i * 2 + 1];
+        f->x0 = (x < f->x0) ? x : f->x0;
+        f->x1 = (x > f->x1) ? x : f->x1;
+        f->y0 = (y < f->y0) ? y : f->y0;
+        f->y1 = (y > f->y1) ? y : f->y1;
+    }
+
+    memcpy(m->xy + m->nvertices * 2, xy, n * 2 * sizeof(float));
+    m->nvertices += n;
+}
+
+/*----------------------------------------------------------------------------
+ * compareItemsX, compareItemsY, tileItems
+ *
+ * Sort-tile-recursive order: sort by the centres' x, cut into vertical
+ * slices of about the square root of the number of nodes to be made, and
+ * sort each slice by y, so that every run of MAP_NODE_SIZE items is close
+ * together in both directions.
+ *----------------------------------------------------------------------------*/
+static int compareItemsX(const void *a, const void *b)
+{
+    float ca = ((const MapItem *)a)->x0 + ((const MapItem *)a)->x1;
+    float cb = ((const MapItem *)b)->x0 + ((const MapItem *)b)->x1;
+    return (ca > cb) - (ca < cb);
+}
+
+static int compareItemsY(const void *a, const void *b)
+{
+    float ca = ((const MapItem *)a)->y0 + ((const MapItem *)a)->y1;
+    float cb = ((const MapItem *)b)->y0 + ((const MapItem *)b)->y1;
+    return (ca > cb) - (ca < cb);
+}
+
+static void tileItems(MapItem *items, int n)
+{
+    int nodes = (n + MAP_NODE_SIZE - 1) / MAP_NODE_SIZE;
+    int slices = (int)ceil(sqrt(nodes));
+    int slice = slices * MAP_NODE_SIZE;
+
+    qsort(items, n, sizeof(MapItem), compareItemsX);
+    for (int i = 0; i < n; i += slice)
+        qsort(items + i, (n - i < slice) ? n - i : slice, sizeof(MapItem), compareItemsY);
+}
+
+/*----------------------------------------------------------------------------
+ * buildMap
+ *
+ * Pack the R-tree over the features, a level at a time from the leaves up,
+ * each level's nodes following the last in one array so that the root ends
+ * up last. The features are put in leaf order, so a leaf covers a run of
+ * them, as every other node covers a run of the level below. Simplified
+ * features from before are dropped.
+ *----------------------------------------------------------------------------*/
+void buildMap(VectorMap *m)
+{
+    freeMapLevels(m);
+    free(m->nodes);
+    m->nodes = NULL;
+    m->nnodes = 0;
+    if (m->nfeatures == 0)
+        return;
+
+    tileItems(m->features, m->nfeatures);
+
+    /* No level has more than a node for every MAP_NODE_SIZE items below */
+    int cap = m->nfeatures / (MAP_NODE_SIZE - 1) + 2 * (int)(log(m->nfeatures + 1) / log(2)) + 2;
+    m->nodes = (MapItem *)malloc(cap * sizeof(MapItem));
+
+    MapItem *items = m->features;
+    int first = 0, n = m->nfeatures, leaf = 1;
+    while (1) {
+        int level = m->nnodes;
+        for (int i = 0; i < n; i += MAP_NODE_SIZE) {
+            MapItem *node = &m->nodes[m->nnodes++];
+            *node = items[i];
+            node->first = first + i;
+            node->count = (n - i < MAP_NODE_SIZE) ? n - i : MAP_NODE_SIZE;
+            node->leaf = leaf;
+            for (int j = i + 1; j < i + node->count; ++j) {
+                node->x0 = (items[j].x0 < node->x0) ? items[j].x0 : node->x0;
+                node->y0 = (items[j].y0 < node->y0) ? items[j].y0 : node->y0;
+                node->x1 = (items[j].x1 > node->x1) ? items[j].x1 : node->x1;
+                node->y1 = (items[j].y1 > node->y1) ? items[j].y1 : node->y1;
+            }
+        }
+        if (m->nnodes - level == 1)
+            break;
+        tileItems(m->nodes + level, m->nnodes - level);
+        items = m->nodes + level;
+        first = level;
+        n = m->nnodes - level;
+        leaf = 0;
+    }
+
+    MapItem *root = &m->nodes[m->nnodes - 1];
+    float size = (root->x1 - root->x0 > root->y1 - root->y0) ? root->x1 - root->x0 : root->y1 - root->y0;
+    m->tolerance = size / 65536;
+    if (m->tolerance <= 0)
+        m->tolerance = 1e-6f;
+}
+
+/*----------------------------------------------------------------------------
+ * loadMap, saveMap
+ *
+ * Return 0, or -1 if the file can't be read or written or isn't a map.
+ *----------------------------------------------------------------------------*/
+int loadMap(VectorMap *m, const char *filename)
+{
+    unsigned int head[2];
+    char magic[8];
+    struct stat st;
+
+    FILE *fp = fopen(filename, "rb");
+    if (!fp)
+        return -1;
+    if (fread(magic, 1, 8, fp) != 8 || memcmp(magic, "LOUISMP1", 8) || fread(head, 4, 2, fp) != 2 ||
+        fstat(fileno(fp), &st) < 0) {
+        fclose(fp);
+        return -1;
+    }
+
+    /* Believe the counts in the header only if the file is big enough to
+     * hold them */
+    if ((size_t)head[0] * 4 + (size_t)head[1] * 8 > (size_t)st.st_size - 16) {
+        fclose(fp);
+        return -1;
+    }
+
+    unsigned int *counts = (unsigned int *)malloc(((size_t)head[0] + 1) * sizeof(unsigned int));
+    float *xy = (float *)malloc(((size_t)head[1] + 1) * 2 * sizeof(float));
+    int ok = fread(counts, 4, head[0], fp) == head[0] && fread(xy, 8, head[1], fp) == head[1];
+    fclose(fp);
+
+    long total = 0;
+    for (unsigned int i = 0; ok && i < head[0]; ++i)
+        total += counts[i];
+    ok = ok && total == (long)head[1];
+
+    initMap(m);
+    if (ok) {
+        m->vertexCap = head[1];
+        m->xy = (float *)malloc(m->vertexCap * 2 * sizeof(float));
+        for (unsigned int i = 0, v = 0; i < head[0]; v += counts[i++])
+            addMapFeature(m, xy + (size_t)v * 2, counts[i]);
+        buildMap(m);
+    }
+    free(counts);
+    free(xy);
+
+    return ok ? 0 : -1;
+}
+
+int saveMap(VectorMap *m, const char *filename)
+{
+    unsigned int head[2] = {m->nfeatures, m->nvertices};
+
+    FILE *fp = fopen(filename, "wb");
+    if (!fp)
+        return -1;
+
+    int ok = fwrite("LOUISMP1", 1, 8, fp) == 8 && fwrite(head, 4, 2, fp) == 2;
+    for (int i = 0; ok && i < m->nfeatures; ++i) {
+        unsigned int n = m->features[i].count;
+        ok = fwrite(&n, 4, 1, fp) == 1;
+    }
+    for (int i = 0; ok && i < m->nfeatures; ++i)
+        ok = fwrite(m->xy + (size_t)m->features[i].first * 2, 8, m->features[i].count, fp) ==
+             (size_t)m->features[i].count;
+
+    return (fclose(fp) == 0 && ok) ? 0 : -1;
+}
+
+/*----------------------------------------------------------------------------
+ * simplifyFeature
+ *
+ * Return the vertices of feature i that are kept at zoom level k, found the
+ * first time they are asked for with the Douglas-Peucker method: starting
+ * from the two ends, the vertex furthest from the segment between a pair of
+ * kept ones is kept too if it is further than the tolerance, and the two
+ * halves are done the same way. The halves still to do are kept on a stack
+ * rather than recursing, as a feature can be long.
+ *----------------------------------------------------------------------------*/
+static const int *simplifyFeature(VectorMap *m, int i, int k, int *count)
+{
+    MapLevel *l = &m->levels[k];
+    MapItem *f = &m->features[i];
+
+    if (!l->start) {
+        l->start = (int *)malloc(m->nfeatures * sizeof(int));
+        l->count = (int *)malloc(m->nfeatures * sizeof(int));
+        memset(l->start, -1, m->nfeatures * sizeof(int));
+    }
+    if (l->start[i] >= 0) {
+        *count = l->count[i];
+        return l->pool + l->start[i];
+    }
+
+    if (f->count > m->scratch) {
+        m->scratch = f->count;
+        m->keep = (unsigned char *)realloc(m->keep, m->scratch);
+        m->stack = (int *)realloc(m->stack, m->scratch * 2 * sizeof(int));
+    }
+
+    const float *v = m->xy + (size_t)f->first * 2;
+    float tol = m->tolerance * (1 << k), tol2 = tol * tol;
+    int n = f->count, top = 0;
+
+    memset(m->keep, 0, n);
+    m->keep[0] = m->keep[n - 1] = 1;
+    if (n > 2) {
+        m->stack[top++] = 0;
+        m->stack[top++] = n - 1;
+    }
+    while (top > 0) {
+        int b = m->stack[--top], a = m->stack[--top];
+        float ax = v[a * 2], ay = v[a * 2 + 1];
+        float dx = v[b * 2] - ax, dy = v[b * 2 + 1] - ay;
+        float len2 = dx * dx + dy * dy;
+        float worst = 0;
+        int far = -1;
+
+        for (int j = a + 1; j < b; ++j) {
+            float px = v[j * 2] - ax, py = v[j * 2 + 1] - ay;
+            float cross = px * dy - py * dx;
+            /* Closed outlines start and end at the same place */
+            float d2 = (len2 > 0) ? cross * cross / len2 : px * px + py * py;
+            if (d2 > worst) {
+                worst = d2;
+                far = j;
+            }
+        }
+        if (far < 0 || worst <= tol2)
+            continue;
+
+        m->keep[far] = 1;
+        m->stack[top++] = a;
+        m->stack[top++] = far;
+        m->stack[top++] = far;
+        m->stack[top++] = b;
+    }
+
+    int kept = 0;
+    for (int j = 0; j < n; ++j)
+        kept += m->keep[j];
+    if (l->used + kept > l->cap) {
+        while (l->used + kept > l->cap)
+            l->cap = l->cap ? l->cap * 2 : 4096;
+        l->pool = (int *)realloc(l->pool, l->cap * sizeof(int));
+    }
+
+    l->start[i] = l->used;
+    l->count[i] = kept;
+    for (int j = 0; j < n; ++j)
+        if (m->keep[j])
+            l->pool[l->used++] = j;
+
+    *count = kept;
+    return l->pool + l->start[i];
+}
+
+/*----------------------------------------------------------------------------
+ * drawMap
+ *
+ * Draw the part of a map around cx, cy in world coordinates, at scale dots
+ * to a world unit, in the w by h block of dots with its lower left corner
+ * at x, y. At less than full detail, lines are simplified to within a dot
+ * or more rather than half a dot. Return the number of segments drawn.
+ *----------------------------------------------------------------------------*/
+long drawMap(Surface *s, VectorMap *m, int x, int y, int w, int h, float cx, float cy, float scale)
+{
+    int stack[64 * MAP_NODE_SIZE];
+    long segments = 0;
+    int top = 0;
+
+    if (m->nnodes == 0 || scale <= 0)
+        return 0;
+
+    float vx0 = cx - w / 2.0f / scale, vy0 = cy - h / 2.0f / scale;
+    float vx1 = cx + w / 2.0f / scale, vy1 = cy + h / 2.0f / scale;
+
+    /* Clip to the points drawPoint rounds into the block. At 0 that starts
+     * from -1.5, since drawPoint rounds towards 0. */
+    float bx0 = ((x > 0) ? x - 0.5f : -1.5f) + CLIP_EDGE, by0 = ((y > 0) ? y - 0.5f : -1.5f) + CLIP_EDGE;
+    float bx1 = x + w - 0.5f - CLIP_EDGE, by1 = y + h - 0.5f - CLIP_EDGE;
+
+    /* The coarsest level whose tolerance is still within half a dot */
+    int k = -1;
+    while (k + 1 < MAP_LEVELS && m->tolerance * (1 << (k + 1)) <= 0.5f / scale / frameDetail())
+        ++k;
+
+    pushTransform();
+    resetTransform();
+
+    stack[top++] = m->nnodes - 1;
+    while (top > 0) {
+        MapItem *node = &m->nodes[stack[--top]];
+        if (node->x1 < vx0 || node->x0 > vx1 || node->y1 < vy0 || node->y0 > vy1)
+            continue;
+
+        if (!node->leaf) {
+            for (int i = node->count - 1; i >= 0; --i)
+                stack[top++] = node->first + i;
+            continue;
+        }
+
+        for (int i = node->first; i < node->first + node->count; ++i) {
+            MapItem *f = &m->features[i];
+            if (f->x1 < vx0 || f->x0 > vx1 || f->y1 < vy0 || f->y0 > vy1)
+                continue;
+
+            const float *v = m->xy + (size_t)f->first * 2;
+            if ((f->x1 - f->x0) * scale < 1 && (f->y1 - f->y0) * scale < 1) {
+                drawPoint(s, x + (v[0] - vx0) * scale, y + (v[1] - vy0) * scale, 1);
+                continue;
+            }
+
+            int n = f->count;
+            const int *kept = (k >= 0) ? simplifyFeature(m, i, k, &n) : NULL;
+            float px = x + (v[(kept ? kept[0] : 0) * 2] - vx0) * scale;
+            float py = y + (v[(kept ? kept[0] : 0) * 2 + 1] - vy0) * scale;
+
+            for (int j = 1; j < n; ++j) {
+                int at = kept ? kept[j] : j;
+                float qx = x + (v[at * 2] - vx0) * scale, qy = y + (v[at * 2 + 1] - vy0) * scale;
+                segments += drawClippedLine(s, px, py, qx, qy, bx0, by0, bx1, by1);
+                px = qx;
+                py = qy;
+            }
+        }
+    }
+
+    popTransform();
+
+    return segments;
+}
+
+/*----------------------------------------------------------------------------
+ * Sample files
+ *
+ * A SampleFile is a file of raw float samples, such as those recorded in a
+ * load test, mapped into memory rather than read, so that it opens at once
+ * however large it is. To draw the samples at any zoom, a column of dots
+ * shows the least and greatest of the samples it covers. These come from a
+ * pyramid of minima and maxima, whose first level holds one pair for every
+ * SAMPLE_BLOCK samples and each level after one for every SAMPLE_FANOUT pairs
+ * of the level below, so a column is found from a handful of pairs.
+ *
+ * The pyramid is built by a thread of its own while the file is on the
+ * screen. It first reads a block at the start of each of SAMPLE_OVERVIEW
+ * stretches of the file, which gives a rough picture after reading only a
+ * few megabytes. These are read every 64th first, then every 8th, so that
+ * the rough picture spans the whole file almost at once. The thread then
+ * goes through the whole file in order, handing over each level a piece at
+ * a time. Columns are drawn from the finest level ready for them, from the
+ * samples themselves when zoomed in far enough, and from the rough picture
+ * otherwise, when they are drawn dotted.
+ *----------------------------------------------------------------------------*/
+#define SAMPLE_BLOCK 1024
+#define SAMPLE_FANOUT 8
+#define SAMPLE_LEVELS 16
+#define SAMPLE_OVERVIEW 4096
+#define SAMPLE_PUBLISH 256
+
+typedef struct SampleFile {
+    const float *samples;
+    long count;
+    size_t mapped;
+    float *min[SAMPLE_LEVELS];
+    float *max[SAMPLE_LEVELS];
+    long size[SAMPLE_LEVELS];
+    long span[SAMPLE_LEVELS];
+    atomic_long built[SAMPLE_LEVELS];
+    int levels;
+    float *overviewMin;
+    float *overviewMax;
+    atomic_uchar *overviewReady;
+    long overviewSpan;
+    int overviewSize;
+    pthread_t thread;
+    atomic_int quit;
+} SampleFile;
+
+/*----------------------------------------------------------------------------
+ * publishLevels
+ *
+ * Hand over the first done pairs of the first level, and fold them into the
+ * levels above as far as they go. Only whole groups are folded until the
+ * level below is complete.
+ *----------------------------------------------------------------------------*/
+static void publishLevels(SampleFile *sf, long done)
+{
+    atomic_store_explicit(&sf->built[0], done, memory_order_release);
+
+    for (int k = 1; k < sf->levels; ++k) {
+        done = (done == sf->size[k - 1]) ? sf->size[k] : done / SAMPLE_FANOUT;
+        for (long e = atomic_load_explicit(&sf->built[k], memory_order_relaxed); e < done; ++e) {
+            long first = e * SAMPLE_FANOUT;
+            int n = (sf->size[k - 1] - first < SAMPLE_FANOUT) ? sf->size[k - 1] - first : SAMPLE_FANOUT;
+            float lo = 1e30f, hi = -1e30f, unused0 = 1e30f, unused1 = -1e30f;
+            kernels.minMax(sf->min[k - 1] + first, n, &lo, &unused1);
+            kernels.minMax(sf->max[k - 1] + first, n, &unused0, &hi);
+            sf->min[k][e] = lo;
+            sf->max[k][e] = hi;
+        }
+        atomic_store_explicit(&sf->built[k], done, memory_order_release);
+    }
+}
+
+/*----------------------------------------------------------------------------
+ * sampleBuilder
+ *
+ * Build the rough picture and then the pyramid. The kernel is told how the
+ * file is about to be read each time, so that the scattered blocks of the
+ * rough picture don't each pull in a long read-ahead.
+ *----------------------------------------------------------------------------*/
+static void *sampleBuilder(void *arg)
+{
+    SampleFile *sf = (SampleFile *)arg;
+
+    madvise((void *)sf->samples, sf->mapped, MADV_RANDOM);
+    for (int stride = 64; stride > 0; stride /= 8) {
+        for (int i = 0; i < sf->overviewSize; i += stride) {
+            if (stride < 64 && i % (stride * 8) == 0)
+                continue;
+            if (atomic_load_explicit(&sf->quit, memory_order_relaxed))
+                return NULL;
+            long first = i * sf->overviewSpan;
+            int n = (sf->count - first < SAMPLE_BLOCK) ? sf->count - first : SAMPLE_BLOCK;
+            float lo = 1e30f, hi = -1e30f;
+            kernels.minMax(sf->samples + first, n, &lo, &hi);
+            sf->overviewMin[i] = lo;
+            sf->overviewMax[i] = hi;
+            atomic_store_explicit(&sf->overviewReady[i], 1, memory_order_release);
+        }
+    }
+
+    madvise((void *)sf->samples, sf->mapped, MADV_SEQUENTIAL);
+    for (long j = 0; j < sf->size[0]; ++j) {
+        long first = j * SAMPLE_BLOCK;
+        int n = (sf->count - first < SAMPLE_BLOCK) ? sf->count - first : SAMPLE_BLOCK;
+        float lo = 1e30f, hi = -1e30f;
+        kernels.minMax(sf->samples + first, n, &lo, &hi);
+        sf->min[0][j] = lo;
+        sf->max[0][j] = hi;
+        if ((j + 1) % SAMPLE_PUBLISH == 0 || j + 1 == sf->size[0]) {
+            if (atomic_load_explicit(&sf->quit, memory_order_relaxed))
+                return NULL;
+            publishLevels(sf, j + 1);
+        }
+    }
+    madvise((void *)sf->samples, sf->mapped, MADV_NORMAL);
+
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------
+ * openSampleFile, closeSampleFile
+ *
+ * Map a file of floats in the machine's byte order and start building its
+ * pyramid, with the kernels picked by initLouis. Return 0, or -1 with errno
+ * set if it can't be mapped, if it holds no samples, or if the thread can't
+ * be started.
+ *----------------------------------------------------------------------------*/
+static void releaseSampleFile(SampleFile *sf)
+{
+    for (int k = 0; k < sf->levels; ++k)
+        free(sf->min[k]);
+    free(sf->overviewMin);
+    free(sf->overviewReady);
+    munmap((void *)sf->samples, sf->mapped);
+    memset(sf, 0, sizeof(SampleFile));
+}
+
+int openSampleFile(SampleFile *sf, const char *filename)
+{
+    struct stat st;
+
+    memset(sf, 0, sizeof(SampleFile));
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+    if (st.st_size < (off_t)sizeof(float)) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    sf->mapped = st.st_size;
+    void *p = mmap(NULL, sf->mapped, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return -1;
+    sf->samples = (const float *)p;
+    sf->count = st.st_size / sizeof(float);
+
+    long size = (sf->count + SAMPLE_BLOCK - 1) / SAMPLE_BLOCK, span = SAMPLE_BLOCK;
+    for (sf->levels = 0; sf->levels < SAMPLE_LEVELS; ++sf->levels) {
+        sf->size[sf->levels] = size;
+        sf->span[sf->levels] = span;
+        sf->min[sf->levels] = (float *)malloc(size * 2 * sizeof(float));
+        sf->max[sf->levels] = sf->min[sf->levels] + size;
+        if (size == 1)
+            break;
+        size = (size + SAMPLE_FANOUT - 1) / SAMPLE_FANOUT;
+        span *= SAMPLE_FANOUT;
+    }
+    if (sf->levels < SAMPLE_LEVELS)
+        ++sf->levels;
+
+    sf->overviewSpan = (sf->count + SAMPLE_OVERVIEW - 1) / SAMPLE_OVERVIEW;
+    sf->overviewSize = (sf->count + sf->overviewSpan - 1) / sf->overviewSpan;
+    sf->overviewMin = (float *)malloc(sf->overviewSize * 2 * sizeof(float));
+    sf->overviewMax = sf->overviewMin + sf->overviewSize;
+    sf->overviewReady = (atomic_uchar *)calloc(sf->overviewSize, sizeof(atomic_uchar));
+
+    int err = pthread_create(&sf->thread, NULL, sampleBuilder, sf);
+    if (err) {
+        releaseSampleFile(sf);
+        errno = err;
+        return -1;
+    }
+
+    return 0;
+}
+
+void closeSampleFile(SampleFile *sf)
+{
+    atomic_store(&sf->quit, 1);
+    pthread_join(sf->thread, NULL);
+    releaseSampleFile(sf);
+}
+
+/*----------------------------------------------------------------------------
+ * sampleProgress
+ *
+ * Return how much of the file the pyramid covers so far, from 0 to 1.
+ *----------------------------------------------------------------------------*/
+float sampleProgress(SampleFile *sf)
+{
+    return (float)atomic_load_explicit(&sf->built[0], memory_order_acquire) / sf->size[0];
+}
+
+/*----------------------------------------------------------------------------
+ * sampleColumns
+ *
+ * Find the least and greatest of the samples each of w columns covers, when
+ * they span samples first to first + count. A column is given pairs from the
+ * coarsest level with at least four to a column, so that it takes in little
+ * of its neighbours, or from a finer level if that one isn't ready for it.
+ * Columns left to the rough picture are marked in rough, and columns that
+ * nothing is known about yet are given NAN. Return the number of columns
+ * left to the rough picture.
+ *----------------------------------------------------------------------------*/
+#define SAMPLE_MAX_PAIRS 65536
+
+static int pairRange(const float *min, const float *max, long e0, long e1, long ready, float *lo, float *hi)
+{
+    float unused0 = 1e30f, unused1 = -1e30f;
+
+    if (e1 - e0 > SAMPLE_MAX_PAIRS || ready < e1)
+        return 0;
+    *lo = 1e30f;
+    *hi = -1e30f;
+    kernels.minMax(min + e0, e1 - e0, lo, &unused1);
+    kernels.minMax(max + e0, e1 - e0, &unused0, hi);
+
+    return 1;
+}
+
+int sampleColumns(SampleFile *sf, long first, long count, float *min, float *max, unsigned char *rough, int w)
+{
+    int nrough = 0;
+
+    for (int c = 0; c < w; ++c) {
+        long a = first + count * c / w, b = first + count * (c + 1) / w;
+        if (b <= a)
+            b = a + 1;
+        rough[c] = 0;
+        min[c] = max[c] = NAN;
+        if (a < 0 || b > sf->count)
+            continue;
+
+        /* Close in, the samples themselves are as quick as the pyramid */
+        if (b - a < SAMPLE_BLOCK * 4) {
+            min[c] = 1e30f;
+            max[c] = -1e30f;
+            kernels.minMax(sf->samples + a, b - a, &min[c], &max[c]);
+            continue;
+        }
+
+        int k = 0;
+        while (k + 1 < sf->levels && sf->span[k + 1] * 4 <= b - a)
+            ++k;
+        for (; k >= 0; --k) {
+            long e0 = a / sf->span[k], e1 = (b + sf->span[k] - 1) / sf->span[k];
+            long ready = atomic_load_explicit(&sf->built[k], memory_order_acquire);
+            if (pairRange(sf->min[k], sf->max[k], e0, e1, ready, &min[c], &max[c]))
+                break;
+        }
+        if (k >= 0)
+            continue;
+
+        /* Whichever blocks of the rough picture are in yet */
+        long o0 = a / sf->overviewSpan, o1 = (b + sf->overviewSpan - 1) / sf->overviewSpan;
+        min[c] = 1e30f;
+        max[c] = -1e30f;
+        for (long o = o0; o < o1 && o - o0 < SAMPLE_MAX_PAIRS; ++o) {
+            if (!atomic_load_explicit(&sf->overviewReady[o], memory_order_acquire))
+                continue;
+            min[c] = (sf->overviewMin[o] < min[c]) ? sf->overviewMin[o] : min[c];
+            max[c] = (sf->overviewMax[o] > max[c]) ? sf->overviewMax[o] : max[c];
+        }
+        if (min[c] <= max[c]) {
+            rough[c] = 1;
+            ++nrough;
+        } else {
+            min[c] = max[c] = NAN;
+        }
+    }
+
+    return nrough;
+}
+
+/*----------------------------------------------------------------------------
+ * drawSamples
+ *
+ * Draw samples first to first + count of a SampleFile in the block of dots
+ * from x, y that is w wide and h high, scaled to fit, as a line a column
+ * wide from the least to the greatest sample of each column. Columns drawn
+ * from the rough picture are dotted. Return the number of them, so that the
+ * caller knows to draw again once the pyramid has caught up.
+ *----------------------------------------------------------------------------*/
+int drawSamples(Surface *s, SampleFile *sf, long first, long count, int x, int y, int w, int h)
+{
+    float *min = (float *)malloc(w * 2 * sizeof(float));
+    float *max = min + w;
+    unsigned char *rough = (unsigned char *)malloc(w);
+    int nrough = sampleColumns(sf, first, count, min, max, rough, w);
+
+    float lo = 1e30f, hi = -1e30f;
+    for (int c = 0; c < w; ++c) {
+        if (max[c] != max[c])
+            continue;
+        lo = (min[c] < lo) ? min[c] : lo;
+        hi = (max[c] > hi) ? max[c] : hi;
+    }
+    if (hi <= lo)
+        hi = lo + 1.0f;
+
+    pushTransform();
+    resetTransform();
+
+    float scale = (h - 1) / (hi - lo);
+    int prev = 0, prevLo = 0, prevHi = 0;
+    for (int c = 0; c < w && lo < 1e30f; ++c) {
+        if (max[c] != max[c]) {
+            prev = 0;
+            continue;
+        }
+        int y0 = (min[c] - lo) * scale, y1 = (max[c] - lo) * scale;
+        int top = y1, bottom = y0;
+
+        /* Reach back to the last column so that steep steps stay joined */
+        if (prev && bottom > prevHi)
+            bottom = prevHi;
+        if (prev && top < prevLo)
+            top = prevLo;
+
+        if (rough[c]) {
+            for (int i = bottom & ~1; i <= top; i += 2)
+                drawPoint(s, x + c, y + i, 1);
+        } else {
+            drawRect(s, x + c, y + bottom, 1, top - bottom + 1, 1);
+        }
+        prev = 1;
+        prevLo = y0;
+        prevHi = y1;
+    }
+
+    popTransform();
+    free(min);
+    free(rough);
+
+    return nrough;
+}
+
+/*----------------------------------------------------------------------------
+ * Tweens
+ *
+ * A tween moves a float from one value to another over some time, along an
+ * easing curve, starting after a delay so that tweens can be lined up into
+ * timelines. Each tween writes to a float owned by the program, such as a
+ * position or a curve coefficient, and thousands of them are advanced
+ * together by one call to updateTweens per frame.
+ *
+ * Tweens are kept as structures of arrays, one set for each easing curve, so
+ * that the curve is fixed inside the update loop and the compiler vectorizes
+ * it. The loop computes every value into an array first, and only then are
+ * the values stored to their targets, a tween that hasn't started yet
+ * leaving its target alone. Tweens that have finished are then removed by
+ * moving the last one into their place, and their ids are kept in done until
+ * the next update so the program can react to them.
+ *----------------------------------------------------------------------------*/
+enum {EASE_LINEAR, EASE_IN, EASE_OUT, EASE_IN_OUT, EASE_SINE, EASE_COUNT};
+
+typedef struct TweenGroup {
+    float *from;
+    float *to;
+    float *start;
+    float *duration;
+    float *value;
+    float **target;
+    int *ids;
+    int count;
+    int cap;
+} TweenGroup;
+
+typedef struct Tweens {
+    TweenGroup groups[EASE_COUNT];
+    float time;
+    int nextId;
+    int *done;
+    int ndone;
+    int doneCap;
+} Tweens;
+
+/*----------------------------------------------------------------------------
+ * initTweens, freeTweens
+ *
+ * Set up an empty set of tweens, and release it.
+ *----------------------------------------------------------------------------*/
+void initTweens(Tweens *tw)
+{
+    memset(tw, 0, sizeof(Tweens));
+    tw->nextId = 1;
+}
+
+void freeTweens(Tweens *tw)
+{
+    for (int e = 0; e < EASE_COUNT; ++e) {
+        TweenGroup *g = &tw->groups[e];
+        free(g->from);
+        free(g->to);
+        free(g->start);
+        free(g->duration);
+        free(g->value);
+        free(g->target);
+        free(g->ids);
+    }
+    free(tw->done);
+    memset(tw, 0, sizeof(Tweens));
+}
+
+/*----------------------------------------------------------------------------
+ * addTween
+ *
+ * Move *target from one value to another over duration seconds, starting
+ * delay seconds from now, along one of the easing curves. Return the id the
+ * tween will be reported by when it finishes.
+ *----------------------------------------------------------------------------*/
+int addTween(Tweens *tw, float *target, float from, float to, float delay, float duration, int easing)
+{
+    TweenGroup *g = &tw->groups[(easing >= 0 && easing < EASE_COUNT) ? easing : EASE_LINEAR];
+
+    if (g->count == g->cap) {
+        g->cap = g->cap ? g->cap * 2 : 64;
+        g->from = (float *)realloc(g->from, g->cap * sizeof(float));
+        g->to = (float *)realloc(g->to, g->cap * sizeof(float));
+        g->start = (float *)realloc(g->start, g->cap * sizeof(float));
+        g->duration = (float *)realloc(g->duration, g->cap * sizeof(float));
+        g->value = (float *)realloc(g->value, g->cap * sizeof(float));
+        g->target = (float **)realloc(g->target, g->cap * sizeof(float *));
+        g->ids = (int *)realloc(g->ids, g->cap * sizeof(int));
+    }
+
+    int i = g->count++;
+    g->from[i] = from;
+    g->to[i] = to;
+    g->start[i] = tw->time + (delay > 0 ? delay : 0);
+    g->duration[i] = duration > 1e-6f ? duration : 1e-6f;
+    g->target[i] = target;
+    g->ids[i] = tw->nextId;
+
+    return tw->nextId++;
+}
+
+/*----------------------------------------------------------------------------
+ * cancelTweens
+ *
+ * Remove every tween that writes to target, leaving it where it is, for
+ * instance to send it somewhere else instead. Cancelled tweens aren't
+ * reported as done.
+ *----------------------------------------------------------------------------*/
+static void removeTween(TweenGroup *g, int i)
+{
+    int last = --g->count;
+
+    g->from[i] = g->from[last];
+    g->to[i] = g->to[last];
+    g->start[i] = g->start[last];
+    g->duration[i] = g->duration[last];
+    g->target[i] = g->target[last];
+    g->ids[i] = g->ids[last];
+}
+
+void cancelTweens(Tweens *tw, float *target)
+{
+    for (int e = 0; e < EASE_COUNT; ++e) {
+        TweenGroup *g = &tw->groups[e];
+        for (int i = 0; i < g->count;) {
+            if (g->target[i] == target)
+                removeTween(g, i);
+            else
+                ++i;
+        }
+    }
+}
+
+/*----------------------------------------------------------------------------
+ * easeGroup
+ *
+ * Compute the value of every tween in a group at time t. The loop body is
+ * kept free of branches so it vectorizes without relaxed floating point
+ * flags: progress is clamped to 0 to 1 with fabsf, the halves of the in-out
+ * curve are blended by a 0 or 1 weight, and the sine curve is sin squared
+ * from its Taylor series, good to 1e-4. updateTweens lands finished tweens
+ * exactly on their end values.
+ *----------------------------------------------------------------------------*/
+static inline __attribute__((always_inline))
+void easeGroup(TweenGroup *g, float t, int easing)
+{
+    float *__restrict value = g->value;
+    const float *__restrict from = g->from, *__restrict to = g->to;
+    const float *__restrict start = g->start, *__restrict duration = g->duration;
+
+    for (int i = 0; i < g->count; ++i) {
+        float p = (t - start[i]) / duration[i];
+        p = 0.5f * (p + fabsf(p));
+        float q = 1.0f - p;
+        q = 0.5f * (q + fabsf(q));
+        p = 1.0f - q;
+
+        if (easing == EASE_IN) {
+            p = p * p * p;
+        } else if (easing == EASE_OUT) {
+            p = 1.0f - q * q * q;
+        } else if (easing == EASE_IN_OUT) {
+            float first = (float)(p < 0.5f);
+            p = first * 4.0f * p * p * p + (1.0f - first) * (1.0f - 4.0f * q * q * q);
+        } else if (easing == EASE_SINE) {
+            float x = p * 1.57079633f, x2 = x * x;
+            float sine = x * (1.0f - x2 / 6.0f * (1.0f - x2 / 20.0f * (1.0f - x2 / 42.0f)));
+            p = sine * sine;
+        }
+
+        value[i] = from[i] + (to[i] - from[i]) * p;
+    }
+}
+
+/*----------------------------------------------------------------------------
+ * updateTweens
+ *
+ * Advance time by dt seconds and move every started tween's target. Return
+ * the number of tweens that finished, whose ids are then in tw->done.
+ *----------------------------------------------------------------------------*/
+int updateTweens(Tweens *tw, float dt)
+{
+    float t = (tw->time += dt);
+
+    tw->ndone = 0;
+
+    for (int e = 0; e < EASE_COUNT; ++e) {
+        TweenGroup *g = &tw->groups[e];
+
+        switch (e) {
+        case EASE_LINEAR: easeGroup(g, t, EASE_LINEAR); break;
+        case EASE_IN: easeGroup(g, t, EASE_IN); break;
+        case EASE_OUT: easeGroup(g, t, EASE_OUT); break;
+        case EASE_IN_OUT: easeGroup(g, t, EASE_IN_OUT); break;
+        case EASE_SINE: easeGroup(g, t, EASE_SINE); break;
+        }
+
+        for (int i = 0; i < g->count; ++i)
+            if (t >= g->start[i])
+                *g->target[i] = g->value[i];
+
+        /* Retire what has finished */
+        for (int i = 0; i < g->count;) {
+            if (t < g->start[i] + g->duration[i]) {
+                ++i;
+                continue;
+            }
+            if (tw->ndone == tw->doneCap) {
+                tw->doneCap = tw->doneCap ? tw->doneCap * 2 : 64;
+                tw->done = (int *)realloc(tw->done, tw->doneCap * sizeof(int));
+            }
+            *g->target[i] = g->to[i];
+            tw->done[tw->ndone++] = g->ids[i];
+            removeTween(g, i);
+        }
+    }
+
+    return tw->ndone;
+}
+
+/*----------------------------------------------------------------------------
+ * tweenCount
+ *
+ * Return the number of tweens still running.
+ *----------------------------------------------------------------------------*/
+int tweenCount(Tweens *tw)
+{
+    int n = 0;
+    for (int e = 0; e < EASE_COUNT; ++e)
+        n += tw->groups[e].count;
+    return n;
+}
+
+/*----------------------------------------------------------------------------
+ * Scripts
+ *
+ * A script is a function that runs a little at a time, across frames, to
+ * drive something over a span of time: an entity in a game, or a scene in a
+ * demo. It is written straight through, and stops where it says to wait:
+ *
+ *     typedef struct Blinker { int on; } Blinker;
+ *
+ *     int blink(Script *sc)
+ *     {
+ *         Blinker *b = (Blinker *)sc->locals;
+ *
+ *         SCRIPT_BEGIN(sc);
+ *         while (1) {
+ *             b->on = !b->on;
+ *             WAIT_SECONDS(sc, 0.5);
+ *         }
+ *         SCRIPT_END(sc);
+ *     }
+ *
+ * NEXT_FRAME waits for the next call to runScripts, WAIT_SECONDS for some
+ * time to pass, and WAIT_UNTIL for a condition to hold, checked once a
+ * frame. The waits are made with a switch on the line number, so the
+ * function's own local variables don't keep their values across them, a
+ * script can't wait inside a switch of its own, and each wait needs a line
+ * to itself. Whatever has to be kept lives in sc->locals, which startScript
+ * fills in, and sc->arg is a pointer the script is given.
+ *
+ * Scripts live in blocks of SCRIPT_BLOCK that are never moved or freed until
+ * freeScripts, so starting and ending them doesn't allocate once the pool is
+ * big enough, and thousands can run without a thread each. A script waiting
+ * for the next frame is kept on a list, one waiting for time on a heap
+ * ordered by when it wakes, and one waiting for nothing isn't looked at.
+ *----------------------------------------------------------------------------*/
+#define SCRIPT_LOCALS 64
+#define SCRIPT_BLOCK 256
+
+enum {SCRIPT_DONE, SCRIPT_FRAME, SCRIPT_TIMER};
+
+typedef struct Script Script;
+typedef int (*ScriptFunc)(Script *sc);
+
+struct Script {
+    alignas(16) unsigned char locals[SCRIPT_LOCALS];
+    ScriptFunc func;
+    void *arg;
+    float wait;
+    int line;
+    int id;
+    int next;
+};
+
+#define SCRIPT_BEGIN(sc) switch ((sc)->line) { case 0:
+#define SCRIPT_END(sc) } return SCRIPT_DONE
+#define NEXT_FRAME(sc) \
+    do { (sc)->line = __LINE__; return SCRIPT_FRAME; case __LINE__:; } while (0)
+#define WAIT_SECONDS(sc, seconds) \
+    do { (sc)->line = __LINE__; (sc)->wait = (seconds); return SCRIPT_TIMER; case __LINE__:; } while (0)
+#define WAIT_UNTIL(sc, cond) \
+    do { (sc)->line = __LINE__; case __LINE__: if (!(cond)) return SCRIPT_FRAME; } while (0)
+
+typedef struct ScriptTimer {
+    float wake;
+    int slot;
+} ScriptTimer;
+
+typedef struct Scripts {
+    Script **blocks;
+    int nblocks;
+    int free;
+    int *ready;
+    int nready;
+    int readyCap;
+    int *later;
+    int nlater;
+    int laterCap;
+    ScriptTimer *timers;
+    int ntimers;
+    int timerCap;
+    float time;
+    int serial;
+    int count;
+} Scripts;
+
+/*----------------------------------------------------------------------------
+ * initScripts, freeScripts
+ *
+ * Set up an empty set of scripts, and release it with every script in it.
+ *----------------------------------------------------------------------------*/
+void initScripts(Scripts *ss)
+{
+    memset(ss, 0, sizeof(Scripts));
+    ss->free = -1;
+}
+
+void freeScripts(Scripts *ss)
+{
+    for (int i = 0; i < ss->nblocks; ++i)
+        free(ss->blocks[i]);
+    free(ss->blocks);
+    free(ss->ready);
+    free(ss->later);
+    free(ss->timers);
+    initScripts(ss);
+}
+
+/*----------------------------------------------------------------------------
+ * scriptAt, pushSlot, releaseScript
+ *
+ * Find a script by its slot, add a slot to a growing list, and give a
+ * script's slot back for reuse.
+ *----------------------------------------------------------------------------*/
+static Script *scriptAt(Scripts *ss, int slot)
+{
+    return &ss->blocks[slot / SCRIPT_BLOCK][slot % SCRIPT_BLOCK];
+}
+
+static void pushSlot(int **slots, int *n, int *cap, int slot)
+{
+    if (*n == *cap) {
+        *cap = *cap ? *cap * 2 : 256;
+        *slots = (int *)realloc(*slots, *cap * sizeof(int));
+    }
+    (*slots)[(*n)++] = slot;
+}
+
+static void releaseScript(Scripts *ss, int slot)
+{
+    Script *sc = scriptAt(ss, slot);
+
+    if (sc->func)
+        --ss->count;
+    sc->func = NULL;
+    sc->next = ss->free;
+    ss->free = slot;
+}
+
+/*----------------------------------------------------------------------------
+ * pushTimer, popTimer
+ *
+ * The sleeping scripts, kept as a binary heap with the first to wake on top.
+ *----------------------------------------------------------------------------*/
+static void pushTimer(Scripts *ss, float wake, int slot)
+{
+    if (ss->ntimers == ss->timerCap) {
+        ss->timerCap = ss->timerCap ? ss->timerCap * 2 : 256;
+        ss->timers = (ScriptTimer *)realloc(ss->timers, ss->timerCap * sizeof(ScriptTimer));
+    }
+
+    int i = ss->ntimers++;
+    while (i > 0 && ss->timers[(i - 1) / 2].wake > wake) {
+        ss->timers[i] = ss->timers[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    ss->timers[i].wake = wake;
+    ss->timers[i].slot = slot;
+}
+
+static int popTimer(Scripts *ss)
+{
+    int slot = ss->timers[0].slot;
+    ScriptTimer last = ss->timers[--ss->ntimers];
+    int i = 0;
+
+    while (2 * i + 1 < ss->ntimers) {
+        int child = 2 * i + 1;
+        if (child + 1 < ss->ntimers && ss->timers[child + 1].wake < ss->timers[child].wake)
+            ++child;
+        if (last.wake <= ss->timers[child].wake)
+            break;
+        ss->timers[i] = ss->timers[child];
+        i = child;
+    }
+    if (ss->ntimers > 0)
+        ss->timers[i] = last;
+
+    return slot;
+}
+
+/*----------------------------------------------------------------------------
+ * startScript
+ *
+ * Start func with a copy of size bytes of locals, up to SCRIPT_LOCALS, and
+ * arg. It first runs on the next call to runScripts. Return an id for
+ * stopScript, or -1 if the locals don't fit.
+ *----------------------------------------------------------------------------*/
+int startScript(Scripts *ss, ScriptFunc func, void *arg, const void *locals, int size)
+{
+    if (size < 0 || size > SCRIPT_LOCALS)
+        return -1;
+
+    if (ss->free < 0) {
+        ss->blocks = (Script **)realloc(ss->blocks, (ss->nblocks + 1) * sizeof(Script *));
+        ss->blocks[ss->nblocks] = (Script *)calloc(SCRIPT_BLOCK, sizeof(Script));
+        for (int i = SCRIPT_BLOCK - 1; i >= 0; --i) {
+            ss->blocks[ss->nblocks][i].next = ss->free;
+            ss->free = ss->nblocks * SCRIPT_BLOCK + i;
+        }
+        ++ss->nblocks;
+    }
+
+    int slot = ss->free;
+    Script *sc = scriptAt(ss, slot);
+
+    ss->free = sc->next;
+    memset(sc->locals, 0, SCRIPT_LOCALS);
+    if (locals)
+        memcpy(sc->locals, locals, size);
+    sc->func = func;
+    sc->arg = arg;
+    sc->line = 0;
+    /* The low bits find the slot, and the high ones tell its users apart */
+    sc->id = slot | (ss->serial++ & 0x7FF) << 20;
+    ++ss->count;
+    pushSlot(&ss->later, &ss->nlater, &ss->laterCap, slot);
+
+    return sc->id;
+}
+
+/*----------------------------------------------------------------------------
+ * stopScript
+ *
+ * End a script wherever it is waiting. Its slot is given back the next time
+ * it would have run.
+ *----------------------------------------------------------------------------*/
+void stopScript(Scripts *ss, int id)
+{
+    int slot = id & 0xFFFFF;
+
+    if (id < 0 || slot >= ss->nblocks * SCRIPT_BLOCK)
+        return;
+
+    Script *sc = scriptAt(ss, slot);
+    if (sc->func && sc->id == id) {
+        sc->func = NULL;
+        --ss->count;
+    }
+}
+
+/*----------------------------------------------------------------------------
+ * runScripts
+ *
+ * Advance time by dt seconds, and run every script waiting for this frame
+ * or for a time that has now come, each until it waits again. Scripts
+ * started meanwhile first run on the next frame. Return the number of
+ * scripts still going.
+ *----------------------------------------------------------------------------*/
+int runScripts(Scripts *ss, float dt)
+{
+    int *swap = ss->ready;
+    ss->ready = ss->later;
+    ss->later = swap;
+    ss->nready = ss->nlater;
+    ss->nlater = 0;
+    int cap = ss->readyCap;
+    ss->readyCap = ss->laterCap;
+    ss->laterCap = cap;
+
+    ss->time += dt;
+    while (ss->ntimers > 0 && ss->timers[0].wake <= ss->time)
+        pushSlot(&ss->ready, &ss->nready, &ss->readyCap, popTimer(ss));
+
+    for (int i = 0; i < ss->nready; ++i) {
+        int slot = ss->ready[i];
+        Script *sc = scriptAt(ss, slot);
+        int state = sc->func ? sc->func(sc) : SCRIPT_DONE;
+
+        /* A script may have been stopped by one that ran before it, or by
+         * itself */
+        if (!sc->func)
+            state = SCRIPT_DONE;
+
+        if (state == SCRIPT_FRAME)
+            pushSlot(&ss->later, &ss->nlater, &ss->laterCap, slot);
+        else if (state == SCRIPT_TIMER)
+            pushTimer(ss, ss->time + sc->wait, slot);
+        else
+            releaseScript(ss, slot);
+    }
+    ss->nready = 0;
+
+    return ss->count;
+}
+
+/*----------------------------------------------------------------------------
+ * loadBitmap
+ *
+ * Extract the bitmap data from a BMP file and put it in a buffer that can be
+ * passed to drawBitmap. Write 0xFFFFFF (white) as 0 and everything else as 1.
+ * In other words, the function expects two-value data, where white is
+ * interpreted as the image's transparent background and black is the solid
+ * foreground where braille dots are printed.
+ *----------------------------------------------------------------------------*/
+struct Surface loadBitmap(char *filename)
+{
+    FILE *fp;
+    Surface bitmap;
+    unsigned char r, g, b;
+    unsigned int pixel;
+    unsigned int dataOffset;
+
+    fp = fopen(filename, "r");
+
+    fseek(fp, 0L, SEEK_END);
+
+    int size = ftell(fp);
+    rewind(fp);
+
+    unsigned char *buf = (unsigned char *)malloc(sizeof(char) * size);
+
+    fread(buf, 1, size, fp);
+
+    fclose(fp);
+
+    /* Read the width, height, and data offset information from the bitmap
+     * file, converting from little-endian order. */
+    bitmap.width = littleToBigEndian(buf + 0x12);
+    bitmap.height = littleToBigEndian(buf + 0x16);
+    dataOffset = littleToBigEndian(buf + 0x0A);
+
+    bitmap.data = (unsigned char *)malloc(bitmap.width * bitmap.height);
+    unsigned char *bp = bitmap.data;
+
+    /* BMP data is "upside down" from a screen's perspective, but we leave it
+     * this way, because our drawPoint function writes data "upside down" too,
+     * in order to comply with the standard coordinate system employed in
+     * mathematics. */
+    for (int y = 0; y < bitmap.height; y++) {
+        for (int x = 0; x < bitmap.width; x++) {
+            int bufOffset = (y * bitmap.width) + x;
+            b = *(buf + dataOffset + (bufOffset * 3));
+            g = *(buf + dataOffset + (bufOffset * 3) + 1);
+            r = *(buf + dataOffset + (bufOffset * 3) + 2);
+            pixel = (r << 24) | (g << 16) | (b << 8);
+            *bp++ = pixel ? 0 : 1;
+        }
+    }
+
+    free(buf);
+
+    return bitmap;
+}
+
+
+/*----------------------------------------------------------------------------
+ * PNG decoding
+ *
+ * The decoder below reads a PNG file without any outside library. The zlib
+ * stream spread across the IDAT chunks is pulled through a small inflate
+ * implementation one byte at a time, and every decompressed scanline is
+ * unfiltered and turned into dots as soon as it is complete. Only the 64K
+ * sliding window and two scanlines are ever held in memory besides the
+ * finished bitmap, which has the same layout loadBitmap produces.
+ *----------------------------------------------------------------------------*/
+#define INFLATE_FAST_BITS 9
+#define INFLATE_WINDOW 0x10000
+
+/* Huffman codes are decoded from a table indexed by the next nine bits of
+ * input. Each entry packs the code length above the nine bits of the symbol.
+ * Longer codes, which are rare, fall back to walking the canonical code one
+ * bit at a time with the count and symbol arrays. */
+typedef struct Huffman {
+    unsigned short fast[1 << INFLATE_FAST_BITS];
+    unsigned short count[16];
+    unsigned short symbol[320];
+} Huffman;
+
+typedef struct PngDecoder {
+    FILE *fp;
+    int error;
+    int done;
+    unsigned int chunkLeft;
+    unsigned int bitBuf;
+    int bitCount;
+
+    unsigned char window[INFLATE_WINDOW];
+    unsigned int pos;
+    unsigned int flushed;
+    Huffman lit;
+    Huffman dist;
+
+    int width;
+    int height;
+    int depth;
+    int colorType;
+    int interlace;
+    int channels;
+    unsigned char palette[256][4];
+    int hasKey;
+    unsigned int key[3];
+
+    unsigned char *cur;
+    unsigned char *prev;
+    int bpp;
+    int rowBytes;
+    int rowPos;
+    int filter;
+    int row;
+    int pass;
+    int passWidth;
+    int passHeight;
+    Surface *out;
+} PngDecoder;
+
+static const unsigned short inflateLenBase[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const unsigned char inflateLenExtra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const unsigned short inflateDistBase[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289,
+    16385, 24577
+};
+static const unsigned char inflateDistExtra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+static const unsigned char inflateClenOrder[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+/* Adam7 pass origins and strides. A non-interlaced image is decoded as the
+ * last pass with both origins at 0 and both strides at 1. */
+static const unsigned char adam7X0[7] = {0, 4, 0, 2, 0, 1, 0};
+static const unsigned char adam7Y0[7] = {0, 0, 4, 0, 2, 0, 1};
+static const unsigned char adam7DX[7] = {8, 8, 4, 4, 2, 2, 1};
+static const unsigned char adam7DY[7] = {8, 8, 8, 4, 4, 2, 2};
+
+/*----------------------------------------------------------------------------
+ * pngByte, pngBits
+ *
+ * Fetch the next byte of the zlib stream, moving on to the following IDAT
+ * chunk when the current one runs out, and read bit fields from it in the
+ * least-significant-bit-first order deflate uses.
+ *----------------------------------------------------------------------------*/
+static int pngByte(PngDecoder *d)
+{
+    unsigned char hdr[12];
+
+    while (d->chunkLeft == 0) {
+        /* CRC of the finished chunk, then the next chunk's length and type */
+        if (d->error || fread(hdr, 1, 12, d->fp) != 12 || memcmp(hdr + 8, "IDAT", 4)) {
+            d->error = 1;
+            return 0;
+        }
+        d->chunkLeft = readBigEndian(hdr + 4);
+    }
+
+    int c = fgetc(d->fp);
+    if (c == EOF) {
+        d->error = 1;
+        return 0;
+    }
+    --d->chunkLeft;
+
+    return c;
+}
+
+static int pngBits(PngDecoder *d, int n)
+{
+    while (d->bitCount < n) {
+        d->bitBuf |= (unsigned int)pngByte(d) << d->bitCount;
+        d->bitCount += 8;
+    }
+
+    int v = d->bitBuf & ((1u << n) - 1);
+    d->bitBuf >>= n;
+    d->bitCount -= n;
+
+    return v;
+}
+
+/*----------------------------------------------------------------------------
+ * huffBuild, huffDecode
+ *
+ * Build the canonical Huffman decoding tables from a list of code lengths,
+ * and decode one symbol with them. huffBuild returns -1 if a length is over
+ * 15 or there are more codes of some length than can fit.
+ *----------------------------------------------------------------------------*/
+static int huffBuild(Huffman *h, const unsigned char *lengths, int n)
+{
+    unsigned short offs[16];
+    unsigned short next[16];
+    int code = 0, left = 1;
+
+    memset(h->count, 0, sizeof(h->count));
+    memset(h->fast, 0, sizeof(h->fast));
+    for (int i = 0; i < n; ++i) {
+        if (lengths[i] > 15)
+            return -1;
+        h->count[lengths[i]]++;
+    }
+    h->count[0] = 0;
+
+    /* Codes may be left unused, as deflate allows, but not oversubscribed */
+    for (int len = 1; len < 16; ++len) {
+        left = (left << 1) - h->count[len];
+        if (left < 0)
+            return -1;
+    }
+
+    offs[1] = 0;
+    for (int len = 1; len < 15; ++len)
+        offs[len + 1] = offs[len] + h->count[len];
+    for (int len = 1; len < 16; ++len) {
+        code = (code + h->count[len - 1]) << 1;
+        next[len] = code;
+    }
+
+    for (int sym = 0; sym < n; ++sym) {
+        int len = lengths[sym];
+        if (!len)
+            continue;
+        h->symbol[offs[len]++] = sym;
+
+        code = next[len]++;
+        if (len > INFLATE_FAST_BITS)
+            continue;
+
+        /* Deflate sends codes most-significant bit first, so the table is
+         * indexed by the reversed code, repeated for every bit pattern that
+         * could follow it. */
+        int rev = 0;
+        for (int i = 0; i < len; ++i)
+            rev |= ((code >> i) & 1) << (len - 1 - i);
+        for (int i = rev; i < (1 << INFLATE_FAST_BITS); i += 1 << len)
+            h->fast[i] = (len << 9) | sym;
+    }
+
+    return 0;
+}
+
+static int huffDecode(PngDecoder *d, Huffman *h)
+{
+    while (d->bitCount < INFLATE_FAST_BITS) {
+        d->bitBuf |= (unsigned int)pngByte(d) << d->bitCount;
+        d->bitCount += 8;
+    }
+
+    int e = h->fast[d->bitBuf & ((1 << INFLATE_FAST_BITS) - 1)];
+    if (e) {
+        d->bitBuf >>= e >> 9;
+        d->bitCount -= e >> 9;
+        return e & 0x1FF;
+    }
+
+    int code = 0, first = 0, index = 0;
+    for (int len = 1; len < 16; ++len) {
+        code |= pngBits(d, 1);
+        int count = h->count[len];
+        if (code - count < first)
+            return h->symbol[index + (code - first)];
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+
+    d->error = 1;
+    return 0;
+}
+
+/*----------------------------------------------------------------------------
+ * pngUnfilter, pngSample, pngDot, pngStartPass, pngRowDone, pngConsume
+ *
+ * Scanline handling. Decompressed bytes are gathered into the current row;
+ * when a row is complete it is unfiltered against the previous one and each
+ * of its pixels is written straight into the bitmap as a 0 or a 1, using the
+ * same rule as loadBitmap: white, or mostly transparent, is background.
+ *----------------------------------------------------------------------------*/
+static void pngUnfilter(PngDecoder *d)
+{
+    unsigned char *c = d->cur, *p = d->prev;
+    int bpp = d->bpp, n = d->rowBytes;
+
+    switch (d->filter) {
+    case 1:
+        for (int i = bpp; i < n; ++i)
+            c[i] += c[i - bpp];
+        break;
+    case 2:
+        for (int i = 0; i < n; ++i)
+            c[i] += p[i];
+        break;
+    case 3:
+        for (int i = 0; i < bpp; ++i)
+            c[i] += p[i] >> 1;
+        for (int i = bpp; i < n; ++i)
+            c[i] += (c[i - bpp] + p[i]) >> 1;
+        break;
+    case 4:
+        for (int i = 0; i < n; ++i) {
+            int a = (i >= bpp) ? c[i - bpp] : 0;
+            int b = p[i];
+            int cc = (i >= bpp) ? p[i - bpp] : 0;
+            int pa = abs(b - cc), pb = abs(a - cc), pc = abs(a + b - 2 * cc);
+            c[i] += (pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : cc;
+        }
+        break;
+    }
+}
+
+static unsigned int pngSample(PngDecoder *d, int k)
+{
+    int bit;
+
+    switch (d->depth) {
+    case 8:
+        return d->cur[k];
+    case 16:
+        return d->cur[k * 2] << 8 | d->cur[k * 2 + 1];
+    default:
+        bit = k * d->depth;
+        return (d->cur[bit >> 3] >> (8 - d->depth - (bit & 7))) & ((1 << d->depth) - 1);
+    }
+}
+
+static int pngDot(PngDecoder *d, int i)
+{
+    unsigned int maxv = (1u << d->depth) - 1;
+    unsigned int r, g, b, a;
+    unsigned char *pal;
+
+    switch (d->colorType) {
+    case 0:
+        g = pngSample(d, i);
+        if (d->hasKey && g == d->key[0])
+            return 0;
+        return g != maxv;
+    case 2:
+        r = pngSample(d, i * 3);
+        g = pngSample(d, i * 3 + 1);
+        b = pngSample(d, i * 3 + 2);
+        if (d->hasKey && r == d->key[0] && g == d->key[1] && b == d->key[2])
+            return 0;
+        return !(r == maxv && g == maxv && b == maxv);
+    case 3:
+        pal = d->palette[pngSample(d, i)];
+        if (pal[3] < 128)
+            return 0;
+        return !(pal[0] == 255 && pal[1] == 255 && pal[2] == 255);
+    case 4:
+        g = pngSample(d, i * 2);
+        a = pngSample(d, i * 2 + 1);
+        if (a <= maxv / 2)
+            return 0;
+        return g != maxv;
+    default:
+        r = pngSample(d, i * 4);
+        g = pngSample(d, i * 4 + 1);
+        b = pngSample(d, i * 4 + 2);
+        a = pngSample(d, i * 4 + 3);
+        if (a <= maxv / 2)
+            return 0;
+        return !(r == maxv && g == maxv && b == maxv);
+    }
+}
+
+static void pngStartPass(PngDecoder *d)
+{
+    for (; d->pass < 7; ++d->pass) {
+        int x0 = adam7X0[d->pass], y0 = adam7Y0[d->pass];
+        int dx = adam7DX[d->pass], dy = adam7DY[d->pass];
+        if (!d->interlace && d->pass < 6)
+            continue;
+        if (!d->interlace)
+            x0 = y0 = 0, dx = dy = 1;
+
+        d->passWidth = (d->width - x0 + dx - 1) / dx;
+        d->passHeight = (d->height - y0 + dy - 1) / dy;
+        if (d->passWidth <= 0 || d->passHeight <= 0)
+            continue;
+
+        d->rowBytes = (d->passWidth * d->channels * d->depth + 7) / 8;
+        d->rowPos = -1;
+        d->row = 0;
+        memset(d->prev, 0, d->rowBytes);
+        return;
+    }
+
+    d->done = 1;
+}
+
+static void pngRowDone(PngDecoder *d)
+{
+    Surface *out = d->out;
+    int x0 = 0, y0 = 0, dx = 1, dy = 1;
+    unsigned char *tmp;
+
+    if (d->interlace) {
+        x0 = adam7X0[d->pass];
+        y0 = adam7Y0[d->pass];
+        dx = adam7DX[d->pass];
+        dy = adam7DY[d->pass];
+    }
+
+    pngUnfilter(d);
+
+    /* PNG rows run top to bottom; store them bottom-up like BMP data. */
+    int y = y0 + d->row * dy;
+    unsigned char *bp = out->data + (out->height - 1 - y) * out->width;
+    for (int i = 0; i < d->passWidth; ++i)
+        bp[x0 + i * dx] = pngDot(d, i);
+
+    tmp = d->prev;
+    d->prev = d->cur;
+    d->cur = tmp;
+    d->rowPos = -1;
+
+    if (++d->row == d->passHeight) {
+        ++d->pass;
+        pngStartPass(d);
+    }
+}
+
+static void pngConsume(PngDecoder *d, const unsigned char *p, int n)
+{
+    while (n > 0 && !d->done) {
+        if (d->rowPos < 0) {
+            d->filter = *p++;
+            --n;
+            d->rowPos = 0;
+            if (d->filter > 4)
+                d->error = 1;
+            continue;
+        }
+
+        int take = d->rowBytes - d->rowPos;
+        if (take > n)
+            take = n;
+        memcpy(d->cur + d->rowPos, p, take);
+        d->rowPos += take;
+        p += take;
+        n -= take;
+
+        if (d->rowPos == d->rowBytes)
+            pngRowDone(d);
+    }
+}
+
+/*----------------------------------------------------------------------------
+ * inflateFlush, inflateStream
+ *
+ * Decompress the zlib stream. Output goes into a 64K ring that keeps the
+ * 32K of history deflate may refer back to; whenever at least 32K of it has
+ * not yet been seen by the scanline code, that part is handed over.
+ *----------------------------------------------------------------------------*/
+static void inflateFlush(PngDecoder *d)
+{
+    while (d->flushed != d->pos) {
+        unsigned int start = d->flushed & (INFLATE_WINDOW - 1);
+        unsigned int n = d->pos - d->flushed;
+        if (start + n > INFLATE_WINDOW)
+            n = INFLATE_WINDOW - start;
+        pngConsume(d, d->window + start, n);
+        d->flushed += n;
+    }
+}
+
+static int inflateStream(PngDecoder *d)
+{
+    unsigned char lengths[320] = {0};
+    int final;
+
+    /* zlib header: deflate method, no preset dictionary */
+    int cmf = pngBits(d, 8);
+    int flg = pngBits(d, 8);
+    if ((cmf & 0x0F) != 8 || (flg & 0x20) || ((cmf << 8) | flg) % 31)
+        return -1;
+
+    do {
+        final = pngBits(d, 1);
+        int type = pngBits(d, 2);
+
+        if (type == 0) {
+            /* Stored block: skip to a byte boundary and copy through */
+            pngBits(d, d->bitCount & 7);
+            int len = pngBits(d, 16);
+            int nlen = pngBits(d, 16);
+            if ((len ^ 0xFFFF) != nlen)
+                return -1;
+            while (len-- && !d->error)
+                d->window[d->pos++ & (INFLATE_WINDOW - 1)] = pngBits(d, 8);
+        } else if (type == 1 || type == 2) {
+            if (type == 1) {
+                /* Fixed codes */
+                memset(lengths, 8, 144);
+                memset(lengths + 144, 9, 112);
+                memset(lengths + 256, 7, 24);
+                memset(lengths + 280, 8, 8);
+                huffBuild(&d->lit, lengths, 288);
+                memset(lengths, 5, 30);
+                huffBuild(&d->dist, lengths, 30);
+            } else {
+                /* Dynamic codes, themselves described with a code-length
+                 * code */
+                int nlit = pngBits(d, 5) + 257;
+                int ndist = pngBits(d, 5) + 1;
+                int nclen = pngBits(d, 4) + 4;
+                memset(lengths, 0, 19);
+                for (int i = 0; i < nclen; ++i)
+                    lengths[inflateClenOrder[i]] = pngBits(d, 3);
+                if (huffBuild(&d->lit, lengths, 19) < 0)
+                    return -1;
+
+                for (int i = 0; i < nlit + ndist && !d->error;) {
+                    int sym = huffDecode(d, &d->lit);
+                    int rep, val = 0;
+                    if (sym < 16) {
+                        lengths[i++] = sym;
+                        continue;
+                    } else if (sym == 16) {
+                        if (i == 0)
+                            return -1;
+                        val = lengths[i - 1];
+                        rep = 3 + pngBits(d, 2);
+                    } else if (sym == 17) {
+                        rep = 3 + pngBits(d, 3);
+                    } else {
+                        rep = 11 + pngBits(d, 7);
+                    }
+                    if (i + rep > nlit + ndist)
+                        return -1;
+                    while (rep--)
+                        lengths[i++] = val;
+                }
+                if (d->error)
+                    return -1;
+                if (huffBuild(&d->lit, lengths, nlit) < 0 || huffBuild(&d->dist, lengths + nlit, ndist) < 0)
+                    return -1;
+            }
+
+            while (!d->error) {
+                int sym = huffDecode(d, &d->lit);
+                if (sym < 256) {
+                    d->window[d->pos++ & (INFLATE_WINDOW - 1)] = sym;
+                } else if (sym == 256) {
+                    break;
+                } else {
+                    sym -= 257;
+                    if (sym >= 29)
+                        return -1;
+                    int len = inflateLenBase[sym] + pngBits(d, inflateLenExtra[sym]);
+                    int dsym = huffDecode(d, &d->dist);
+                    if (dsym >= 30)
+                        return -1;
+                    unsigned int dist = inflateDistBase[dsym] + pngBits(d, inflateDistExtra[dsym]);
+                    if (dist > d->pos)
+                        return -1;
+                    while (len--) {
+                        d->window[d->pos & (INFLATE_WINDOW - 1)] =
+                            d->window[(d->pos - dist) & (INFLATE_WINDOW - 1)];
+                        ++d->pos;
+                    }
+                }
+                if (d->pos - d->flushed >= INFLATE_WINDOW / 2)
+                    inflateFlush(d);
+            }
+        } else {
+            return -1;
+        }
+
+        inflateFlush(d);
+    } while (!final && !d->error && !d->done);
+
+    return d->error ? -1 : 0;
+}
+
+/*----------------------------------------------------------------------------
+ * loadPNG
+ *
+ * Decode a PNG file into a buffer that can be passed to drawBitmap, just like
+ * loadBitmap does for BMP files. All color types, bit depths, and interlaced
+ * images are accepted. Pixels that are white or more than half transparent
+ * become 0 and all others 1. On failure the returned Surface has no data and
+ * a width and height of 0.
+ *----------------------------------------------------------------------------*/
+struct Surface loadPNG(char *filename)
+{
+    static const unsigned char signature[8] = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+    Surface bitmap = {NULL, 0, 0};
+    unsigned char hdr[8], buf[13];
+    PngDecoder *d;
+    int ok = 0;
+
+    FILE *fp = fopen(filename, "rb");
+    if (!fp)
+        return bitmap;
+
+    d = (PngDecoder *)calloc(1, sizeof(PngDecoder));
+    if (!d || fread(hdr, 1, 8, fp) != 8 || memcmp(hdr, signature, 8))
+        goto done;
+    d->fp = fp;
+    for (int i = 0; i < 256; ++i)
+        d->palette[i][3] = 255;
+
+    /* Walk the chunks up to the first IDAT */
+    while (fread(hdr, 1, 8, fp) == 8) {
+        unsigned int len = readBigEndian(hdr);
+
+        if (!memcmp(hdr + 4, "IHDR", 4)) {
+            if (len != 13 || fread(buf, 1, 13, fp) != 13)
+                goto done;
+            d->width = readBigEndian(buf);
+            d->height = readBigEndian(buf + 4);
+            d->depth = buf[8];
+            d->colorType = buf[9];
+            d->interlace = buf[12];
+            len = 0;
+        } else if (!memcmp(hdr + 4, "PLTE", 4)) {
+            for (unsigned int i = 0; i < len / 3 && i < 256; ++i) {
+                if (fread(d->palette[i], 1, 3, fp) != 3)
+                    goto done;
+            }
+            len -= (len / 3 < 256 ? len / 3 : 256) * 3;
+        } else if (!memcmp(hdr + 4, "tRNS", 4)) {
+            if (d->colorType == 3) {
+                for (unsigned int i = 0; i < len && i < 256; ++i)
+                    d->palette[i][3] = fgetc(fp);
+                len -= len < 256 ? len : 256;
+            } else if (len == 2 || len == 6) {
+                if (fread(buf, 1, len, fp) != len)
+                    goto done;
+                for (unsigned int i = 0; i < len / 2; ++i)
+                    d->key[i] = buf[i * 2] << 8 | buf[i * 2 + 1];
+                d->hasKey = 1;
+                len = 0;
+            }
+        } else if (!memcmp(hdr + 4, "IDAT", 4)) {
+            d->chunkLeft = len;
+            ok = 1;
+            break;
+        }
+
+        /* Skip whatever is left of the chunk and its CRC */
+        fseek(fp, len + 4, SEEK_CUR);
+    }
+
+    if (!ok || d->width <= 0 || d->height <= 0 || d->width > 0x8000 || d->height > 0x8000 || d->interlace > 1)
+        goto done;
+    ok = 0;
+
+    switch (d->colorType) {
+    case 0: d->channels = 1; break;
+    case 2: d->channels = 3; break;
+    case 3: d->channels = 1; break;
+    case 4: d->channels = 2; break;
+    case 6: d->channels = 4; break;
+    default: goto done;
+    }
+    if (d->depth != 1 && d->depth != 2 && d->depth != 4 && d->depth != 8 && d->depth != 16)
+        goto done;
+    if ((d->colorType == 3 && d->depth > 8) || (d->colorType != 0 && d->colorType != 3 && d->depth < 8))
+        goto done;
+
+    d->bpp = (d->channels * d->depth + 7) / 8;
+    d->cur = (unsigned char *)malloc((d->width * d->channels * d->depth + 7) / 8);
+    d->prev = (unsigned char *)malloc((d->width * d->channels * d->depth + 7) / 8);
+    bitmap.width = d->width;
+    bitmap.height = d->height;
+    bitmap.data = (unsigned char *)calloc(bitmap.width * bitmap.height, 1);
+    d->out = &bitmap;
+    if (!d->cur || !d->prev || !bitmap.data)
+        goto done;
+
+    pngStartPass(d);
+    ok = inflateStream(d) == 0 && d->done;
+
+done:
+    if (!ok) {
+        free(bitmap.data);
+        bitmap.data = NULL;
+        bitmap.width = bitmap.height = 0;
+    }
+    if (d) {
+        free(d->cur);
+        free(d->prev);
+        free(d);
+    }
+    fclose(fp);
+
+    return bitmap;
+}
+
+
+/*----------------------------------------------------------------------------
+ * Asset loading
+ *
+ * Decoding a few large images with loadBitmap or loadPNG before the first
+ * frame holds the program up for as long as they take. An AssetLoader does
+ * the decoding on a pool of worker threads instead. requestAsset returns an
+ * Asset handle at once, and the program goes on drawing it with drawAsset,
+ * which shows a placeholder, a dithered box of the size given with the
+ * request, until a worker has finished with it. The file's first bytes pick
+ * the decoder, so BMP and PNG files can be mixed.
+ *
+ * Workers also pack each image into whole braille cells: the dots to set,
+ * and the dots the image covers. drawAsset blits those a row of cells at a
+ * time when the image lands on a cell boundary, which is much faster than
+ * drawBitmap's point by point drawing, and falls back to drawBitmap
+ * elsewhere. Assets belong to their loader and are freed with it.
+ *----------------------------------------------------------------------------*/
+enum {ASSET_PENDING, ASSET_READY, ASSET_FAILED};
+
+typedef struct Asset {
+    char *filename;
+    atomic_int state;
+    int placeholderWidth;
+    int placeholderHeight;
+    Surface bitmap;
+    int cellWidth;
+    int cellHeight;
+    unsigned char *set;
+    unsigned char *keep;
+    struct Asset *next;
+    struct Asset *all;
+} Asset;
+
+typedef struct AssetLoader {
+    pthread_t *threads;
+    int count;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    Asset *head;
+    Asset *tail;
+    Asset *assets;
+    int stop;
+} AssetLoader;
+
+/*----------------------------------------------------------------------------
+ * packAsset
+ *
+ * Pack a decoded bitmap into cells, bottom row of cells first, as if drawn
+ * with its first dot at the corner of a cell.
+ *----------------------------------------------------------------------------*/
+static void packAsset(Asset *a)
+{
+    Surface *b = &a->bitmap;
+
+    a->cellWidth = (b->width + 1) / 2;
+    a->cellHeight = (b->height + 3) / 4;
+    a->set = (unsigned char *)calloc(a->cellWidth * a->cellHeight, 1);
+    a->keep = (unsigned char *)malloc(a->cellWidth * a->cellHeight);
+    memset(a->keep, 0xFF, a->cellWidth * a->cellHeight);
+
+    for (int y = 0; y < b->height; ++y) {
+        for (int x = 0; x < b->width; ++x) {
+            int cell = (y / 4) * a->cellWidth + x / 2;
+            unsigned char dot = braillePositionVals[((y % 4) * 2) + (x % 2)];
+            a->keep[cell] &= ~dot;
+            if (b->data[y * b->width + x])
+                a->set[cell] |= dot;
+        }
+    }
+}
+
+/*----------------------------------------------------------------------------
+ * decodeAsset, assetWorker
+ *
+ * Workers take requests off the queue in order and decode them.
+ *----------------------------------------------------------------------------*/
+static void decodeAsset(Asset *a)
+{
+    unsigned char magic[8] = {0};
+    FILE *fp = fopen(a->filename, "rb");
+
+    if (!fp || fread(magic, 1, 8, fp) != 8) {
+        if (fp)
+            fclose(fp);
+        atomic_store_explicit(&a->state, ASSET_FAILED, memory_order_release);
+        return;
+    }
+    fclose(fp);
+
+    if (!memcmp(magic, "\x89PNG\r\n\x1a\n", 8))
+        a->bitmap = loadPNG(a->filename);
+    else if (magic[0] == 'B' && magic[1] == 'M')
+        a->bitmap = loadBitmap(a->filename);
+
+    if (!a->bitmap.data) {
+        atomic_store_explicit(&a->state, ASSET_FAILED, memory_order_release);
+        return;
+    }
+
+    packAsset(a);
+    atomic_store_explicit(&a->state, ASSET_READY, memory_order_release);
+}
+
+static void *assetWorker(void *arg)
+{
+    AssetLoader *al = (AssetLoader *)arg;
+
+    while (1) {
+        pthread_mutex_lock(&al->lock);
+        while (!al->head && !al->stop)
+            pthread_cond_wait(&al->wake, &al->lock);
+        if (al->stop) {
+            pthread_mutex_unlock(&al->lock);
+            return NULL;
+        }
+        Asset *a = al->head;
+        al->head = a->next;
+        if (!al->head)
+            al->tail = NULL;
+        pthread_mutex_unlock(&al->lock);
+
+        decodeAsset(a);
+    }
+}
+
+/*----------------------------------------------------------------------------
+ * initAssetLoader, freeAssetLoader
+ *
+ * Start a loader with n worker threads, and stop it, dropping any requests
+ * not yet started and freeing every Asset it handed out.
+ *----------------------------------------------------------------------------*/
+void initAssetLoader(AssetLoader *al, int n)
+{
+    memset(al, 0, sizeof(AssetLoader));
+    pthread_mutex_init(&al->lock, NULL);
+    pthread_cond_init(&al->wake, NULL);
+
+    al->threads = (pthread_t *)malloc((n < 1 ? 1 : n) * sizeof(pthread_t));
+    for (int i = 0; i < n || i == 0; ++i) {
+        if (pthread_create(&al->threads[i], NULL, assetWorker, al) != 0)
+            break;
+        ++al->count;
+    }
+}
+
+void freeAssetLoader(AssetLoader *al)
+{
+    pthread_mutex_lock(&al->lock);
+    al->stop = 1;
+    pthread_cond_broadcast(&al->wake);
+    pthread_mutex_unlock(&al->lock);
+    for (int i = 0; i < al->count; ++i)
+        pthread_join(al->threads[i], NULL);
+
+    while (al->assets) {
+        Asset *a = al->assets;
+        al->assets = a->all;
+        free(a->filename);
+        free(a->bitmap.data);
+        free(a->set);
+        free(a->keep);
+        free(a);
+    }
+
+    pthread_mutex_destroy(&al->lock);
+    pthread_cond_destroy(&al->wake);
+    free(al->threads);
+    memset(al, 0, sizeof(AssetLoader));
+}
+
+/*----------------------------------------------------------------------------
+ * requestAsset, assetReady
+ *
+ * Queue an image file for loading and return its handle. The placeholder is
+ * w by h dots. assetReady tells whether the image has been loaded, after
+ * which its bitmap can be used like any other.
+ *----------------------------------------------------------------------------*/
+Asset *requestAsset(AssetLoader *al, const char *filename, int w, int h)
+{
+    Asset *a = (Asset *)calloc(1, sizeof(Asset));
+    a->filename = strdup(filename);
+    a->placeholderWidth = w;
+    a->placeholderHeight = h;
+    atomic_init(&a->state, ASSET_PENDING);
+
+    pthread_mutex_lock(&al->lock);
+    a->all = al->assets;
+    al->assets = a;
+    if (al->tail)
+        al->tail->next = a;
+    else
+        al->head = a;
+    al->tail = a;
+    pthread_cond_signal(&al->wake);
+    pthread_mutex_unlock(&al->lock);
+
+    return a;
+}
+
+int assetReady(Asset *a)
+{
+    return atomic_load_explicit(&a->state, memory_order_acquire) == ASSET_READY;
+}
+
+/*----------------------------------------------------------------------------
+ * drawAsset
+ *
+ * Draw an Asset at x, y like drawBitmap, or its placeholder while it is
+ * still loading. Nothing is drawn for an image that failed to load.
+ *----------------------------------------------------------------------------*/
+void drawAsset(Surface *s, Asset *a, int x, int y)
+{
+    int state = atomic_load_explicit(&a->state, memory_order_acquire);
+
+    if (state == ASSET_FAILED)
+        return;
+
+    if (state == ASSET_PENDING) {
+        drawRect(s, x, y, a->placeholderWidth, a->placeholderHeight, 0);
+        for (int i = 1; i < a->placeholderHeight - 1; ++i)
+            for (int j = 1; j < a->placeholderWidth - 1; ++j)
+                drawDitheredPoint(s, x + j, y + i, 0.25f);
+        return;
+    }
+
+    /* Off a cell boundary, or partly off the bottom or left of the Surface,
+     * the dots don't line up with the packed cells */
+    if (trace.fp || x < 0 || y < 0 || (x & 1) || (y & 3)) {
+        drawBitmap(s, &a->bitmap, x, y);
+        return;
+    }
+
+    int cx = x / 2, cy = y / 4;
+    int w = a->cellWidth, h = a->cellHeight;
+    if (cx + w > s->width)
+        w = s->width - cx;
+    if (cy + h > s->height)
+        h = s->height - cy;
+
+    for (int row = 0; row < h; ++row)
+        kernels.blit(s->data + (s->height - 1 - (cy + row)) * s->width + cx, a->set + row * a->cellWidth,
+                     a->keep + row * a->cellWidth, w);
+}
+
+/*----------------------------------------------------------------------------
+ * initLouis
+ *
+ * Perform various routines necessary for the graphics library to work:
+ *
+ * 1) Save the terminal's attributes on program entry.
+ * 2) Switch to raw input mode.
+ * 3) Generate the table of braille escape sequences.
+ * 4) Generate the tables used to shift dots between cells.
+ * 5) Bind the kernels for the CPU, or for the level named by LOUIS_CPU.
+ * 6) Start tracing if LOUIS_TRACE names a file.
+ * 7) Write frames through io_uring if LOUIS_IO_URING is set.
+ *----------------------------------------------------------------------------*/
+void initLouis()
+{
+    tcgetattr(0, &origterm);
+    rawterm = origterm;
+    rawterm.c_iflag |= IGNBRK;
+    rawterm.c_lflag &= ~ICANON;
+    rawterm.c_lflag &= ~ECHO;
+    rawterm.c_cc[VMIN] = 0;
+    rawterm.c_cc[VTIME] = 0;
+    tcsetattr(0, TCSAFLUSH, &rawterm);
+
+    genBrailleTab();
+    genGridTabs();
+    setCpuLevel(getenv("LOUIS_CPU") ? cpuLevelByName(getenv("LOUIS_CPU")) : CPU_BEST);
+
+    if (getenv("LOUIS_TRACE"))
+        startTrace(getenv("LOUIS_TRACE"));
+    if (getenv("LOUIS_IO_URING"))
+        useIoUring(1);
 }
 
 /*----------------------------------------------------------------------------
  * endLouis
  *
- * Clear the screen, show the cursor, restore the original terminal attributes
- * for a clean exit, and free the screen buffer.
+ * Finish any io_uring writes, clear the screen, show the cursor, restore the
+ * original terminal attributes for a clean exit, stop any render threads and
+ * tracing, and free the screen buffer.
  *----------------------------------------------------------------------------*/
 void endLouis()
 {
-    write(1, "\x1b[2J", 4);
-    write(1, "\x1b[?25h", 6);
+    useIoUring(0);
+    louisWrite("\x1b[2J", 4);
+    louisWrite("\x1b[?25h", 6);
     tcsetattr(0, TCSAFLUSH, &origterm);
+    setRenderThreads(1);
+    stopTrace();
     free(screenBuffer);
 }
 
@@ -0,0 +1,209 @@
+/*----------------------------------------------------------------------------
+ * map.c
+ *
+ * This program shows a vector map with the louis graphics library, and makes
+ * map files for it:
+ *
+ *     map coast.map
+ *     map -c coast.txt coast.map
+ *     map -g 300 islands.map
+ *
+ * The first form shows a map. The arrow keys pan, + and - zoom, 0 goes back
+ * to the whole map, and q quits. The bottom line tells how many segments
+ * were drawn and how long the frame took.
+ *
+ * -c converts polylines from text, a vertex per line as x and y, with a
+ * blank line or one starting with > between features and # for comments.
+ * -g makes up a map of the given number of islands, each with a coastline
+ * of over 8000 vertices, for trying out large maps.
+ *----------------------------------------------------------------------------*/
+
+#include <time.h>
+#include "louis.h"
+
+#define ISLAND_DEPTH 10
+
+/*----------------------------------------------------------------------------
+ * convertText
+ *
+ *----------------------------------------------------------------------------*/
+static int convertText(VectorMap *m, const char *filename)
+{
+    char line[256];
+    float *xy = NULL;
+    int n = 0, cap = 0;
+
+    FILE *fp = fopen(filename, "r");
+    if (!fp)
+        return -1;
+
+    while (1) {
+        float x, y;
+        int more = fgets(line, sizeof(line), fp) != NULL;
+
+        if (more && line[0] == '#')
+            continue;
+        if (more && sscanf(line, "%f %f", &x, &y) == 2) {
+            if (n == cap) {
+                cap = cap ? cap * 2 : 1024;
+                xy = (float *)realloc(xy, cap * 2 * sizeof(float));
+            }
+            xy[n * 2] = x;
+            xy[n * 2 + 1] = y;
+            ++n;
+            continue;
+        }
+
+        /* Anything else ends the feature */
+        addMapFeature(m, xy, n);
+        n = 0;
+        if (!more)
+            break;
+    }
+    fclose(fp);
+    free(xy);
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------------
+ * makeIslands
+ *
+ * Start each island as an octagon and split every edge ISLAND_DEPTH times,
+ * pushing the new vertex in or out by a random part of the edge's length.
+ *----------------------------------------------------------------------------*/
+static void makeIslands(VectorMap *m, int islands)
+{
+    int n = 8 << ISLAND_DEPTH;
+    float *xy = (float *)malloc((n + 1) * 2 * sizeof(float));
+
+    for (int i = 0; i < islands; ++i) {
+        float cx = rand() % 10000 / 10.0f, cy = rand() % 10000 / 10.0f;
+        float r = 2 + rand() % 400 / 10.0f;
+
+        for (int j = 0; j < 8; ++j) {
+            xy[(j * n / 8) * 2] = cx + r * cosf(j * 0.785398f);
+            xy[(j * n / 8) * 2 + 1] = cy + r * sinf(j * 0.785398f);
+        }
+        for (int step = n / 8; step > 1; step /= 2) {
+            for (int a = 0; a < n; a += step) {
+                int b = (a + step) % n, mid = a + step / 2;
+                float dx = xy[b * 2] - xy[a * 2], dy = xy[b * 2 + 1] - xy[a * 2 + 1];
+                float push = (rand() % 1000 / 1000.0f - 0.5f) * 0.4f;
+                xy[mid * 2] = (xy[a * 2] + xy[b * 2]) / 2 + dy * push;
+                xy[mid * 2 + 1] = (xy[a * 2 + 1] + xy[b * 2 + 1]) / 2 - dx * push;
+            }
+        }
+        xy[n * 2] = xy[0];
+        xy[n * 2 + 1] = xy[1];
+        addMapFeature(m, xy, n + 1);
+    }
+
+    free(xy);
+}
+
+/*----------------------------------------------------------------------------
+ * fitMap
+ *
+ * Centre the whole map in the Surface.
+ *----------------------------------------------------------------------------*/
+static void fitMap(VectorMap *m, Surface *s, float *cx, float *cy, float *scale)
+{
+    MapItem *root = &m->nodes[m->nnodes - 1];
+    float sx = (s->width * 2 - 1) / (root->x1 - root->x0 + 1e-6f);
+    float sy = (s->height * 4 - 1) / (root->y1 - root->y0 + 1e-6f);
+
+    *cx = (root->x0 + root->x1) / 2;
+    *cy = (root->y0 + root->y1) / 2;
+    *scale = (sx < sy) ? sx : sy;
+}
+
+/*----------------------------------------------------------------------------
+ * main
+ *
+ *----------------------------------------------------------------------------*/
+int main(int argc, char **argv)
+{
+    VectorMap m;
+    char c;
+
+    initMap(&m);
+
+    if (argc == 4 && (!strcmp(argv[1], "-c") || !strcmp(argv[1], "-g"))) {
+        if (!strcmp(argv[1], "-g")) {
+            makeIslands(&m, atoi(argv[2]));
+        } else if (convertText(&m, argv[2]) < 0) {
+            perror(argv[2]);
+            return 1;
+        }
+        if (saveMap(&m, argv[3]) < 0) {
+            perror(argv[3]);
+            return 1;
+        }
+        printf("%d features, %ld vertices\n", m.nfeatures, m.nvertices);
+        freeMap(&m);
+        return 0;
+    }
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s file | -c text file | -g islands file\n", argv[0]);
+        return 1;
+    }
+    if (loadMap(&m, argv[1]) < 0 || m.nfeatures == 0) {
+        fprintf(stderr, "%s: can't read a map from %s\n", argv[0], argv[1]);
+        return 1;
+    }
+
+    initLouis();
+
+    Surface s;
+    initSurface(&s);
+
+    float cx, cy, scale;
+    fitMap(&m, &s, &cx, &cy, &scale);
+
+    while (1) {
+        float step = s.width / scale / 5;
+
+        while (readInput(&c, 1) == 1) {
+            switch (c) {
+            case 'q':
+                goto done;
+            case '+':
+                scale *= 1.5f;
+                break;
+            case '-':
+                scale /= 1.5f;
+                break;
+            case '0':
+                fitMap(&m, &s, &cx, &cy, &scale);
+                break;
+            /* The arrow keys send ESC [ A through D */
+            case 'A': cy += step; break;
+            case 'B': cy -= step; break;
+            case 'C': cx += step; break;
+            case 'D': cx -= step; break;
+            }
+        }
+
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        clearSurface(&s);
+        long segments = drawMap(&s, &m, 0, 0, s.width * 2, s.height * 4, cx, cy, scale);
+        render(&s);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+
+        char status[128];
+        int len = snprintf(status, sizeof(status), "\x1b[%d;1H\x1b[K%ld segments, %.1f ms\x1b[H", s.height,
+                           segments, (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6);
+        writeOutput(status, len);
+
+        usleep(20000);
+    }
+
+done:
+    endLouis();
+    freeMap(&m);
+    free(s.data);
+
+    return 0;
+}
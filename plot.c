@@ -0,0 +1,225 @@
+/*----------------------------------------------------------------------------
+ * plot.c
+ *
+ * This program plots formulas given on the command line with the louis
+ * graphics library, for example:
+ *
+ *     plot -x -10:10 -y -2:2 "sin(x + t)" "a * cos(x * 2)" -p a=0.5
+ *
+ * The parameter t counts seconds since the program started, so formulas that
+ * use it are animated. The arrow keys pan, + and - zoom, : reads a new
+ * formula from the keyboard to replace the first one, and q quits. Over a
+ * slow link, -b limits each frame to the given number of bytes. With many
+ * costly formulas, -f limits the time spent on each frame to the given
+ * number of milliseconds, drawing the formulas in less detail when needed.
+ *----------------------------------------------------------------------------*/
+
+#include <time.h>
+#include "louis.h"
+
+#define MAX_EXPRS 8
+
+static Expr exprs[MAX_EXPRS];
+static char sources[MAX_EXPRS][256];
+static int nexprs;
+
+/*----------------------------------------------------------------------------
+ * parseRange
+ *
+ *----------------------------------------------------------------------------*/
+static int parseRange(char *arg, float *lo, float *hi)
+{
+    return sscanf(arg, "%f:%f", lo, hi) == 2 && *lo < *hi;
+}
+
+/*----------------------------------------------------------------------------
+ * setParams
+ *
+ * Parameters are shared by all the formulas.
+ *----------------------------------------------------------------------------*/
+static void setParams(char name, float value)
+{
+    for (int i = 0; i < MAX_EXPRS; ++i)
+        setExprParam(&exprs[i], name, value);
+}
+
+/*----------------------------------------------------------------------------
+ * drawAxes
+ *
+ *----------------------------------------------------------------------------*/
+static void drawAxes(Surface *s, float xmin, float xmax, float ymin, float ymax)
+{
+    int w = s->width * 2, h = s->height * 4;
+    float ox = 0, oy = 0;
+
+    /* Find the origin in dots */
+    pushTransform();
+    scaleView(w - 1, h - 1);
+    setAxisScale(AXIS_X, SCALE_LINEAR, xmin, xmax, 0);
+    setAxisScale(AXIS_Y, SCALE_LINEAR, ymin, ymax, 0);
+    mapPoints(&ox, &oy, &ox, &oy, 1);
+    popTransform();
+
+    if (ymin < 0 && ymax > 0) {
+        for (int x = 0; x < w; x += 2)
+            drawPoint(s, x, oy, 1);
+    }
+    if (xmin < 0 && xmax > 0) {
+        for (int y = 0; y < h; y += 2)
+            drawPoint(s, ox, y, 1);
+    }
+}
+
+/*----------------------------------------------------------------------------
+ * main
+ *
+ *----------------------------------------------------------------------------*/
+int main(int argc, char **argv)
+{
+    float xmin = -10, xmax = 10, ymin = -10, ymax = 10;
+    char line[256] = "";
+    char message[256] = "";
+    int editing = 0;
+    int budget = 0;
+    float frameTime = 0;
+    float value;
+    char name;
+    int opt;
+    char c;
+
+    while ((opt = getopt(argc, argv, "x:y:p:b:f:")) != -1) {
+        if (opt == 'x' && parseRange(optarg, &xmin, &xmax))
+            continue;
+        if (opt == 'y' && parseRange(optarg, &ymin, &ymax))
+            continue;
+        if (opt == 'p' && sscanf(optarg, "%c=%f", &name, &value) == 2) {
+            setParams(name, value);
+            continue;
+        }
+        if (opt == 'b' && (budget = atoi(optarg)) > 0)
+            continue;
+        if (opt == 'f' && (frameTime = atof(optarg)) > 0)
+            continue;
+        fprintf(stderr, "usage: %s [-x min:max] [-y min:max] [-p name=value] [-b bytes] [-f ms] formula...\n", argv[0]);
+        return 1;
+    }
+
+    for (; optind < argc && nexprs < MAX_EXPRS; ++optind, ++nexprs) {
+        snprintf(sources[nexprs], sizeof(sources[nexprs]), "%s", argv[optind]);
+        int err = compileExpr(&exprs[nexprs], sources[nexprs]);
+        if (err) {
+            fprintf(stderr, "%s: %s at column %d of \"%s\"\n", argv[0], exprs[nexprs].error, err, sources[nexprs]);
+            return 1;
+        }
+    }
+    if (nexprs == 0) {
+        fprintf(stderr, "usage: %s [-x min:max] [-y min:max] [-p name=value] [-b bytes] [-f ms] formula...\n", argv[0]);
+        return 1;
+    }
+
+    initLouis();
+
+    Surface s;
+    initSurface(&s);
+
+    Throttle throttle;
+    initThrottle(&throttle, budget);
+
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (1) {
+        float dx = (xmax - xmin) / 20, dy = (ymax - ymin) / 20;
+
+        while (readInput(&c, 1) == 1) {
+            if (editing) {
+                int len = strlen(line);
+                if (c == '\n' || c == '\r') {
+                    /* Keep the old formula if the new one doesn't parse */
+                    Expr e = exprs[0];
+                    e.code = NULL;
+                    e.cap = 0;
+                    int err = compileExpr(&e, line);
+                    if (err) {
+                        snprintf(message, sizeof(message), "%s at column %d", e.error, err);
+                        freeExpr(&e);
+                    } else {
+                        freeExpr(&exprs[0]);
+                        exprs[0] = e;
+                        memcpy(sources[0], line, sizeof(line));
+                        exprs[0].src = sources[0];
+                        message[0] = '\0';
+                    }
+                    editing = 0;
+                } else if (c == 0x7F || c == '\b') {
+                    if (len > 0)
+                        line[len - 1] = '\0';
+                } else if (c == 0x1B) {
+                    editing = 0;
+                } else if (len < (int)sizeof(line) - 1 && c >= ' ') {
+                    line[len] = c;
+                    line[len + 1] = '\0';
+                }
+                continue;
+            }
+
+            switch (c) {
+            case 'q':
+                goto done;
+            case ':':
+                editing = 1;
+                line[0] = '\0';
+                break;
+            case '+':
+                xmin += dx * 2, xmax -= dx * 2, ymin += dy * 2, ymax -= dy * 2;
+                break;
+            case '-':
+                xmin -= dx * 2, xmax += dx * 2, ymin -= dy * 2, ymax += dy * 2;
+                break;
+            /* The arrow keys send ESC [ A through D */
+            case 'A': ymin += dy, ymax += dy; break;
+            case 'B': ymin -= dy, ymax -= dy; break;
+            case 'C': xmin += dx, xmax += dx; break;
+            case 'D': xmin -= dx, xmax -= dx; break;
+            }
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        setParams('t', (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9f);
+
+        beginFrame(frameTime / 1000);
+        clearSurface(&s);
+        drawAxes(&s, xmin, xmax, ymin, ymax);
+        for (int i = 0; i < nexprs; ++i)
+            plotExpr(&s, &exprs[i], xmin, xmax, ymin, ymax);
+        if (budget)
+            renderThrottled(&s, &throttle);
+        else
+            render(&s);
+        endFrame();
+
+        /* The prompt and any error go on the bottom line, over the plot */
+        if (editing || message[0]) {
+            char status[600];
+            int len = snprintf(status, sizeof(status), "\x1b[%d;1H\x1b[K%s%s\x1b[H",
+                               s.height, editing ? ":" : "", editing ? line : message);
+            writeOutput(status, len);
+
+            /* The throttle has to resend the row once the prompt goes */
+            if (budget)
+                for (int x = 0; x < s.width; ++x)
+                    throttle.shown[(s.height - 1) * s.width + x] = ~s.data[(s.height - 1) * s.width + x];
+        }
+
+        usleep(20000);
+    }
+
+done:
+    endLouis();
+    freeThrottle(&throttle);
+    free(s.data);
+    for (int i = 0; i < nexprs; ++i)
+        freeExpr(&exprs[i]);
+
+    return 0;
+}
@@ -0,0 +1,308 @@
+/*----------------------------------------------------------------------------
+ * replay.c
+ *
+ * This program plays back a trace recorded from a louis program, for
+ * example with:
+ *
+ *     LOUIS_TRACE=demo.trace ./demo
+ *     replay -n 5 demo.trace
+ *
+ * The drawing calls are made again as fast as they will go, and every frame
+ * is rendered to a virtual terminal instead of the screen. The best of n runs
+ * is reported: the time spent drawing and rendering, the frame rate reached,
+ * and the bytes per frame, next to how long the recording took. A checksum
+ * of every frame is printed as well, so that two builds of the library can
+ * be checked to draw the same pictures before their times are compared.
+ *----------------------------------------------------------------------------*/
+
+#include "louis.h"
+
+static unsigned char *traceData;
+static long traceSize;
+static Surface surfaces[TRACE_MAX_SURFACES];
+
+/* The largest width or height a traced surface is replayed with */
+#define TRACE_MAX_SIZE 65535
+
+/*----------------------------------------------------------------------------
+ * now
+ *
+ *----------------------------------------------------------------------------*/
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*----------------------------------------------------------------------------
+ * argCount
+ *
+ * The number of float arguments each operation is recorded with.
+ *----------------------------------------------------------------------------*/
+static int argCount(int op)
+{
+    switch (op) {
+    case TRACE_SURFACE: return 2;
+    case TRACE_BITMAP: return 2;
+    case TRACE_POINT: return 3;
+    case TRACE_LINE: return 4;
+    case TRACE_CURVE: return 5;
+    case TRACE_RECT: return 5;
+    case TRACE_DRAW_BITMAP: return 3;
+    case TRACE_DITHER: return 3;
+    case TRACE_CLEAR: return 0;
+    case TRACE_SCROLL: return 2;
+    case TRACE_CELLS: return 4;
+    case TRACE_RENDER: return 1;
+    case TRACE_INPUT: return 2;
+    case TRACE_CIRCLE: return 4;
+    case TRACE_POINTS: return 1;
+    case TRACE_POLYLINE: return 1;
+    case TRACE_LOD: return 1;
+    }
+    return -1;
+}
+
+/*----------------------------------------------------------------------------
+ * setSurface
+ *
+ * Give surface id a new, blank width by height. Return 0, or -1 if it can't
+ * be allocated.
+ *----------------------------------------------------------------------------*/
+static int setSurface(int id, int width, int height)
+{
+    free(surfaces[id].data);
+    surfaces[id].data = (unsigned char *)calloc((size_t)width * height + 1, 1);
+    surfaces[id].width = surfaces[id].data ? width : 0;
+    surfaces[id].height = surfaces[id].data ? height : 0;
+    return surfaces[id].data ? 0 : -1;
+}
+
+/*----------------------------------------------------------------------------
+ * replay
+ *
+ * Play the whole trace once. Return 0, or -1 if the trace is damaged.
+ *----------------------------------------------------------------------------*/
+typedef struct Run {
+    double draw;
+    double render;
+    double recorded;
+    long frames;
+    long inputs;
+    long bytes;
+    unsigned int checksum;
+} Run;
+
+static int replay(Run *run, VTerm *vt)
+{
+    long pos = 8;
+    float a[5];
+    float xy[TRANSFORM_BLOCK * 2];
+
+    memset(run, 0, sizeof(Run));
+    run->checksum = 2166136261u;
+    setFrameDetail(1.0f);
+    for (int i = 0; i < TRACE_MAX_SURFACES; ++i)
+        setSurface(i, 0, 0);
+
+    double t0 = now();
+
+    while (pos + 3 <= traceSize) {
+        int op = traceData[pos];
+        int id = traceData[pos + 1] | traceData[pos + 2] << 8;
+        int n = argCount(op);
+
+        pos += 3;
+        if (n < 0 || id >= TRACE_MAX_SURFACES || pos + n * (long)sizeof(float) > traceSize)
+            return -1;
+        Surface *s = &surfaces[id];
+        memcpy(a, traceData + pos, n * sizeof(float));
+        pos += n * sizeof(float);
+
+        /* Surface ids and sizes are used to index and allocate */
+        if (op == TRACE_DRAW_BITMAP && !(a[0] >= 0 && a[0] < TRACE_MAX_SURFACES))
+            return -1;
+        if ((op == TRACE_SURFACE || op == TRACE_BITMAP) &&
+            !(a[0] >= 0 && a[0] <= TRACE_MAX_SIZE && a[1] >= 0 && a[1] <= TRACE_MAX_SIZE))
+            return -1;
+
+        /* Records that carry bytes after their arguments */
+        long extra = 0;
+        if (op == TRACE_BITMAP)
+            extra = (long)a[0] * (long)a[1];
+        else if (op == TRACE_CELLS)
+            extra = (long)(a[2] - a[0] + 1) * (long)(a[3] - a[1] + 1);
+        else if (op == TRACE_INPUT)
+            extra = (long)a[1];
+        else if ((op == TRACE_POINTS || op == TRACE_POLYLINE) && !(a[0] >= 0 && a[0] <= TRANSFORM_BLOCK))
+            extra = -1;
+        else if (op == TRACE_POINTS || op == TRACE_POLYLINE)
+            extra = (long)a[0] * 2 * (long)sizeof(float);
+        if (extra < 0 || pos + extra > traceSize)
+            return -1;
+
+        switch (op) {
+        case TRACE_SURFACE:
+            if (setSurface(id, a[0], a[1]) < 0)
+                return -1;
+            break;
+        case TRACE_BITMAP:
+            if (setSurface(id, a[0], a[1]) < 0)
+                return -1;
+            memcpy(s->data, traceData + pos, extra);
+            break;
+        case TRACE_POINT:
+            drawPoint(s, a[0], a[1], a[2]);
+            break;
+        case TRACE_LINE:
+            drawLine(s, a[0], a[1], a[2], a[3]);
+            break;
+        case TRACE_CURVE:
+            drawCurve(s, a[0], a[1], a[2], a[3], a[4]);
+            break;
+        case TRACE_RECT:
+            drawRect(s, a[0], a[1], a[2], a[3], a[4]);
+            break;
+        case TRACE_DRAW_BITMAP:
+            drawBitmap(s, &surfaces[(int)a[0]], a[1], a[2]);
+            break;
+        case TRACE_DITHER:
+            drawDitheredPoint(s, a[0], a[1], a[2]);
+            break;
+        case TRACE_CIRCLE:
+            drawCircle(s, a[0], a[1], a[2], a[3]);
+            break;
+        case TRACE_POINTS:
+            memcpy(xy, traceData + pos, extra);
+            drawPoints(s, xy, xy + (int)a[0], a[0]);
+            break;
+        case TRACE_POLYLINE: {
+            /* The points were thinned out when they were recorded */
+            float detail = frameDetail();
+            memcpy(xy, traceData + pos, extra);
+            setFrameDetail(1.0f);
+            drawPolyline(s, xy, xy + (int)a[0], a[0]);
+            setFrameDetail(detail);
+            break;
+        }
+        case TRACE_LOD:
+            setFrameDetail(a[0]);
+            break;
+        case TRACE_CLEAR:
+            clearSurface(s);
+            break;
+        case TRACE_SCROLL:
+            scrollSurface(s, a[0], a[1]);
+            break;
+        case TRACE_CELLS: {
+            int x0 = a[0], y0 = a[1], x1 = a[2], y1 = a[3];
+            if (x0 < 0 || y0 < 0 || x1 >= s->width || y1 >= s->height)
+                return -1;
+            for (int y = y0; y <= y1; ++y)
+                memcpy(s->data + y * s->width + x0, traceData + pos + (y - y0) * (x1 - x0 + 1), x1 - x0 + 1);
+            break;
+        }
+        case TRACE_RENDER: {
+            if (vt->width != s->width || vt->height != s->height) {
+                freeVTerm(vt);
+                initVTerm(vt, s->width, s->height);
+                setOutputSink(vt);
+                free(screenBuffer);
+                screenBuffer = NULL;
+            }
+            double t1 = now();
+            run->draw += t1 - t0;
+            render(s);
+            t0 = now();
+            run->render += t0 - t1;
+            run->bytes += vt->bytes;
+            resetVTermStats(vt);
+            for (int i = 0; i < s->width * s->height; ++i)
+                run->checksum = (run->checksum ^ s->data[i]) * 16777619u;
+            run->recorded = a[0];
+            ++run->frames;
+            break;
+        }
+        case TRACE_INPUT:
+            ++run->inputs;
+            break;
+        }
+
+        pos += extra;
+    }
+
+    run->draw += now() - t0;
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------------
+ * main
+ *
+ *----------------------------------------------------------------------------*/
+int main(int argc, char **argv)
+{
+    int runs = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        if (opt == 'n' && (runs = atoi(optarg)) > 0)
+            continue;
+        fprintf(stderr, "usage: %s [-n runs] trace\n", argv[0]);
+        return 1;
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "usage: %s [-n runs] trace\n", argv[0]);
+        return 1;
+    }
+
+    FILE *fp = fopen(argv[optind], "rb");
+    if (!fp) {
+        perror(argv[optind]);
+        return 1;
+    }
+    fseek(fp, 0, SEEK_END);
+    traceSize = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    traceData = (unsigned char *)malloc(traceSize + 1);
+    if (fread(traceData, 1, traceSize, fp) != (size_t)traceSize || traceSize < 8 ||
+        memcmp(traceData, "LOUISTR1", 8)) {
+        fprintf(stderr, "%s: %s is not a louis trace\n", argv[0], argv[optind]);
+        return 1;
+    }
+    fclose(fp);
+
+    genBrailleTab();
+    genGridTabs();
+    setCpuLevel(getenv("LOUIS_CPU") ? cpuLevelByName(getenv("LOUIS_CPU")) : CPU_BEST);
+
+    VTerm vt;
+    initVTerm(&vt, 0, 0);
+    Run best, run;
+
+    for (int i = 0; i < runs; ++i) {
+        if (replay(&run, &vt) < 0) {
+            fprintf(stderr, "%s: %s is damaged\n", argv[0], argv[optind]);
+            return 1;
+        }
+        if (i == 0 || run.draw + run.render < best.draw + best.render)
+            best = run;
+    }
+    setOutputSink(NULL);
+
+    long frames = best.frames ? best.frames : 1;
+    printf("frames %ld, inputs %ld, recorded over %.2f s\n", best.frames, best.inputs, best.recorded);
+    printf("replayed in %.2f ms: draw %.1f us/frame, render %.1f us/frame, %.0f frames/s\n",
+           (best.draw + best.render) * 1e3, best.draw * 1e6 / frames, best.render * 1e6 / frames,
+           best.frames / (best.draw + best.render));
+    printf("%ld bytes/frame, checksum %08x\n", best.bytes / frames, best.checksum);
+
+    for (int i = 0; i < TRACE_MAX_SURFACES; ++i)
+        free(surfaces[i].data);
+    freeVTerm(&vt);
+    free(screenBuffer);
+    free(traceData);
+
+    return 0;
+}
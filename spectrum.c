@@ -0,0 +1,388 @@
+/*----------------------------------------------------------------------------
+ * spectrum.c
+ *
+ * This program reads PCM audio and draws its frequency spectrum with the louis
+ * graphics library, either as a bar graph or as a spectrogram waterfall that
+ * scrolls to the left one dot column at a time.
+ *
+ * usage: spectrum [-w] [-r rate] [-c channels] [-n size] [file]
+ *
+ * The input is a 16-bit PCM WAV file, or raw signed 16-bit little-endian
+ * samples when no WAV header is found, in which case the rate and channel
+ * count come from -r and -c (48000 and 2 by default). Without a file name the
+ * audio is read from standard input, e.g. from arecord or ffmpeg, and the
+ * program stops at the end of the stream or on Ctrl-C; otherwise q quits.
+ *----------------------------------------------------------------------------*/
+
+#include <math.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <time.h>
+#include "louis.h"
+
+#define FRAMES_PER_SECOND 50
+#define MIN_FREQ 30.0f
+#define FLOOR_DB -90.0f
+#define MAX_CHANNELS 2048
+
+static volatile sig_atomic_t quit;
+
+typedef struct Input {
+    FILE *fp;
+    int rate;
+    int channels;
+    unsigned char pending[12];
+    int npending;
+} Input;
+
+/* Twiddle factors are stored stage by stage, so the butterfly loop of every
+ * stage reads them, and the two halves of each group, at unit stride. That
+ * keeps the inner loop in a form the compiler turns into vector code. */
+typedef struct FFT {
+    int n;
+    int *rev;
+    float *twRe;
+    float *twIm;
+    float *window;
+    float *re;
+    float *im;
+} FFT;
+
+/*----------------------------------------------------------------------------
+ * onSignal
+ *
+ *----------------------------------------------------------------------------*/
+static void onSignal(int sig)
+{
+    (void)sig;
+    quit = 1;
+}
+
+/*----------------------------------------------------------------------------
+ * openInput
+ *
+ * Read the WAV header if there is one and position the stream at the first
+ * sample. Return -1 for WAV data in a format other than 16-bit PCM, or with
+ * more than MAX_CHANNELS channels, or for a header cut short.
+ *----------------------------------------------------------------------------*/
+static int openInput(Input *in)
+{
+    unsigned char hdr[24];
+
+    in->npending = fread(in->pending, 1, 12, in->fp);
+    if (in->npending < 12 || memcmp(in->pending, "RIFF", 4) || memcmp(in->pending + 8, "WAVE", 4))
+        return 0;
+    in->npending = 0;
+
+    /* Walk the chunks until the sample data */
+    while (fread(hdr, 1, 8, in->fp) == 8) {
+        unsigned int len = hdr[4] | hdr[5] << 8 | hdr[6] << 16 | (unsigned int)hdr[7] << 24;
+
+        if (!memcmp(hdr, "data", 4))
+            return 0;
+
+        if (!memcmp(hdr, "fmt ", 4)) {
+            if (len < 16 || fread(hdr + 8, 1, 16, in->fp) != 16)
+                return -1;
+            int format = hdr[8] | hdr[9] << 8;
+            int bits = hdr[22] | hdr[23] << 8;
+            in->channels = hdr[10] | hdr[11] << 8;
+            in->rate = hdr[12] | hdr[13] << 8 | hdr[14] << 16 | hdr[15] << 24;
+            if ((format != 1 && format != 0xFFFE) || bits != 16 || in->channels < 1 ||
+                in->channels > MAX_CHANNELS)
+                return -1;
+            len -= 16;
+        }
+
+        /* Chunks are padded to an even length. Pipes can't seek, so read
+         * through them instead. */
+        long skip = (long)len + (len & 1);
+        if (fseek(in->fp, skip, SEEK_CUR) != 0) {
+            unsigned char buf[4096];
+            while (skip > 0) {
+                size_t want = (skip < (long)sizeof(buf)) ? skip : sizeof(buf);
+                if (fread(buf, 1, want, in->fp) != want)
+                    return -1;
+                skip -= want;
+            }
+        }
+    }
+
+    return -1;
+}
+
+/*----------------------------------------------------------------------------
+ * readMono
+ *
+ * Read up to n sample frames, averaging the channels of each one, and return
+ * how many were read.
+ *----------------------------------------------------------------------------*/
+static int readMono(Input *in, float *out, int n)
+{
+    int frameBytes = in->channels * 2;
+    unsigned char buf[MAX_CHANNELS * 2];
+    int got = 0;
+
+    while (got < n) {
+        int want = (n - got) * frameBytes;
+        if (want > (int)sizeof(buf))
+            want = sizeof(buf) / frameBytes * frameBytes;
+
+        /* Raw input may have had its first bytes consumed looking for a
+         * header */
+        int len = 0;
+        while (in->npending && len < want) {
+            buf[len++] = in->pending[0];
+            memmove(in->pending, in->pending + 1, --in->npending);
+        }
+        while (len < want) {
+            int r = fread(buf + len, 1, want - len, in->fp);
+            if (r <= 0)
+                break;
+            len += r;
+        }
+
+        int frames = len / frameBytes;
+        for (int i = 0; i < frames; ++i) {
+            int sum = 0;
+            for (int c = 0; c < in->channels; ++c) {
+                unsigned char *p = buf + (i * in->channels + c) * 2;
+                sum += (short)(p[0] | p[1] << 8);
+            }
+            out[got++] = sum / (32768.0f * in->channels);
+        }
+
+        if (len < want)
+            break;
+    }
+
+    return got;
+}
+
+/*----------------------------------------------------------------------------
+ * initFFT
+ *
+ * Allocate buffers and precompute the bit-reversal permutation, the twiddle
+ * factors, and a Hann window for a transform of size n, a power of two.
+ *----------------------------------------------------------------------------*/
+static void initFFT(FFT *f, int n)
+{
+    int bits = 0;
+    while ((1 << bits) < n)
+        ++bits;
+
+    f->n = n;
+    f->rev = (int *)malloc(n * sizeof(int));
+    f->twRe = (float *)malloc(n * sizeof(float));
+    f->twIm = (float *)malloc(n * sizeof(float));
+    f->window = (float *)malloc(n * sizeof(float));
+    f->re = (float *)malloc(n * sizeof(float));
+    f->im = (float *)malloc(n * sizeof(float));
+
+    for (int i = 0; i < n; ++i) {
+        int r = 0;
+        for (int b = 0; b < bits; ++b)
+            r |= ((i >> b) & 1) << (bits - 1 - b);
+        f->rev[i] = r;
+        f->window[i] = 0.5f - 0.5f * cosf(2.0f * (float)M_PI * i / n);
+    }
+
+    /* The stage with half-size h keeps its h factors at offset h - 1 */
+    for (int h = 1; h < n; h <<= 1) {
+        for (int k = 0; k < h; ++k) {
+            f->twRe[h - 1 + k] = cosf((float)M_PI * k / h);
+            f->twIm[h - 1 + k] = -sinf((float)M_PI * k / h);
+        }
+    }
+}
+
+/*----------------------------------------------------------------------------
+ * runFFT
+ *
+ * Window the samples, transform them in place, and leave the magnitude of
+ * each of the lower n / 2 + 1 bins in mag.
+ *----------------------------------------------------------------------------*/
+static void runFFT(FFT *f, const float *samples, float *mag)
+{
+    int n = f->n;
+    float *re = f->re, *im = f->im;
+
+    for (int i = 0; i < n; ++i) {
+        re[f->rev[i]] = samples[i] * f->window[i];
+        im[i] = 0.0f;
+    }
+
+    for (int h = 1; h < n; h <<= 1) {
+        const float *wr = f->twRe + h - 1, *wi = f->twIm + h - 1;
+        for (int j = 0; j < n; j += h * 2) {
+            float *ar = re + j, *ai = im + j, *br = re + j + h, *bi = im + j + h;
+            for (int k = 0; k < h; ++k) {
+                float tr = br[k] * wr[k] - bi[k] * wi[k];
+                float ti = br[k] * wi[k] + bi[k] * wr[k];
+                br[k] = ar[k] - tr;
+                bi[k] = ai[k] - ti;
+                ar[k] += tr;
+                ai[k] += ti;
+            }
+        }
+    }
+
+    for (int i = 0; i <= n / 2; ++i)
+        mag[i] = sqrtf(re[i] * re[i] + im[i] * im[i]);
+}
+
+/*----------------------------------------------------------------------------
+ * mapBins
+ *
+ * Divide the bins between count dot positions on a logarithmic frequency
+ * scale. Position i covers bins edge[i] up to, but not including,
+ * edge[i + 1], and always at least one bin.
+ *----------------------------------------------------------------------------*/
+static void mapBins(int *edge, int count, int n, int rate)
+{
+    float ratio = (rate / 2.0f) / MIN_FREQ;
+
+    for (int i = 0; i <= count; ++i) {
+        float freq = MIN_FREQ * powf(ratio, (float)i / count);
+        edge[i] = (int)(freq * n / rate);
+        if (edge[i] > n / 2)
+            edge[i] = n / 2;
+        if (i > 0 && edge[i] <= edge[i - 1])
+            edge[i] = edge[i - 1] + 1;
+    }
+}
+
+/*----------------------------------------------------------------------------
+ * level
+ *
+ * Loudness of a range of bins as a value from 0 to 1 on a decibel scale.
+ *----------------------------------------------------------------------------*/
+static float level(const float *mag, int lo, int hi, int n)
+{
+    float m = 0.0f;
+    for (int i = lo; i < hi && i <= n / 2; ++i) {
+        if (mag[i] > m)
+            m = mag[i];
+    }
+
+    /* A full-scale sine peaks at n / 4 with a Hann window */
+    float db = 20.0f * log10f(m / (n / 4.0f) + 1e-9f);
+    if (db < FLOOR_DB)
+        return 0.0f;
+    if (db > 0.0f)
+        return 1.0f;
+    return 1.0f - db / FLOOR_DB;
+}
+
+/*----------------------------------------------------------------------------
+ * main
+ *
+ *----------------------------------------------------------------------------*/
+int main(int argc, char **argv)
+{
+    Input in = {stdin, 48000, 2, {0}, 0};
+    int waterfall = 0;
+    int n = 2048;
+    int opt;
+    char c;
+
+    while ((opt = getopt(argc, argv, "wr:c:n:")) != -1) {
+        switch (opt) {
+        case 'w': waterfall = 1; break;
+        case 'r': in.rate = atoi(optarg); break;
+        case 'c': in.channels = atoi(optarg); break;
+        case 'n': n = atoi(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-w] [-r rate] [-c channels] [-n size] [file]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (n < 64 || (n & (n - 1))) {
+        fprintf(stderr, "%s: size must be a power of two of at least 64\n", argv[0]);
+        return 1;
+    }
+    if (optind < argc && !(in.fp = fopen(argv[optind], "rb"))) {
+        perror(argv[optind]);
+        return 1;
+    }
+    if (openInput(&in) < 0 || in.rate <= 0 || in.channels <= 0 || in.channels > MAX_CHANNELS) {
+        fprintf(stderr, "%s: only 16-bit PCM of up to %d channels is supported\n", argv[0], MAX_CHANNELS);
+        return 1;
+    }
+
+    /* A regular file would be read far faster than real time, so pace it
+     * by the clock; pipes and devices deliver audio at their own speed. */
+    struct stat st;
+    int paced = fstat(fileno(in.fp), &st) == 0 && S_ISREG(st.st_mode);
+    int keys = in.fp != stdin;
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    initLouis();
+
+    Surface s;
+    initSurface(&s);
+
+    int hop = in.rate / FRAMES_PER_SECOND;
+    int dotsX = s.width * 2, dotsY = s.height * 4;
+    float *samples = (float *)calloc(n + hop, sizeof(float));
+    float *mag = (float *)malloc((n / 2 + 1) * sizeof(float));
+    int *edge = (int *)malloc(((dotsX > dotsY ? dotsX : dotsY) + 1) * sizeof(int));
+    FFT fft;
+    initFFT(&fft, n);
+    mapBins(edge, waterfall ? dotsY : dotsX, n, in.rate);
+
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (long frame = 0; !quit; ++frame) {
+        if (keys && readInput(&c, 1) == 1 && c == 'q')
+            break;
+
+        /* Slide the analysis window along by one hop */
+        int got = readMono(&in, samples + n, hop);
+        if (got == 0)
+            break;
+        memmove(samples, samples + got, n * sizeof(float));
+
+        runFFT(&fft, samples, mag);
+
+        if (waterfall) {
+            /* The newest column enters on the right. Its dither pattern
+             * follows the frame count rather than the screen column, so
+             * that neighboring columns use different thresholds as they
+             * scroll past. */
+            scrollSurface(&s, -1, 0);
+            for (int y = 0; y < dotsY; ++y) {
+                float l = level(mag, edge[y], edge[y + 1], n);
+                drawPoint(&s, dotsX - 1, y, l > bayerThreshold(frame, y));
+            }
+        } else {
+            clearSurface(&s);
+            for (int x = 0; x < dotsX; ++x) {
+                int h = level(mag, edge[x], edge[x + 1], n) * (dotsY - 1);
+                if (h > 0)
+                    drawLine(&s, x, 0, x, h);
+            }
+        }
+
+        render(&s);
+
+        if (paced) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            long due = (frame + 1) * 1000000L / FRAMES_PER_SECOND;
+            long elapsed = (now.tv_sec - start.tv_sec) * 1000000L + (now.tv_nsec - start.tv_nsec) / 1000;
+            if (due > elapsed)
+                usleep(due - elapsed);
+        }
+    }
+
+    endLouis();
+    free(s.data);
+    free(samples);
+    free(mag);
+    free(edge);
+
+    return 0;
+}
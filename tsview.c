@@ -0,0 +1,144 @@
+/*----------------------------------------------------------------------------
+ * tsview.c
+ *
+ * This program shows a file of float samples, such as the latencies recorded
+ * in a load test, with the louis graphics library, and makes up files to try
+ * it on:
+ *
+ *     tsview latency.raw
+ *     tsview -g 2500000000 latency.raw
+ *
+ * The first form shows the file. The arrow keys pan, + and - zoom, 0 goes
+ * back to the whole file, and q quits. The file is mapped rather than read,
+ * and indexed while it is on the screen, so even files of many gigabytes
+ * show at once, roughly at first; the parts still drawn from the rough
+ * picture are dotted. The bottom line tells which samples are shown, how
+ * much of the file has been indexed, and how long the frame took.
+ *
+ * -g writes the given number of samples of a latency that wanders about,
+ * with noise and now and then a spike.
+ *----------------------------------------------------------------------------*/
+
+#include "louis.h"
+
+#define GENERATE_CHUNK (1 << 20)
+
+/*----------------------------------------------------------------------------
+ * generate
+ *
+ *----------------------------------------------------------------------------*/
+static int generate(const char *filename, long count)
+{
+    float *chunk = (float *)malloc(GENERATE_CHUNK * sizeof(float));
+    float level = 20.0f;
+
+    FILE *fp = fopen(filename, "wb");
+    if (!fp)
+        return -1;
+
+    for (long done = 0; done < count; done += GENERATE_CHUNK) {
+        int n = (count - done < GENERATE_CHUNK) ? count - done : GENERATE_CHUNK;
+        for (int i = 0; i < n; ++i) {
+            level += (rand() % 2001 - 1000) / 100000.0f;
+            level = (level < 5.0f) ? 5.0f : (level > 80.0f) ? 80.0f : level;
+            float noise = (rand() % 1000) / 200.0f;
+            chunk[i] = level + noise + ((rand() % 100000 == 0) ? rand() % 500 : 0);
+        }
+        if (fwrite(chunk, sizeof(float), n, fp) != (size_t)n) {
+            fclose(fp);
+            free(chunk);
+            return -1;
+        }
+    }
+    free(chunk);
+
+    return fclose(fp);
+}
+
+/*----------------------------------------------------------------------------
+ * main
+ *
+ *----------------------------------------------------------------------------*/
+int main(int argc, char **argv)
+{
+    SampleFile sf;
+    char c;
+
+    if (argc == 4 && !strcmp(argv[1], "-g")) {
+        if (generate(argv[3], atol(argv[2])) < 0) {
+            perror(argv[3]);
+            return 1;
+        }
+        return 0;
+    }
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s file | -g samples file\n", argv[0]);
+        return 1;
+    }
+
+    initLouis();
+
+    if (openSampleFile(&sf, argv[1]) < 0) {
+        endLouis();
+        perror(argv[1]);
+        return 1;
+    }
+
+    Surface s;
+    initSurface(&s);
+
+    long first = 0, count = sf.count;
+
+    while (1) {
+        while (readInput(&c, 1) == 1) {
+            long step = count / 5 ? count / 5 : 1;
+            switch (c) {
+            case 'q':
+                goto done;
+            case '+':
+                if (count > s.width) {
+                    first += count / 6;
+                    count -= count / 3;
+                }
+                break;
+            case '-':
+                first -= count / 4;
+                count += count / 2;
+                break;
+            case '0':
+                first = 0;
+                count = sf.count;
+                break;
+            /* The arrow keys send ESC [ A through D */
+            case 'C': first += step; break;
+            case 'D': first -= step; break;
+            }
+            count = (count > sf.count) ? sf.count : count;
+            first = (first > sf.count - count) ? sf.count - count : first;
+            first = (first < 0) ? 0 : first;
+        }
+
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        clearSurface(&s);
+        int rough = drawSamples(&s, &sf, first, count, 0, 4, s.width * 2, s.height * 4 - 4);
+        render(&s);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+
+        char status[160];
+        int len = snprintf(status, sizeof(status),
+                           "\x1b[%d;1H\x1b[Ksamples %ld to %ld of %ld, %.0f%% indexed, %d rough, %.1f ms\x1b[H",
+                           s.height, first, first + count, sf.count, sampleProgress(&sf) * 100, rough,
+                           (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6);
+        writeOutput(status, len);
+
+        usleep(20000);
+    }
+
+done:
+    endLouis();
+    closeSampleFile(&sf);
+    free(s.data);
+
+    return 0;
+}